@@ -1,6 +1,8 @@
 #include "6502.h"
 #include "Console.h"
 
+#include <cstring>
+
 void CPU::setCarryFlag() {
 	status |= 0x01;
 }
@@ -2237,6 +2239,76 @@ CPU::CPU(Console *con) {
 	console = con;
 }
 
+//Everything in the CPU that changes as it runs, the lookup table and the
+//console pointer never do
+struct CPUState {
+	uint16_t programCounter;
+	uint8_t stackPointer;
+	uint8_t status;
+	uint8_t acc;
+	uint8_t x;
+	uint8_t y;
+	bool inInstruction;
+	bool inInterrupt;
+	bool irqWaiting;
+	bool nmiWaiting;
+	bool resetWaiting;
+	uint8_t currentOp;
+	AddressMode currentMode;
+	uint16_t addressTemp;
+	uint16_t addressTempInd;
+	int16_t dataTemp;
+	int cycleCounter;
+};
+
+size_t CPU::stateSize() {
+	return sizeof(CPUState);
+}
+
+void CPU::saveState(uint8_t *state) {
+	CPUState saved;
+	saved.programCounter = programCounter;
+	saved.stackPointer = stackPointer;
+	saved.status = status;
+	saved.acc = acc;
+	saved.x = x;
+	saved.y = y;
+	saved.inInstruction = inInstruction;
+	saved.inInterrupt = inInterrupt;
+	saved.irqWaiting = irqWaiting;
+	saved.nmiWaiting = nmiWaiting;
+	saved.resetWaiting = resetWaiting;
+	saved.currentOp = currentOp;
+	saved.currentMode = currentMode;
+	saved.addressTemp = addressTemp;
+	saved.addressTempInd = addressTempInd;
+	saved.dataTemp = dataTemp;
+	saved.cycleCounter = cycleCounter;
+	memcpy(state, &saved, sizeof(saved));
+}
+
+void CPU::loadState(const uint8_t *state) {
+	CPUState saved;
+	memcpy(&saved, state, sizeof(saved));
+	programCounter = saved.programCounter;
+	stackPointer = saved.stackPointer;
+	status = saved.status;
+	acc = saved.acc;
+	x = saved.x;
+	y = saved.y;
+	inInstruction = saved.inInstruction;
+	inInterrupt = saved.inInterrupt;
+	irqWaiting = saved.irqWaiting;
+	nmiWaiting = saved.nmiWaiting;
+	resetWaiting = saved.resetWaiting;
+	currentOp = saved.currentOp;
+	currentMode = saved.currentMode;
+	addressTemp = saved.addressTemp;
+	addressTempInd = saved.addressTempInd;
+	dataTemp = saved.dataTemp;
+	cycleCounter = saved.cycleCounter;
+}
+
 void CPU::cycle() {
 	if (inInstruction) {
 		//perform the function for the current op
@@ -2,6 +2,7 @@
 #define CPU_H
 
 #include <cstdint>
+#include <cstddef>
 #include <exception>
 #include <string>
 
@@ -293,6 +294,14 @@ public:
 	Operation performNextInstruction();
 
 	uint8_t readWord(uint16_t address);
+
+	//Snapshot of the registers and whatever instruction or interrupt is
+	//partway through, see Console::saveState
+	size_t stateSize();
+
+	void saveState(uint8_t *state);
+
+	void loadState(const uint8_t *state);
 };
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "Debug.h"
 
 #include <iostream>
+#include <cstring>
 
 using namespace std;
 
@@ -432,4 +433,199 @@ void APU::writeFrameCounter(uint8_t data) {
 
 bool APU::irqWaiting() {
 	return frameIRQ;
-}
\ No newline at end of file
+}
+
+//Every channel, counter and the frame sequencer. The length table is a
+//constant and the console stays put, so neither is in it
+struct APUState {
+	bool sequenceMode;
+	bool irqDisabled;
+	int8_t step;
+	int32_t divider;
+	uint8_t channelsEnabled;
+	bool cycleSwitch;
+	bool clockWaiting;
+	bool pulseCounterHaltBuf0;
+	bool pulseCounterHaltBuf1;
+	bool triCounterHaltBuf;
+	bool noiseCounterHaltBuf;
+
+	//Pulse channel 0
+	uint16_t pulseTimer0;
+	uint8_t pulseDuty0;
+	int16_t pulseCounter0;
+	bool pulseCounterHalt0;
+	bool pulseVolMode0;
+	uint8_t pulseVol0;
+	bool pulseSweepEnabled0;
+	uint8_t pulseDivider0;
+	bool pulseNegate0;
+	uint8_t pulseShift0;
+	bool pulseReload0;
+
+	//Pulse channel 1
+	uint16_t pulseTimer1;
+	uint8_t pulseDuty1;
+	int16_t pulseCounter1;
+	bool pulseCounterHalt1;
+	bool pulseVolMode1;
+	uint8_t pulseVol1;
+	bool pulseSweepEnabled1;
+	uint8_t pulseDivider1;
+	bool pulseNegate1;
+	uint8_t pulseShift1;
+	bool pulseReload1;
+
+	//Triangle channel
+	uint16_t triTimer;
+	int16_t triCounter;
+	bool triCounterHalt;
+	int16_t triLinCounter;
+	bool triReload;
+
+	//Noise channel
+	uint16_t noiseTimer;
+	int16_t noiseCounter;
+	bool noiseCounterHalt;
+	bool noiseVolMode;
+	uint8_t noiseVol;
+	bool noiseMode;
+	uint16_t noisePeriod;
+
+	//DMC channel
+	bool dmcIRQEnabled;
+	bool dmcIRQ;
+	bool dmcLoopFlag;
+	uint16_t dmcFreq;
+	uint8_t dmcOutput;
+	uint8_t dmcAddress;
+	uint16_t dmcSampleLength;
+
+	int8_t irqSet;
+	bool frameIRQ;
+	int16_t frameCounterReset;
+};
+
+size_t APU::stateSize() {
+	return sizeof(APUState);
+}
+
+void APU::saveState(uint8_t *state) {
+	APUState saved;
+	saved.sequenceMode = sequenceMode;
+	saved.irqDisabled = irqDisabled;
+	saved.step = step;
+	saved.divider = divider;
+	saved.channelsEnabled = channelsEnabled;
+	saved.cycleSwitch = cycleSwitch;
+	saved.clockWaiting = clockWaiting;
+	saved.pulseCounterHaltBuf0 = pulseCounterHaltBuf0;
+	saved.pulseCounterHaltBuf1 = pulseCounterHaltBuf1;
+	saved.triCounterHaltBuf = triCounterHaltBuf;
+	saved.noiseCounterHaltBuf = noiseCounterHaltBuf;
+	saved.pulseTimer0 = pulseTimer0;
+	saved.pulseDuty0 = pulseDuty0;
+	saved.pulseCounter0 = pulseCounter0;
+	saved.pulseCounterHalt0 = pulseCounterHalt0;
+	saved.pulseVolMode0 = pulseVolMode0;
+	saved.pulseVol0 = pulseVol0;
+	saved.pulseSweepEnabled0 = pulseSweepEnabled0;
+	saved.pulseDivider0 = pulseDivider0;
+	saved.pulseNegate0 = pulseNegate0;
+	saved.pulseShift0 = pulseShift0;
+	saved.pulseReload0 = pulseReload0;
+	saved.pulseTimer1 = pulseTimer1;
+	saved.pulseDuty1 = pulseDuty1;
+	saved.pulseCounter1 = pulseCounter1;
+	saved.pulseCounterHalt1 = pulseCounterHalt1;
+	saved.pulseVolMode1 = pulseVolMode1;
+	saved.pulseVol1 = pulseVol1;
+	saved.pulseSweepEnabled1 = pulseSweepEnabled1;
+	saved.pulseDivider1 = pulseDivider1;
+	saved.pulseNegate1 = pulseNegate1;
+	saved.pulseShift1 = pulseShift1;
+	saved.pulseReload1 = pulseReload1;
+	saved.triTimer = triTimer;
+	saved.triCounter = triCounter;
+	saved.triCounterHalt = triCounterHalt;
+	saved.triLinCounter = triLinCounter;
+	saved.triReload = triReload;
+	saved.noiseTimer = noiseTimer;
+	saved.noiseCounter = noiseCounter;
+	saved.noiseCounterHalt = noiseCounterHalt;
+	saved.noiseVolMode = noiseVolMode;
+	saved.noiseVol = noiseVol;
+	saved.noiseMode = noiseMode;
+	saved.noisePeriod = noisePeriod;
+	saved.dmcIRQEnabled = dmcIRQEnabled;
+	saved.dmcIRQ = dmcIRQ;
+	saved.dmcLoopFlag = dmcLoopFlag;
+	saved.dmcFreq = dmcFreq;
+	saved.dmcOutput = dmcOutput;
+	saved.dmcAddress = dmcAddress;
+	saved.dmcSampleLength = dmcSampleLength;
+	saved.irqSet = irqSet;
+	saved.frameIRQ = frameIRQ;
+	saved.frameCounterReset = frameCounterReset;
+	memcpy(state, &saved, sizeof(saved));
+}
+
+void APU::loadState(const uint8_t *state) {
+	APUState saved;
+	memcpy(&saved, state, sizeof(saved));
+	sequenceMode = saved.sequenceMode;
+	irqDisabled = saved.irqDisabled;
+	step = saved.step;
+	divider = saved.divider;
+	channelsEnabled = saved.channelsEnabled;
+	cycleSwitch = saved.cycleSwitch;
+	clockWaiting = saved.clockWaiting;
+	pulseCounterHaltBuf0 = saved.pulseCounterHaltBuf0;
+	pulseCounterHaltBuf1 = saved.pulseCounterHaltBuf1;
+	triCounterHaltBuf = saved.triCounterHaltBuf;
+	noiseCounterHaltBuf = saved.noiseCounterHaltBuf;
+	pulseTimer0 = saved.pulseTimer0;
+	pulseDuty0 = saved.pulseDuty0;
+	pulseCounter0 = saved.pulseCounter0;
+	pulseCounterHalt0 = saved.pulseCounterHalt0;
+	pulseVolMode0 = saved.pulseVolMode0;
+	pulseVol0 = saved.pulseVol0;
+	pulseSweepEnabled0 = saved.pulseSweepEnabled0;
+	pulseDivider0 = saved.pulseDivider0;
+	pulseNegate0 = saved.pulseNegate0;
+	pulseShift0 = saved.pulseShift0;
+	pulseReload0 = saved.pulseReload0;
+	pulseTimer1 = saved.pulseTimer1;
+	pulseDuty1 = saved.pulseDuty1;
+	pulseCounter1 = saved.pulseCounter1;
+	pulseCounterHalt1 = saved.pulseCounterHalt1;
+	pulseVolMode1 = saved.pulseVolMode1;
+	pulseVol1 = saved.pulseVol1;
+	pulseSweepEnabled1 = saved.pulseSweepEnabled1;
+	pulseDivider1 = saved.pulseDivider1;
+	pulseNegate1 = saved.pulseNegate1;
+	pulseShift1 = saved.pulseShift1;
+	pulseReload1 = saved.pulseReload1;
+	triTimer = saved.triTimer;
+	triCounter = saved.triCounter;
+	triCounterHalt = saved.triCounterHalt;
+	triLinCounter = saved.triLinCounter;
+	triReload = saved.triReload;
+	noiseTimer = saved.noiseTimer;
+	noiseCounter = saved.noiseCounter;
+	noiseCounterHalt = saved.noiseCounterHalt;
+	noiseVolMode = saved.noiseVolMode;
+	noiseVol = saved.noiseVol;
+	noiseMode = saved.noiseMode;
+	noisePeriod = saved.noisePeriod;
+	dmcIRQEnabled = saved.dmcIRQEnabled;
+	dmcIRQ = saved.dmcIRQ;
+	dmcLoopFlag = saved.dmcLoopFlag;
+	dmcFreq = saved.dmcFreq;
+	dmcOutput = saved.dmcOutput;
+	dmcAddress = saved.dmcAddress;
+	dmcSampleLength = saved.dmcSampleLength;
+	irqSet = saved.irqSet;
+	frameIRQ = saved.frameIRQ;
+	frameCounterReset = saved.frameCounterReset;
+}
@@ -2,6 +2,7 @@
 #define APU_H
 
 #include <cstdint>
+#include <cstddef>
 
 #define SEQMODE_4STEP 0x00
 #define SEQMODE_5STEP 0x01
@@ -161,6 +162,14 @@ public:
 	void writeFrameCounter(uint8_t data);
 
 	bool irqWaiting();
+
+	//Snapshot of every channel, counter and the frame sequencer, see
+	//Console::saveState
+	size_t stateSize();
+
+	void saveState(uint8_t *state);
+
+	void loadState(const uint8_t *state);
 };
 
 #endif
\ No newline at end of file
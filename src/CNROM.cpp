@@ -28,10 +28,19 @@ void CNROM::cpuWrite(uint16_t address, uint8_t data) {
 	//PRG-ROM region
 	if (address >= 0x8000) {
 		chrROMBank = data;
+		updatePPUPages();
 	}
 
 }
 
+void CNROM::updatePPUPages() {
+	for (int i = 0; i < 8; i++)
+		chrPages[i] = chrROM + (0x2000 * chrROMBank) + (i * PPU_PAGE_SIZE);
+
+	for (int i = 0; i < 4; i++)
+		nametablePages[i] = vram + (mirroringTable[i] * PPU_PAGE_SIZE);
+}
+
 uint8_t CNROM::ppuRead(uint16_t address) {
 	if (address < 0x2000) {
 		cout << "Read address " << hex << address << " from bank " << +chrROMBank << endl;
@@ -95,6 +104,8 @@ CNROM::CNROM(Console *con, RomImage *rom) {
 		mirroringTable[2] = 0;
 		mirroringTable[3] = 1;
 	}
+
+	updatePPUPages();
 }
 
 CNROM::~CNROM() {
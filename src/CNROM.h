@@ -29,6 +29,9 @@ class CNROM: public Mapper {
 
 	uint8_t mirroringTable[4];
 
+	//Points the PPU pages at the current CHR bank and mirrored nametables
+	void updatePPUPages();
+
 public:
 	CNROM(Console *con, RomImage *rom);
 
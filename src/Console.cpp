@@ -1,36 +1,585 @@
 #include "Console.h"
 #include "6502.h"
+#include "PPU.h"
+#include "APU.h"
+#include "ROM.h"
+#include "Mapper.h"
+#include "Controller.h"
+#include "PPUThread.h"
+#include "PPURecorder.h"
 
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+using namespace std;
+
+static int64_t timerNow() {
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Console::Console(RomImage *rom) {
+	mapper = rom->getMapper(this);
+
+	init();
+}
+
+Console::Console(Mapper *mapper) {
+	this->mapper = mapper;
+
+	init();
+}
+
+void Console::init() {
+	ram = (uint8_t *) malloc(CPU_RAM_SIZE);
 
-Console::Console(uint8_t *memory) {
 	cpu = new CPU(this);
 
+	ppu = new PPU(this);
+
+	apu = new APU(this);
+
+	controller1 = new Controller();
+
+	controller2 = new Controller();
+
+	openBus = 0x00;
+
+	dmaCycle = 0;
+	dmaAddress = 0x0000;
+	dmaData = 0x00;
+
+	cpuCycles = 0;
+
+	frameReady = false;
+
+	//Mappers watching the PPU's fetches (e.g. MMC3's A12 IRQ counter) need
+	//them to happen on the CPU cycle they belong to, catching up later would
+	//make their IRQs late, so those stay in lockstep
+	ppuCatchUp = !mapper->notifiesFetches();
+	ppuPendingDots = 0;
+	ppuDeadline = ppu->dotsUntilEvent();
+
+	ppuThread = NULL;
+	ppuClock = 0;
+
+	ppuExtraLine = false;
+
+	ppuRecorder = NULL;
+
+	runAheadState = NULL;
+
+	timing = false;
+	timingTotal = 0;
+	timingPPU = 0;
+	timingAPU = 0;
+	timerOverhead = 0;
+
 	cpu->raiseReset();
+}
 
-	ram = memory;
+Console::~Console() {
+	delete ppuRecorder;
+	delete ppuThread;
+	delete cpu;
+	delete ppu;
+	delete apu;
+	delete controller1;
+	delete controller2;
+	free(ram);
+	free(runAheadState);
+	//The mapper frees the RomImage it was created from, and that
+	//belongs to whoever created the console, so it isn't deleted here
 }
 
 uint8_t Console::debugRead(uint16_t address) {
-	return ram[address];
+	//Internal RAM
+	if (address < 0x2000) {
+		return ram[address & 0x07FF];
+	}
+	//PPU registers
+	else if (address < 0x4000) {
+		syncPPU();
+		return ppu->debugReadRegister(address & 0x0007);
+	}
+	//Cartridge space
+	else if (address >= 0x4020) {
+		return mapper->debugCpuRead(address);
+	}
+	else {
+		return openBus;
+	}
 }
 
 uint8_t Console::cpuRead(uint16_t address) {
-	return ram[address];
+	//Internal RAM
+	if (address < 0x2000) {
+		openBus = ram[address & 0x07FF];
+	}
+	//PPU registers, mirrored every 8 bytes
+	else if (address < 0x4000) {
+		syncPPU();
+		openBus = ppu->readRegister(address & 0x0007);
+		if (ppuRecorder)
+			ppuRecorder->registerRead(ppuTime(), address & 0x0007, openBus);
+	}
+	//APU status, bit 5 is open bus
+	else if (address == 0x4015) {
+		openBus = apu->readStatus() | (openBus & 0x20);
+	}
+	//Controllers only drive the low bit
+	else if (address == 0x4016) {
+		openBus = (openBus & 0xE0) | controller1->read();
+	}
+	else if (address == 0x4017) {
+		openBus = (openBus & 0xE0) | controller2->read();
+	}
+	//Cartridge space
+	else if (address >= 0x4020) {
+		openBus = mapper->cpuRead(address);
+	}
+
+	return openBus;
 }
 
 void Console::cpuWrite(uint16_t address, uint8_t data) {
-	//cout << "Write:" << endl;
-	//cout << "Address\t" << hex << address << endl;
-	//cout << "Data\t" << hex << +data << endl; 
-	ram[address] = data;
+	openBus = data;
+
+	//Internal RAM
+	if (address < 0x2000) {
+		ram[address & 0x07FF] = data;
+	}
+	//PPU registers, mirrored every 8 bytes
+	else if (address < 0x4000) {
+		if (ppuRecorder)
+			ppuRecorder->registerWrite(ppuTime(), address & 0x0007, data);
+
+		if (ppuThread && (address & 0x0007) != PPUCTRL) {
+			ppuThread->push(ppuClock, PPU_EVENT_WRITE, address & 0x0007, data);
+		}
+		else {
+			syncPPU();
+			ppu->writeRegister(address & 0x0007, data);
+		}
+	}
+	//OAM DMA, takes an extra cycle if started on an odd CPU cycle
+	else if (address == 0x4014) {
+		dmaAddress = data << 8;
+		dmaCycle = (cpuCycles % 2) ? 514 : 513;
+	}
+	else if (address == 0x4015) {
+		apu->writeControl(data);
+	}
+	//Controller strobe goes to both controllers
+	else if (address == 0x4016) {
+		if (data & 0x01) {
+			controller1->strobeHigh();
+			controller2->strobeHigh();
+		}
+		else {
+			controller1->strobeLow();
+			controller2->strobeLow();
+		}
+	}
+	else if (address == 0x4017) {
+		apu->writeFrameCounter(data);
+	}
+	//APU channel registers
+	else if (address < 0x4014) {
+		apu->writeRegister(address & 0x001F, data);
+	}
+	//Cartridge space, bank switches change what the PPU sees
+	else if (address >= 0x4020) {
+		syncPPU();
+		ppu->pagesChanging();
+		mapper->cpuWrite(address, data);
+		ppu->nametablesChanged();
+		if (ppuRecorder)
+			ppuRecorder->pagesChanged(ppuTime());
+	}
+}
+
+uint8_t Console::ppuRead(uint16_t address) {
+	return mapper->ppuRead(address & 0x3FFF);
+}
+
+void Console::ppuWrite(uint16_t address, uint8_t data) {
+	mapper->ppuWrite(address & 0x3FFF, data);
+}
+
+uint8_t Console::getOpenBus() {
+	return openBus;
+}
+
+void Console::raiseNMI() {
+	cpu->raiseNMI();
+}
+
+//The DMA unit halts the CPU and copies a page of CPU memory into OAM
+//one byte every two cycles. Any alignment cycles come first
+void Console::performDMA() {
+	if (dmaCycle > 512) {
+		//Waiting for alignment
+	}
+	else if (dmaCycle % 2 == 0) {
+		dmaData = cpuRead(dmaAddress);
+		dmaAddress++;
+	}
+	else {
+		if (ppuRecorder)
+			ppuRecorder->dmaWrite(ppuTime(), dmaData);
+
+		//The first write is where the PPU's stats count the DMA
+		if (ppuThread) {
+			if (dmaCycle == 511)
+				ppuThread->push(ppuClock, PPU_EVENT_DMA, 0, 0);
+			ppuThread->push(ppuClock, PPU_EVENT_WRITE, OAMDATA, dmaData);
+		}
+		else {
+			syncPPU();
+			if (dmaCycle == 511)
+				ppu->oamDMAStarted();
+			ppu->writeRegister(OAMDATA, dmaData);
+		}
+	}
+	dmaCycle--;
+}
+
+void Console::syncPPU() {
+	if (!ppuThread && ppuPendingDots == 0)
+		return;
+
+	int64_t start = timing ? timerNow() : 0;
+
+	if (ppuThread) {
+		ppuThread->advance(ppuClock);
+		if (ppuThread->wait())
+			frameReady = true;
+	}
+	else if (ppu->runDots(ppuPendingDots)) {
+		frameReady = true;
+	}
+
+	ppuPendingDots = 0;
+	ppuDeadline = ppu->dotsUntilEvent();
+	ppuExtraLine = ppu->onExtraLine();
+
+	if (timing)
+		timingPPU += timerNow() - start;
+}
+
+void Console::cycle() {
+	if (dmaCycle)
+		performDMA();
+	else
+		cpu->cycle();
+
+	bool sample = timing && (cpuCycles & (CONSOLE_TIMING_SAMPLE - 1)) == 0;
+
+	if (!ppuExtraLine) {
+		int64_t start = sample ? timerNow() : 0;
+		apu->cycle();
+		if (sample)
+			timingAPU += (timerNow() - start - timerOverhead) * CONSOLE_TIMING_SAMPLE;
+	}
+
+	if (ppuThread) {
+		ppuClock += PPU_CYCLES_PER_CPU_CYCLE;
+		ppuPendingDots += PPU_CYCLES_PER_CPU_CYCLE;
+		if (ppuPendingDots >= ppuDeadline)
+			syncPPU();
+		else
+			ppuThread->advance(ppuClock);
+	}
+	else if (ppuCatchUp) {
+		ppuPendingDots += PPU_CYCLES_PER_CPU_CYCLE;
+		//Catch up on the same cycle lockstep would have hit the event on
+		if (ppuPendingDots >= ppuDeadline)
+			syncPPU();
+	}
+	else {
+		int64_t start = sample ? timerNow() : 0;
+		for (int i = 0; i < PPU_CYCLES_PER_CPU_CYCLE; i++) {
+			ppu->cycle();
+			if (ppu->endOfFrame())
+				frameReady = true;
+		}
+		ppuExtraLine = ppu->onExtraLine();
+		if (sample)
+			timingPPU += (timerNow() - start - timerOverhead) * CONSOLE_TIMING_SAMPLE;
+	}
+
+	cpuCycles++;
+}
+
+void Console::setPPUCatchUp(bool enabled) {
+	syncPPU();
+	ppuCatchUp = enabled && !mapper->notifiesFetches();
+	ppuDeadline = ppu->dotsUntilEvent();
+}
+
+void Console::setOverclock(int linesBeforeNMI, int linesAfterNMI) {
+	syncPPU();
+	ppu->setOverclock(linesBeforeNMI, linesAfterNMI);
+	ppuDeadline = ppu->dotsUntilEvent();
+}
+
+void Console::runFrame() {
+	int64_t start = timing ? timerNow() : 0;
+
+	frameReady = false;
+	while (!frameReady)
+		cycle();
+
+	if (timing)
+		timingTotal += timerNow() - start;
+
+	if (ppuRecorder && ppuRecorder->frameEnded(ppuTime(), ppu->getFrame(), ppu->frameDisplayed())) {
+		delete ppuRecorder;
+		ppuRecorder = NULL;
+	}
+}
+
+void Console::runFrameAhead(int frames) {
+	//Recording would log the frames that get thrown away, and a mapper that
+	//can't be snapshotted wouldn't come back from them
+	if (frames <= 0 || ppuRecorder || !mapper->hasState()) {
+		runFrame();
+		return;
+	}
+
+	if (!runAheadState)
+		runAheadState = (uint8_t *) malloc(stateSize());
+
+	syncPPU();
+	ppu->hideNextFrame();
+	runFrame();
+	saveState(runAheadState);
+
+	for (int i = 0; i < frames; i++) {
+		if (i < frames - 1) {
+			syncPPU();
+			ppu->hideNextFrame();
+		}
+		runFrame();
+	}
+
+	loadState(runAheadState);
+}
+
+//What the console itself keeps besides RAM. ppuClock isn't in it, it only
+//has to agree with the PPU thread's clock and that keeps counting up
+struct ConsoleState {
+	uint8_t openBus;
+	uint16_t dmaCycle;
+	uint16_t dmaAddress;
+	uint8_t dmaData;
+	uint64_t cpuCycles;
+	bool frameReady;
+};
+
+size_t Console::stateSize() {
+	return sizeof(ConsoleState) + CPU_RAM_SIZE + cpu->stateSize() + ppu->stateSize() + apu->stateSize()
+		+ controller1->stateSize() + controller2->stateSize() + mapper->stateSize();
+}
+
+void Console::saveState(uint8_t *state) {
+	//Pending dots are run first so the PPU is at the same point as the CPU
+	syncPPU();
+
+	ConsoleState saved;
+	saved.openBus = openBus;
+	saved.dmaCycle = dmaCycle;
+	saved.dmaAddress = dmaAddress;
+	saved.dmaData = dmaData;
+	saved.cpuCycles = cpuCycles;
+	saved.frameReady = frameReady;
+	memcpy(state, &saved, sizeof(saved));
+	state += sizeof(saved);
+
+	memcpy(state, ram, CPU_RAM_SIZE);
+	state += CPU_RAM_SIZE;
+
+	cpu->saveState(state);
+	state += cpu->stateSize();
+	ppu->saveState(state);
+	state += ppu->stateSize();
+	apu->saveState(state);
+	state += apu->stateSize();
+	controller1->saveState(state);
+	state += controller1->stateSize();
+	controller2->saveState(state);
+	state += controller2->stateSize();
+	mapper->saveState(state);
+}
+
+void Console::loadState(const uint8_t *state) {
+	//Leaves the PPU thread idle and nothing pending
+	syncPPU();
+
+	ConsoleState saved;
+	memcpy(&saved, state, sizeof(saved));
+	state += sizeof(saved);
+	openBus = saved.openBus;
+	dmaCycle = saved.dmaCycle;
+	dmaAddress = saved.dmaAddress;
+	dmaData = saved.dmaData;
+	cpuCycles = saved.cpuCycles;
+	frameReady = saved.frameReady;
+
+	memcpy(ram, state, CPU_RAM_SIZE);
+	state += CPU_RAM_SIZE;
+
+	cpu->loadState(state);
+	state += cpu->stateSize();
+	ppu->loadState(state);
+	state += ppu->stateSize();
+	apu->loadState(state);
+	state += apu->stateSize();
+	controller1->loadState(state);
+	state += controller1->stateSize();
+	controller2->loadState(state);
+	state += controller2->stateSize();
+	mapper->loadState(state);
+	ppu->vramLoaded();
+
+	ppuPendingDots = 0;
+	ppuDeadline = ppu->dotsUntilEvent();
+	ppuExtraLine = ppu->onExtraLine();
+}
+
+uint64_t Console::ppuTime() {
+	return cpuCycles * PPU_CYCLES_PER_CPU_CYCLE;
+}
+
+bool Console::recordPPU(const char *filename, int frames) {
+	//The log starts from the PPU's power on state
+	if (cpuCycles != 0) {
+		cout << "Error: PPU recording has to start before the console runs" << endl;
+		return false;
+	}
+
+	delete ppuRecorder;
+	ppuRecorder = new PPURecorder(filename, ppu, mapper, frames);
+	if (!ppuRecorder->isOpen()) {
+		cout << "Error: failed to open " << filename << " for PPU recording" << endl;
+		delete ppuRecorder;
+		ppuRecorder = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+Frame Console::getFrame() {
+	runFrame();
+	return ppu->getFrame();
+}
+
+void Console::setPPUThreaded(bool enabled) {
+	syncPPU();
+	//Same as catch-up, fetch-watching mappers have to stay in lockstep
+	if (enabled && !ppuThread && !mapper->notifiesFetches()) {
+		ppuClock = 0;
+		ppuThread = new PPUThread(ppu, ppuClock);
+	}
+	else if (!enabled && ppuThread) {
+		delete ppuThread;
+		ppuThread = NULL;
+	}
+	ppuDeadline = ppu->dotsUntilEvent();
+}
+
+void Console::setTiming(bool enabled) {
+	timing = enabled;
+
+	//Back to back reads, the smallest a sample can ever come out as
+	if (enabled) {
+		int64_t total = 0;
+		for (int i = 0; i < 1000; i++) {
+			int64_t start = timerNow();
+			total += timerNow() - start;
+		}
+		timerOverhead = total / 1000;
+	}
+
+	takeTimings();
+}
+
+ConsoleTimings Console::takeTimings() {
+	//Samples can come out a little negative after taking the overhead off,
+	//and syncs outside runFrame add PPU time without adding to the total
+	if (timingAPU < 0)
+		timingAPU = 0;
+	int64_t cpu = timingTotal - timingPPU - timingAPU;
+	if (cpu < 0)
+		cpu = 0;
+
+	ConsoleTimings result;
+	result.cpu = cpu / 1e6;
+	result.ppu = timingPPU / 1e6;
+	result.apu = timingAPU / 1e6;
+
+	timingTotal = 0;
+	timingPPU = 0;
+	timingAPU = 0;
+
+	return result;
+}
+
+void Console::setFrameskip(uint8_t ratio) {
+	syncPPU();
+	ppu->setFrameskip(ratio);
+}
+
+void Console::displayNextFrame() {
+	syncPPU();
+	ppu->displayNextFrame();
+}
+
+void Console::setVideoOutput(uint32_t *buffer, int pitch, uint8_t format) {
+	syncPPU();
+	ppu->setVideoOutput(buffer, pitch, format);
+}
+
+void Console::setDeferredRendering(bool enabled, int threads) {
+	syncPPU();
+	ppu->setDeferredRendering(enabled, threads);
+}
+
+Controller *Console::getController1() {
+	return controller1;
+}
+
+Controller *Console::getController2() {
+	return controller2;
 }
 
 CPU *Console::getCPU() {
 	return cpu;
 }
 
-Console::~Console() {
-	delete cpu;
-	delete ram;
-}
\ No newline at end of file
+Mapper *Console::getMapper() {
+	return mapper;
+}
+
+PPU *Console::getPPU() {
+	return ppu;
+}
+
+uint64_t Console::getCPUCycles() {
+	return cpuCycles;
+}
+
+void Console::debug() {
+	string input;
+	while (input != "q") {
+		cout << hex << "PC:" << cpu->getProgramCounter();
+		Operation op = cpu->performNextInstruction();
+		cout << "\t" << op.name;
+		cout << "\tA:" << +cpu->getAcc() << " X:" << +cpu->getX() << " Y:" << +cpu->getY();
+		cout << " P:" << +cpu->getStatus() << " SP:" << +cpu->getStackPointer() << endl;
+		getline(cin, input);
+	}
+}
@@ -2,28 +2,123 @@
 #define CONSOLE_H
 
 #include <cstdint>
+#include <cstddef>
 
-#define CPU_RAM_SIZE 65535
+//Internal CPU RAM, mirrored through $0000-$1FFF
+#define CPU_RAM_SIZE 0x0800
 
+//Number of PPU cycles per CPU cycle (NTSC)
+#define PPU_CYCLES_PER_CPU_CYCLE 3
 
-//***********************************
-//	Pretty much all of this code
-//	is placeholder code for testing
-//	the new CPU implementation
-//***********************************
-
+//With timing on, work done every CPU cycle (the APU, and the PPU in
+//lockstep) is only timed one cycle in this many, must be a power of 2
+#define CONSOLE_TIMING_SAMPLE 64
 
 class CPU;
+class PPU;
+class APU;
+class Mapper;
+class RomImage;
+class Controller;
+class PPUThread;
+class PPURecorder;
+
+struct Frame;
+
+//Time spent on each part of the console in ms, see setTiming
+struct ConsoleTimings {
+	double cpu;
+	double ppu;
+	double apu;
+};
 
 class Console {
 private:
 
 	CPU *cpu;
 
+	PPU *ppu;
+
+	APU *apu;
+
+	Mapper *mapper;
+
+	Controller *controller1;
+
+	Controller *controller2;
+
 	uint8_t *ram;
 
+	//Holds the last value that was on the CPU data bus
+	//Reads from unmapped addresses return this
+	uint8_t openBus;
+
+	//OAM DMA ($4014) state
+	//While dmaCycle is not 0 the CPU is halted and the DMA unit
+	//alternates between reading from dmaAddress and writing to OAMDATA
+	uint16_t dmaCycle;
+	uint16_t dmaAddress;
+	uint8_t dmaData;
+
+	//Counts CPU cycles since power on, used to align DMA to even cycles
+	uint64_t cpuCycles;
+
+	//Set when the PPU reaches the end of a frame during Console::cycle
+	bool frameReady;
+
+	//In catch-up mode the PPU isn't stepped every CPU cycle, its dots pile
+	//up in ppuPendingDots and are only run when something needs to see the
+	//PPU state: a PPU register access, OAM DMA, a mapper write, or
+	//ppuDeadline being reached (vblank/NMI and end of frame)
+	bool ppuCatchUp;
+	int ppuPendingDots;
+	int ppuDeadline;
+
+	//In threaded mode the PPU runs on ppuThread. Writes to PPU registers
+	//other than PPUCTRL (which can raise an NMI right away) and DMA writes
+	//are queued with ppuClock as their timestamp instead of syncing, the
+	//deadline and everything else that syncs waits for the thread instead
+	PPUThread *ppuThread;
+	uint64_t ppuClock;
+
+	//Set while the PPU is on one of its overclocking lines, the APU isn't
+	//clocked for those. Only changes at a sync, the ends of the extra lines
+	//are deadlines
+	bool ppuExtraLine;
+
+	//Logs everything the PPU sees while set, see recordPPU
+	PPURecorder *ppuRecorder;
+
+	//Snapshot runFrameAhead goes back to, allocated the first time it's used
+	uint8_t *runAheadState;
+
+	//Timing (see setTiming), all in ns. PPU time is measured around each
+	//catch-up, or wait for the PPU thread, APU time and lockstep PPU time
+	//are sampled and scaled up. CPU time is whatever's left of runFrame
+	bool timing;
+	int64_t timingTotal;
+	int64_t timingPPU;
+	int64_t timingAPU;
+
+	//What reading the clock twice costs, taken off each sample
+	int64_t timerOverhead;
+
+	void init();
+
+	void performDMA();
+
+	//PPU dots run since power on, the timestamp for recorded events
+	uint64_t ppuTime();
+
+	//Runs any PPU dots that are still pending
+	void syncPPU();
+
 public:
-	Console(uint8_t *memory);
+	Console(RomImage *rom);
+
+	//For tools that supply their own mapper instead of a cartridge,
+	//the console doesn't take ownership of it
+	Console(Mapper *mapper);
 
 	~Console();
 
@@ -33,7 +128,96 @@ public:
 
 	void cpuWrite(uint16_t address, uint8_t data);
 
+	uint8_t ppuRead(uint16_t address);
+
+	void ppuWrite(uint16_t address, uint8_t data);
+
+	uint8_t getOpenBus();
+
+	void raiseNMI();
+
+	//Performs one CPU cycle and the corresponding PPU/APU cycles
+	void cycle();
+
+	//Runs the console until the PPU finishes the current frame
+	void runFrame();
+
+	//Runs a frame and returns it
+	Frame getFrame();
+
+	//Run-ahead, hides a frame's worth of the game's input lag. Runs the next
+	//frame without showing it, saves a snapshot, runs frames more frames
+	//with the same input showing only the last, then loads the snapshot back.
+	//What's on screen is frames ahead of where the console actually is.
+	//0 is the same as runFrame, and so is anything while recording the PPU or
+	//with a mapper that can't be snapshotted (see Mapper::hasState)
+	void runFrameAhead(int frames);
+
+	//Snapshot of everything that changes as the console runs: RAM, the CPU,
+	//PPU, APU, controllers and mapper. Takes stateSize bytes, it stays the
+	//same as long as the cartridge does. How the PPU is run and its output
+	//settings aren't part of it, and loading doesn't change what's on screen
+	size_t stateSize();
+
+	void saveState(uint8_t *state);
+
+	void loadState(const uint8_t *state);
+
+	//Switches between stepping the PPU in lockstep with the CPU and only
+	//catching it up when needed. Catch-up is the default, both produce
+	//exactly the same results. Mappers that watch PPU fetches always run in
+	//lockstep, this does nothing for them
+	void setPPUCatchUp(bool enabled);
+
+	//Runs the PPU on a separate thread. Results are the same as the other
+	//modes, games that poll PPU registers a lot won't get much out of it.
+	//Does nothing for mappers that watch PPU fetches, see setPPUCatchUp
+	void setPPUThreaded(bool enabled);
+
+	//Adds extra lines to each frame for the CPU to run in without the PPU
+	//or APU seeing them, see PPU::setOverclock. Reduces slowdown in games
+	//that can't keep up without changing sound or how fast the game runs
+	void setOverclock(int linesBeforeNMI, int linesAfterNMI);
+
+	//Records every PPU register access, OAM DMA write and bank switch for the
+	//next frames frames to filename (see PPURecorder). Has to be called
+	//before the console runs anything, returns false if it can't record
+	bool recordPPU(const char *filename, int frames);
+
+	//Measures how long the CPU, PPU and APU take, for finding out what a
+	//slow machine is struggling with. Costs a couple of percent while on
+	void setTiming(bool enabled);
+
+	//Time spent since the last call
+	ConsoleTimings takeTimings();
+
+	//Passes through to PPU::setFrameskip
+	void setFrameskip(uint8_t ratio);
+
+	//Passes through to PPU::displayNextFrame
+	void displayNextFrame();
+
+	//Passes through to PPU::setVideoOutput
+	void setVideoOutput(uint32_t *buffer, int pitch, uint8_t format);
+
+	//Passes through to PPU::setDeferredRendering
+	void setDeferredRendering(bool enabled, int threads);
+
+	//CPU cycles run since power on, DMA included
+	uint64_t getCPUCycles();
+
+	Controller *getController1();
+
+	Controller *getController2();
+
 	CPU *getCPU();
+
+	Mapper *getMapper();
+
+	PPU *getPPU();
+
+	//Steps through the program one instruction at a time printing the CPU state
+	void debug();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -1,6 +1,9 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
+#include <cstdint>
+#include <cstddef>
+
 #define BTN_A 		0x01
 #define BTN_B 		0x02
 #define BTN_SELECT 	0x04
@@ -10,6 +13,14 @@
 #define BTN_LEFT	0x40
 #define BTN_RIGHT	0x80
 
+//Somewhere the buttons can be read from the moment the game latches them,
+//instead of whatever was last pressed with pressButton (see LiveInput)
+class InputSource {
+public:
+	virtual ~InputSource() {}
+
+	virtual uint8_t sample() = 0;
+};
 
 class Controller {
 
@@ -18,11 +29,19 @@ uint8_t readRegister;
 
 bool strobe;
 
+InputSource *source;
+
 public:
 	Controller() {
 		inputState = 0x00;
 		readRegister = 0x00;
 		strobe = false;
+		source = NULL;
+	}
+
+	//Latches read from source instead, NULL goes back to pressButton
+	void setInputSource(InputSource *source) {
+		this->source = source;
 	}
 
 	void strobeHigh() {
@@ -30,6 +49,8 @@ public:
 	}
 
 	void strobeLow() {
+		if (strobe && source)
+			inputState = source->sample();
 		if (strobe)
 			readRegister = inputState;
 		strobe = false;
@@ -48,6 +69,24 @@ public:
 	void releaseButton(uint8_t key) {
 		inputState &= ~key;
 	}
+
+	//Buttons held are saved too, loading puts back whatever was held then.
+	//The input source isn't, it stays whatever was set last
+	size_t stateSize() {
+		return 3;
+	}
+
+	void saveState(uint8_t *state) {
+		state[0] = inputState;
+		state[1] = readRegister;
+		state[2] = strobe;
+	}
+
+	void loadState(const uint8_t *state) {
+		inputState = state[0];
+		readRegister = state[1];
+		strobe = state[2];
+	}
 };
 
 #endif
\ No newline at end of file
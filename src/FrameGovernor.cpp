@@ -0,0 +1,104 @@
+#include "FrameGovernor.h"
+
+FrameGovernor::FrameGovernor() {
+	reset();
+	resetStats();
+}
+
+void FrameGovernor::reset() {
+	level = GOVERNOR_FULL;
+	frames = 0;
+	costSum = 0;
+	convertSum = 0;
+	settle = GOVERNOR_SETTLE_WINDOWS;
+	quietWindows = 0;
+	recovered = false;
+	stats.level = level;
+}
+
+bool FrameGovernor::frameDone(double cost, double budget) {
+	frames++;
+	costSum += cost;
+	if (frames < GOVERNOR_WINDOW_FRAMES)
+		return false;
+
+	double mean = costSum / frames;
+	double convert = convertSum.exchange(0, std::memory_order_relaxed) / 1e6 / frames;
+	frames = 0;
+	costSum = 0;
+
+	stats.meanCost = mean;
+	stats.meanConvert = convert;
+	stats.budget = budget;
+
+	double load = (mean > convert ? mean : convert) / budget;
+
+	bool justRecovered = recovered;
+	recovered = false;
+
+	if (load > GOVERNOR_DEGRADE) {
+		quietWindows = 0;
+
+		//Couldn't keep up without the level it just got back, wait longer
+		//before trying again
+		if (justRecovered && settle < GOVERNOR_SETTLE_MAX)
+			settle *= 2;
+
+		if (level == GOVERNOR_LEVELS - 1)
+			return false;
+		level++;
+	}
+	else {
+		//It held, so the next try doesn't have to wait as long
+		if (justRecovered && settle > GOVERNOR_SETTLE_WINDOWS)
+			settle /= 2;
+
+		if (load >= GOVERNOR_RECOVER) {
+			quietWindows = 0;
+			return false;
+		}
+
+		quietWindows++;
+		if (quietWindows < settle || level == GOVERNOR_FULL)
+			return false;
+		quietWindows = 0;
+		recovered = true;
+		level--;
+	}
+
+	stats.level = level;
+	stats.changes++;
+	return true;
+}
+
+void FrameGovernor::frameConverted(double time) {
+	convertSum.fetch_add((int64_t)(time * 1e6), std::memory_order_relaxed);
+}
+
+int FrameGovernor::getLevel() {
+	return level;
+}
+
+int FrameGovernor::getFrameskip() {
+	if (level >= GOVERNOR_FRAMESKIP_2)
+		return 2;
+	if (level >= GOVERNOR_FRAMESKIP_1)
+		return 1;
+	return 0;
+}
+
+bool FrameGovernor::filtersAllowed() {
+	return level < GOVERNOR_NO_FILTERS;
+}
+
+GovernorStats FrameGovernor::getStats() {
+	return stats;
+}
+
+void FrameGovernor::resetStats() {
+	stats.level = level;
+	stats.meanCost = 0;
+	stats.meanConvert = 0;
+	stats.budget = 0;
+	stats.changes = 0;
+}
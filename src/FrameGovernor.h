@@ -0,0 +1,99 @@
+#ifndef FRAMEGOVERNOR_H
+#define FRAMEGOVERNOR_H
+
+#include <cstdint>
+#include <atomic>
+
+//What the governor has given up to keep up, each level keeps everything the
+//ones before it gave up
+#define GOVERNOR_FULL			0
+#define GOVERNOR_FRAMESKIP_1	1	//draw every other frame
+#define GOVERNOR_FRAMESKIP_2	2	//draw every third frame
+#define GOVERNOR_NO_FILTERS		3	//NTSC filter and upscaling off too
+#define GOVERNOR_LEVELS			4
+
+//Frames averaged before each decision
+#define GOVERNOR_WINDOW_FRAMES	30
+
+//Load (see FrameGovernor) over which it steps down a level, and under
+//which it steps back up. The gap between them is the hysteresis
+#define GOVERNOR_DEGRADE		0.9
+#define GOVERNOR_RECOVER		0.6
+
+//Windows in a row that have to come in under GOVERNOR_RECOVER before
+//stepping back up. Doubles every time stepping up has to be undone straight
+//away, so a load that sits right on a level's edge doesn't flip back and
+//forth, up to GOVERNOR_SETTLE_MAX
+#define GOVERNOR_SETTLE_WINDOWS	4
+#define GOVERNOR_SETTLE_MAX		64
+
+//Cost of the frames in the last window and where that left the governor
+struct GovernorStats {
+	int level;
+
+	//In ms per emulated frame, emulation's and the UI's converting
+	double meanCost;
+	double meanConvert;
+	double budget;
+
+	//Times the level has changed since the last resetStats
+	int changes;
+};
+
+//Gives up picture quality when the host can't keep up with the frame rate
+//
+//There are two costs, both measured wall clock so time lost to other
+//threads and processes counts as well. The emulation thread hands it how
+//long each frame took to run and the UI thread how long each frame it got
+//took to convert (filters included). Every window the load is whichever of
+//the two, per emulated frame, is the bigger share of the budget. When it
+//gets close to the budget it steps down a level, frameskip first since
+//that's fewer frames to run and fewer for the UI to convert, then the
+//filters. Levels only come back once the load has stayed well under budget
+//for a while
+//
+//Everything except frameConverted, filtersAllowed and getLevel is for the
+//emulation thread
+class FrameGovernor {
+	std::atomic<int> level;
+
+	//Current window, convert time is added by the UI thread in ns
+	int frames;
+	double costSum;
+	std::atomic<int64_t> convertSum;
+
+	int settle;
+	int quietWindows;
+
+	//Stepped up at the end of the last window
+	bool recovered;
+
+	GovernorStats stats;
+
+public:
+	FrameGovernor();
+
+	//Adds a frame that took cost ms to run out of budget ms, returns true if
+	//the level changed
+	bool frameDone(double cost, double budget);
+
+	//Adds a frame the UI took time ms to convert, from the UI thread
+	void frameConverted(double time);
+
+	//Back to GOVERNOR_FULL, for when there's no budget to keep to
+	void reset();
+
+	int getLevel();
+
+	//Frames to skip between drawn ones at this level
+	int getFrameskip();
+
+	//Whether the UI should run the NTSC filter and upscaling, from any thread
+	bool filtersAllowed();
+
+	GovernorStats getStats();
+
+	void resetStats();
+};
+
+#endif
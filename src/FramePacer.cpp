@@ -0,0 +1,113 @@
+#include "FramePacer.h"
+
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+using namespace std;
+
+FramePacer::FramePacer(double rate) {
+	this->rate = rate;
+	period = 1e9 / rate;
+	start = now();
+	frames = 0;
+	deadline = start;
+
+	resetStats();
+}
+
+int64_t FramePacer::now() {
+#if defined(__linux__)
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void FramePacer::sleepUntil(int64_t time) {
+#if defined(__linux__)
+	//Absolute so being woken up early by a signal just means going round again
+	timespec until;
+	until.tv_sec = time / 1000000000;
+	until.tv_nsec = time % 1000000000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0) {}
+#else
+	this_thread::sleep_until(chrono::steady_clock::time_point(chrono::nanoseconds(time)));
+#endif
+}
+
+void FramePacer::setRate(double rate) {
+	//Carries on from the deadline that's already set so nothing jumps
+	this->rate = rate;
+	period = 1e9 / rate;
+	start = deadline;
+	frames = 0;
+}
+
+double FramePacer::getRate() {
+	return rate;
+}
+
+void FramePacer::restart() {
+	start = now();
+	frames = 0;
+	deadline = start;
+}
+
+void FramePacer::wait() {
+	frames++;
+	deadline = start + (int64_t)(frames * period);
+
+	int64_t time = now();
+
+	//Too far behind to catch up
+	if (time - deadline > PACER_RESYNC_FRAMES * period) {
+		start = time;
+		frames = 0;
+		deadline = time;
+		stats.resyncs++;
+		return;
+	}
+
+	if (deadline - time > PACER_SPIN_NS)
+		sleepUntil(deadline - PACER_SPIN_NS);
+
+	do {
+		time = now();
+	} while (time < deadline);
+
+	double error = (time - deadline) / 1e6;
+	stats.frames++;
+	errorSum += error;
+	errorSquareSum += error * error;
+	if (error > stats.maxError)
+		stats.maxError = error;
+	if (error > 1.0)
+		stats.lateFrames++;
+}
+
+PacingStats FramePacer::getStats() {
+	PacingStats result = stats;
+	if (stats.frames) {
+		result.meanError = errorSum / stats.frames;
+		result.rmsError = sqrt(errorSquareSum / stats.frames);
+	}
+	return result;
+}
+
+void FramePacer::resetStats() {
+	stats.frames = 0;
+	stats.meanError = 0;
+	stats.maxError = 0;
+	stats.rmsError = 0;
+	stats.lateFrames = 0;
+	stats.resyncs = 0;
+	errorSum = 0;
+	errorSquareSum = 0;
+}
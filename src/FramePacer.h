@@ -0,0 +1,80 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <cstdint>
+
+//NTSC NES frame rate, 5369318 dots a second over 89341.5 dots a frame
+#define NES_FRAME_RATE		60.0988
+
+//How long before a deadline to stop sleeping and spin instead, sleeps can
+//wake up late by a fair bit but spinning is exact
+#define PACER_SPIN_NS		500000
+
+//Falling this many frames behind (after a stall, a debugger break, the
+//machine going to sleep) starts the deadlines over from now instead of
+//running flat out until it catches up
+#define PACER_RESYNC_FRAMES	4
+
+//How far the deadlines have been missed by since the last resetStats
+struct PacingStats {
+	int frames;
+
+	//Wake up time minus deadline in ms, positive is late
+	double meanError;
+	double maxError;
+	double rmsError;
+
+	//Frames that started more than 1 ms late
+	int lateFrames;
+
+	//Times the deadlines were started over
+	int resyncs;
+};
+
+//Keeps frames to a steady rate with absolute deadlines
+//
+//Deadlines are worked out from when the rate was last set and how many
+//frames there have been since, so rounding never builds up and a frame that
+//runs long is made up for by the next one sleeping less. Waits sleep until
+//just before the deadline then spin out the rest
+class FramePacer {
+	double rate;
+
+	//Deadlines are start + frames * period, all in ns
+	int64_t start;
+	int64_t frames;
+	double period;
+
+	int64_t deadline;
+
+	PacingStats stats;
+	double errorSum;
+	double errorSquareSum;
+
+	//Monotonic time in ns
+	static int64_t now();
+
+	static void sleepUntil(int64_t time);
+
+public:
+	FramePacer(double rate);
+
+	//Changes the rate from the next deadline on
+	void setRate(double rate);
+
+	double getRate();
+
+	//Starts the deadlines over from now, for after a stretch of frames that
+	//weren't paced at all
+	void restart();
+
+	//Waits for the next frame's deadline, returns straight away if it's
+	//already gone
+	void wait();
+
+	PacingStats getStats();
+
+	void resetStats();
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "ROM.h"
+#include "Console.h"
+#include "PPU.h"
+#include "Palette.h"
+#include "Controller.h"
+#include "PPURecorder.h"
+#include "FramePacer.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//Frames run when --frames isn't given, 10 seconds of NES time
+#define HEADLESS_DEFAULT_FRAMES 600
+
+//Buttons held on controller 1 from a frame on
+struct InputChange {
+	int frame;
+	uint8_t buttons;
+};
+
+//Input scripts have one change per line, the frame number then the buttons
+//held from that frame on until the next line:
+//	0	none
+//	120	START
+//	125	RIGHT+A
+//Buttons are A, B, SELECT, START, UP, DOWN, LEFT, RIGHT joined with +, "none"
+//lets go of everything. Anything after a # is ignored
+static bool readInputScript(const char *filename, vector<InputChange> &changes) {
+	ifstream file(filename);
+	if (!file.is_open()) {
+		cout << "Error: couldn't open input script " << filename << endl;
+		return false;
+	}
+
+	const char *names[] = { "A", "B", "SELECT", "START", "UP", "DOWN", "LEFT", "RIGHT" };
+
+	string line;
+	int lineNumber = 0;
+	while (getline(file, line)) {
+		lineNumber++;
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.erase(comment);
+
+		istringstream fields(line);
+		InputChange change;
+		string buttons;
+		if (!(fields >> change.frame))
+			continue;
+		fields >> buttons;
+
+		change.buttons = 0x00;
+		size_t start = 0;
+		while (start < buttons.size() && buttons != "none") {
+			size_t end = buttons.find('+', start);
+			if (end == string::npos)
+				end = buttons.size();
+			string name = buttons.substr(start, end - start);
+
+			bool found = false;
+			for (int i = 0; i < 8; i++) {
+				if (name == names[i]) {
+					//Same order as the BTN_* bits
+					change.buttons |= 1 << i;
+					found = true;
+				}
+			}
+			if (!found)
+				cout << "Warning: unknown button " << name << " on line " << lineNumber << " of " << filename << endl;
+
+			start = end + 1;
+		}
+
+		changes.push_back(change);
+	}
+
+	return true;
+}
+
+//Binary PPM, the simplest thing any image tool can open
+static bool writeFrame(const char *filename, const uint32_t *pixels) {
+	ofstream file(filename, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open()) {
+		cout << "Error: couldn't open " << filename << " to write the frame" << endl;
+		return false;
+	}
+
+	file << "P6\n256 240\n255\n";
+	for (int i = 0; i < 256 * 240; i++) {
+		//PIXEL_FORMAT_RGBA
+		file.put(pixels[i] >> 24);
+		file.put(pixels[i] >> 16);
+		file.put(pixels[i] >> 8);
+	}
+
+	return true;
+}
+
+//Runs a ROM with no window as fast as it'll go
+//
+//	ixnes-headless <rom> [options]
+//	--frames N			frames to run, 600 if not given
+//	--until <addr> <value>	stop early at the end of the first frame where
+//						the CPU reads value from addr (both hex), plus a
+//						drawn one if that frame was skipped
+//	--input <file>		input script for controller 1 (see readInputScript)
+//	--dump <file>		write the last frame out as a PPM
+//	--lockstep			step the PPU with the CPU instead of catching it up
+//	--ppu-thread		run the PPU on its own thread
+//	--defer <threads>	deferred rendering with this many extra threads
+//	--frameskip N		only draw one frame in N+1
+//	--overclock N		extra lines before NMI
+//	--run-ahead N		run N frames ahead of the console (see Console::runFrameAhead),
+//						--until and the frame count still go by the console
+//
+//Reports the time taken, frames and CPU cycles a second and the hash of the
+//last frame. The exit status is 1 if --until never happened, 2 if the ROM
+//couldn't be run
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		cout << "Usage: ixnes-headless <rom> [--frames N] [--until <addr> <value>] [--input <file>] [--dump <file>]" << endl;
+		cout << "	[--lockstep] [--ppu-thread] [--defer <threads>] [--frameskip N] [--overclock N] [--run-ahead N]" << endl;
+		return 2;
+	}
+
+	int frames = HEADLESS_DEFAULT_FRAMES;
+	bool until = false;
+	uint16_t untilAddress = 0;
+	uint8_t untilValue = 0;
+	const char *inputFile = NULL;
+	const char *dumpFile = NULL;
+	bool lockstep = false;
+	bool ppuThread = false;
+	int deferThreads = -1;
+	int frameskip = 0;
+	int overclock = 0;
+	int runAhead = 0;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+			frames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--until") == 0 && i + 2 < argc) {
+			until = true;
+			untilAddress = strtol(argv[i + 1], NULL, 16);
+			untilValue = strtol(argv[i + 2], NULL, 16);
+			i += 2;
+		}
+		else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc)
+			inputFile = argv[++i];
+		else if (strcmp(argv[i], "--dump") == 0 && i + 1 < argc)
+			dumpFile = argv[++i];
+		else if (strcmp(argv[i], "--lockstep") == 0)
+			lockstep = true;
+		else if (strcmp(argv[i], "--ppu-thread") == 0)
+			ppuThread = true;
+		else if (strcmp(argv[i], "--defer") == 0 && i + 1 < argc)
+			deferThreads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc)
+			frameskip = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--overclock") == 0 && i + 1 < argc)
+			overclock = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+			runAhead = atoi(argv[++i]);
+		else
+			cout << "Warning: unknown option " << argv[i] << endl;
+	}
+
+	vector<InputChange> input;
+	if (inputFile && !readInputScript(inputFile, input))
+		return 2;
+
+	RomImage *rom;
+	try {
+		rom = new RomImage(argv[1], false);
+	}
+	catch (RomLoadingException &e) {
+		cout << "Error: " << e.getMessage() << endl;
+		return 2;
+	}
+
+	Console *con = new Console(rom);
+
+	if (lockstep)
+		con->setPPUCatchUp(false);
+	if (ppuThread)
+		con->setPPUThreaded(true);
+	if (deferThreads >= 0)
+		con->setDeferredRendering(true, deferThreads);
+	if (frameskip > 0)
+		con->setFrameskip(frameskip);
+	if (overclock > 0)
+		con->setOverclock(overclock, 0);
+
+	//Colours are only worked out if they're going to be written out
+	uint32_t *pixels = NULL;
+	if (dumpFile) {
+		pixels = new uint32_t[256 * 240];
+		con->setVideoOutput(pixels, 256 * 4, PIXEL_FORMAT_RGBA);
+	}
+
+	Controller *controller = con->getController1();
+	unsigned int nextChange = 0;
+
+	bool reached = false;
+	int reachedFrame = 0;
+	int frame = 0;
+
+	auto start = chrono::steady_clock::now();
+
+	while (frame < frames && !reached) {
+		while (nextChange < input.size() && input[nextChange].frame <= frame) {
+			controller->releaseButton(0xFF);
+			controller->pressButton(input[nextChange].buttons);
+			nextChange++;
+		}
+
+		//The last frame is always drawn so there's something to dump
+		if (frame == frames - 1)
+			con->displayNextFrame();
+
+		con->runFrameAhead(runAhead);
+		frame++;
+
+		if (until && con->debugRead(untilAddress) == untilValue) {
+			reached = true;
+			reachedFrame = frame;
+		}
+	}
+
+	//--until can stop on a skipped frame, one more drawn frame gives the
+	//hash and the dump something to go on
+	if (reached && !con->getPPU()->frameDisplayed()) {
+		con->displayNextFrame();
+		con->runFrameAhead(runAhead);
+		frame++;
+	}
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	uint64_t cycles = con->getCPUCycles();
+
+	cout << frame << " frames, " << cycles << " CPU cycles in " << seconds * 1000 << " ms" << endl;
+	cout << frame / seconds << " frames/s (" << frame / seconds / NES_FRAME_RATE << "x), "
+		<< cycles / seconds / 1000000 << "M CPU cycles/s" << endl;
+	cout << "Last frame hash " << hex << hashFrame(con->getPPU()->getFrame()) << dec << endl;
+
+	if (until) {
+		if (reached)
+			cout << "$" << hex << untilAddress << " reached " << +untilValue << dec << " at frame " << reachedFrame << endl;
+		else
+			cout << "$" << hex << untilAddress << " never reached " << +untilValue << dec << endl;
+	}
+
+	if (dumpFile)
+		writeFrame(dumpFile, pixels);
+
+	delete con;
+	delete rom;
+	delete[] pixels;
+
+	return until && !reached ? 1 : 0;
+}
@@ -2,55 +2,345 @@
 #include <iostream>
 #include <cstdint>
 #include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
 
 #include "ROM.h"
 #include "Console.h"
+#include "Mapper.h"
 #include "PPU.h"
+#include "Palette.h"
 #include "Controller.h"
+#include "NtscFilter.h"
+#include "Upscaler.h"
+#include "TripleBuffer.h"
+#include "FramePacer.h"
+#include "VideoCapture.h"
+#include "LiveInput.h"
+#include "PerfOverlay.h"
+#include "FrameGovernor.h"
 
 #define SCREEN_WIDTH 256
 #define SCREEN_HEIGHT 240
-#define SCREEN_FPS 60
-#define SCREEN_TICKS_PER_FRAME (1000/SCREEN_FPS)
 
 #define PI 3.14159265
 
+//Most post-processing workers worth having, rows are cheap enough that
+//more threads just fight over them
+#define FILTER_MAX_THREADS 3
+
+//Presented frames between upscaler timing reports
+#define UPSCALE_REPORT_FRAMES 600
+
+//Presented frames between reports of how long getting a frame into the
+//texture and onto the screen takes
+#define PRESENT_REPORT_FRAMES 600
+
+//Emulated frames between frame pacing reports
+#define PACING_REPORT_FRAMES 600
+
+//Presents averaged to measure the display's refresh rate with vsync on, and
+//how close that has to be to the NES's rate for emulation to follow it
+#define DISPLAY_RATE_SAMPLES 120
+#define DISPLAY_RATE_TOLERANCE 0.01
+
+//Speeds - and = step through, as multiples of normal. 0 is as fast as the
+//machine can go, Tab runs at that while it's held
+#define SPEED_LEVELS 7
+#define SPEED_NORMAL 2
+static const double speedLevels[SPEED_LEVELS] = { 0.25, 0.5, 1, 2, 4, 8, 0 };
+
+//Frameskip while uncapped, frames are drawn by time instead (see emulate)
+#define SPEED_UNCAPPED_FRAMESKIP 255
+
 using namespace std;
 
-int main(int argc, char *argv[]) {
-	                     //00		   01		   02		   03	
-	uint32_t palette[] = { 0x656565FF, 0x002D69FF, 0x131F7FFF, 0x3C137CFF,
-						 //04		   05		   06		   07
-						   0x600B62FF, 0x730A37FF, 0x710F07FF, 0x5A1A00FF,
-						 //08		   09		   0A 		   0B
-						   0x342800FF, 0x0B3400FF, 0x003C00FF, 0x003D10FF,
-						 //0C 		   0D 		   0E		   0F
-						   0x003840FF, 0x000000FF, 0x000000FF, 0x000000FF,
-						 //10		   11		   12		   13	
-						   0xAEAEAEFF, 0x0F63B3FF, 0x4051D0FF, 0x7841CCFF,
-						 //14		   15		   16		   17
-						   0xA736A9FF, 0xC03470FF, 0xBD3C30FF, 0x9F4A00FF,
-						 //18		   19		   1A 		   1B
-						   0x6D5C00FF, 0x366D00FF, 0x077704FF, 0x00793DFF,
-					     //1C 		   1D 		   1E		   1F
-						   0x00727DFF, 0x000000FF, 0x000000FF, 0x000000FF,
-						 //20		   21		   22		   23	
-						   0xFEFEFFFF, 0x5DB3FFFF, 0x8FA1FFFF, 0xC890FFFF,
-						 //24		   25		   26		   27
-						   0xF785FAFF, 0xFF83C0FF, 0xFF8B7FFF, 0xEF9A49FF,
-						 //28		   29		   2A 		   2B
-						   0xBDAC2CFF, 0x85BC2FFF, 0x55C753FF, 0x3CC98CFF,
-					     //2C 		   2D 		   2E		   2F
-						   0x3EC2CDFF, 0x4E4E4EFF, 0x000000FF, 0x000000FF,
-						 //30		   31		   32		   33	
-						   0xFEFEFEFF, 0xBCDFFFFF, 0xD1D8FFFF, 0xE8D1FFFF,
-						 //34		   35		   36		   37
-						   0xFBCDFDFF, 0xFFCCE5FF, 0xFFCFCAFF, 0xF8D5B4FF,
-						 //38		   39		   3A 		   3B
-						   0xE4DCA8FF, 0xCCE3A9FF, 0xB9E8B8FF, 0xAEE8D0FF,
-					     //3C 		   3D 		   3E		   3F
-						   0xAFE5EAFF, 0xB6B6B6FF, 0x000000FF, 0x000000FF};
+//Per-ROM options live in a text file next to the ROM with ".cfg" on the end
+//of its name (game.nes.cfg), written the same way as on the command line.
+//Anything after a # on a line is ignored
+static vector<string> readRomOptions(const char *romPath) {
+	vector<string> options;
+
+	ifstream file(string(romPath) + ".cfg");
+	string line;
+	while (getline(file, line)) {
+		size_t comment = line.find('#');
+		if (comment != string::npos)
+			line.erase(comment);
+
+		size_t position = 0;
+		while (true) {
+			size_t start = line.find_first_not_of(" \t\r", position);
+			if (start == string::npos)
+				break;
+			position = line.find_first_of(" \t\r", start);
+			options.push_back(line.substr(start, position - start));
+		}
+	}
+
+	return options;
+}
+
+//One row per frame for --ppu-stats, columns are in PPUStats order
+static void writeStatsHeader(ofstream &file) {
+	file << "frame,ctrl,mask,status,oamaddr,oamdata,scroll,addr,data,"
+		<< "data_rendering,scroll_rendering,ctrl_rendering,midline_scroll,midline_ctrl,"
+		<< "overflow_lines,sprite0_line,sprite0_dot,oam_dma,palette_writes,"
+		<< "nt_fetches,at_fetches,pt_fetches" << endl;
+}
+
+static void writeStatsRow(ofstream &file, uint64_t frame, const PPUStats &stats) {
+	file << frame;
+	for (int i = 0; i < 8; i++)
+		file << ',' << stats.registerWrites[i];
+	file << ',' << stats.dataWritesRendering
+		<< ',' << stats.scrollWritesRendering
+		<< ',' << stats.controlWritesRendering
+		<< ',' << stats.midLineScrollWrites
+		<< ',' << stats.midLineControlWrites
+		<< ',' << stats.overflowLines
+		<< ',' << stats.sprite0HitLine
+		<< ',' << stats.sprite0HitDot
+		<< ',' << stats.oamDMAs
+		<< ',' << stats.paletteWrites
+		<< ',' << stats.nametableFetches
+		<< ',' << stats.attributeFetches
+		<< ',' << stats.patternFetches << '\n';
+}
+
+//Level closest to a --speed value, "max" is uncapped
+static int speedLevel(const string &value) {
+	if (value == "max")
+		return SPEED_LEVELS - 1;
+
+	double speed = atof(value.c_str());
+	int closest = SPEED_NORMAL;
+	for (int level = 0; level < SPEED_LEVELS - 1; level++) {
+		if (fabs(log(speedLevels[level] / speed)) < fabs(log(speedLevels[closest] / speed)))
+			closest = level;
+	}
+	if (speed <= 0 || speedLevels[closest] != speed)
+		cout << "Warning: running at " << speedLevels[closest] << "x instead of " << value << "x" << endl;
+	return closest;
+}
+
+//Sets the speed and puts it in the window title when it isn't normal
+static void setSpeed(SDL_Window *window, atomic<double> &speed, double value) {
+	speed.store(value, memory_order_relaxed);
+
+	char title[32];
+	if (value == 0)
+		snprintf(title, sizeof(title), "IXNES - Max speed");
+	else if (value != 1)
+		snprintf(title, sizeof(title), "IXNES - %gx", value);
+	else
+		snprintf(title, sizeof(title), "IXNES");
+	SDL_SetWindowTitle(window, title);
+}
+
+//Controller 1 button for a key, 0 if it isn't one
+static uint8_t keyButton(SDL_Keycode key) {
+	switch (key) {
+		case SDLK_UP:
+			return BTN_UP;
+		case SDLK_DOWN:
+			return BTN_DOWN;
+		case SDLK_LEFT:
+			return BTN_LEFT;
+		case SDLK_RIGHT:
+			return BTN_RIGHT;
+		case SDLK_z:
+			return BTN_B;
+		case SDLK_x:
+			return BTN_A;
+		case SDLK_RETURN:
+			return BTN_START;
+		case SDLK_RSHIFT:
+			return BTN_SELECT;
+	}
+	return 0x00;
+}
+
+//Everything the emulation thread shares with the UI thread
+struct Emulation {
+	Console *con;
+
+	//What the PPU draws into
+	uint32_t *output;
+
+	//Finished frames on their way to the UI thread, numbered by how many
+	//frames the console has run
+	TripleBuffer *frames;
+
+	//Controller 1, fed by the UI thread and --input-device's thread and
+	//read by the controller when the game latches it
+	LiveInput *input;
+
+	atomic<bool> running;
+
+	//Measured refresh rate of the display when it's close enough to the
+	//NES's for emulation to run in step with it, 0 if it isn't
+	atomic<double> displayRate;
+
+	//Multiple of normal speed to run at, 0 for uncapped
+	atomic<double> speed;
+
+	//NULL unless --ppu-stats was given
+	ofstream *statsFile;
+
+	//NULL unless --capture or --capture-pipe was given
+	VideoCapture *capture;
+
+	//Frames shown ahead of the console, see Console::runFrameAhead
+	int runAhead;
+
+	//NULL unless --perf-overlay was given, the console's timing is only on
+	//when it isn't
+	PerfOverlay *overlay;
+
+	//NULL unless --governor was given, the UI thread feeds it convert
+	//times and asks it whether to filter
+	FrameGovernor *governor;
+};
+
+//Runs the console on its own thread at the NES's frame rate, or the
+//display's if it's close. The UI thread only ever sees finished frames, so
+//however long a present takes it can't hold up emulation
+//
+//Other speeds just change the pacer's rate. Above normal speed frameskip
+//keeps about a normal speed's worth of frames drawn, uncapped doesn't wait
+//at all and draws a frame whenever one would have come due at normal speed.
+//The governor's frameskip goes on top of the speed's
+static void emulate(Emulation *emu) {
+	uint64_t frameNumber = 0;
+
+	FramePacer pacer(NES_FRAME_RATE);
+	bool paced = true;
+
+	int frameskip = 0;
+	chrono::steady_clock::time_point lastDrawn = chrono::steady_clock::now();
+	chrono::duration<double> drawPeriod(1 / NES_FRAME_RATE);
+
+	while (emu->running.load(memory_order_acquire)) {
+		chrono::steady_clock::time_point frameStart = chrono::steady_clock::now();
+		double speed = emu->speed.load(memory_order_relaxed);
+
+		//Following the display only makes sense at normal speed
+		double rate = emu->displayRate.load(memory_order_relaxed);
+		if (rate == 0 || speed != 1)
+			rate = NES_FRAME_RATE;
+		if (speed != 0 && rate * speed != pacer.getRate())
+			pacer.setRate(rate * speed);
+
+		int skip = 0;
+		if (speed == 0)
+			skip = SPEED_UNCAPPED_FRAMESKIP;
+		else {
+			if (speed > 1)
+				skip = (int)ceil(speed) - 1;
+			if (emu->governor)
+				skip = (skip + 1) * (emu->governor->getFrameskip() + 1) - 1;
+		}
+		if (skip != frameskip) {
+			emu->con->setFrameskip(skip);
+			frameskip = skip;
+		}
+
+		if (speed == 0 && chrono::steady_clock::now() - lastDrawn >= drawPeriod) {
+			emu->con->displayNextFrame();
+			lastDrawn = chrono::steady_clock::now();
+		}
+
+		//Stats are the console's own frame, what's shown (and captured) is the
+		//one run ahead
+		emu->con->runFrameAhead(emu->runAhead);
+
+		if (emu->statsFile)
+			writeStatsRow(*emu->statsFile, frameNumber, emu->con->getPPU()->getFrameStats());
+		frameNumber++;
+
+		//Every frame goes to the capture, even ones that didn't change, so
+		//the video keeps time
+		if (emu->capture)
+			emu->capture->pushFrame(emu->output);
+
+		//Skipped frames and frames that look the same as the last one leave
+		//the last one up
+		if (emu->con->getPPU()->frameChanged()) {
+			memcpy(emu->frames->getBack(), emu->output, SCREEN_WIDTH*SCREEN_HEIGHT*4);
+			emu->frames->publish(frameNumber);
+		}
+
+		chrono::steady_clock::time_point sleepStart = chrono::steady_clock::now();
+
+		//Uncapped has no budget to keep to, it starts over from full when
+		//it's back to a speed that has one
+		if (emu->governor) {
+			if (speed == 0)
+				emu->governor->reset();
+			else {
+				double cost = chrono::duration<double, milli>(sleepStart - frameStart).count();
+				emu->governor->frameDone(cost, 1000 / pacer.getRate());
+			}
+		}
 
+		if (speed != 0) {
+			//The deadlines from before going uncapped are long gone
+			if (!paced)
+				pacer.restart();
+			pacer.wait();
+		}
+		paced = speed != 0;
+
+		if (emu->overlay) {
+			ConsoleTimings console = emu->con->takeTimings();
+			FrameTiming timing;
+			timing.cpu = console.cpu;
+			timing.ppu = console.ppu;
+			timing.apu = console.apu;
+			timing.sleep = chrono::duration<double, milli>(chrono::steady_clock::now() - sleepStart).count();
+			emu->overlay->emulatedFrame(timing);
+			if (emu->governor)
+				emu->overlay->setGovernorLevel(emu->governor->getLevel());
+		}
+
+		if (frameNumber % PACING_REPORT_FRAMES == 0) {
+			PacingStats stats = pacer.getStats();
+			if (stats.frames) {
+				cout << "Pacing: " << pacer.getRate() << " fps, error mean " << stats.meanError
+					<< " ms, rms " << stats.rmsError << " ms, max " << stats.maxError << " ms, "
+					<< stats.lateFrames << " late, " << stats.resyncs << " resyncs" << endl;
+			}
+			pacer.resetStats();
+
+			if (emu->governor) {
+				GovernorStats governor = emu->governor->getStats();
+				if (governor.budget) {
+					cout << "Governor: level " << governor.level << ", frame cost mean " << governor.meanCost
+						<< " ms, convert " << governor.meanConvert << " ms of " << governor.budget << " ms, "
+						<< governor.changes << " changes" << endl;
+				}
+				emu->governor->resetStats();
+			}
+
+			InputLatencyStats input = emu->input->getStats();
+			if (input.changes) {
+				cout << "Input: " << input.changes << " changes latched, age mean " << input.meanAge
+					<< " ms, max " << input.maxAge << " ms" << endl;
+			}
+			emu->input->resetStats();
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
 	if (SDL_Init(SDL_INIT_VIDEO) != 0) {
 		cout << "Error: failed to initialize SDL" << endl;
 	}
@@ -63,145 +353,440 @@ int main(int argc, char *argv[]) {
 		cout << "Error: failed to create window" << endl;
 	}
 
-	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	RomImage rom(argv[1], false);
+
+	Console con(&rom);
+
+	//Options after the ROM, the ROM's .cfg file is read first
+	//	--ntsc		run the picture through the composite video filter
+	//	--vsync		present in step with the display so frames don't tear
+	//	--scale2x, --scale3x, --scale4x, --xbr2x, --xbr4x
+	//				upscale on the CPU instead of letting the renderer stretch it
+	//	--record-ppu <file> <frames>
+	//				log what the PPU sees for ppureplay
+	//	--capture <file>
+	//				record video, Y4M if the name ends in .y4m otherwise raw RGBA
+	//	--capture-pipe <command>
+	//				record Y4M video into an encoder's standard input
+	//	--ppu-stats <file>
+	//				write the PPU's counters for every frame to a CSV file
+	//	--overclock <lines>
+	//				extra lines for the game before NMI, gets rid of slowdown
+	//	--overclock-vblank <lines>
+	//				extra lines at the end of vblank, for games whose NMI
+	//				handler is what runs out of time
+	//	--input-device <path>
+	//				also read controller 1 from a Linux input device
+	//				(/dev/input/event*) on its own thread
+	//	--perf-overlay
+	//				show frame rates and where the time goes over the picture,
+	//				F1 hides and shows it
+	//	--run-ahead <frames>
+	//				show this many frames ahead of the game to hide its input
+	//				lag, 1 or 2 is usually all a game has
+	//	--governor	when the machine can't keep up, skip frames and then
+	//				turn off the NTSC filter and upscaling until it can
+	//	--speed <multiple>
+	//				start at 0.25, 0.5, 1, 2, 4 or 8 times normal speed, or max
+	//				for as fast as it'll go. - and = change it while running,
+	//				holding Tab runs at max
+	vector<string> options = readRomOptions(argv[1]);
+	for (int i = 2; i < argc; i++)
+		options.push_back(argv[i]);
+
+	bool ntsc = false;
+	bool vsync = false;
+	int upscaleFilter = -1;
+	int overclockLines = 0;
+	int overclockVblankLines = 0;
+	int runAhead = 0;
+	int speed = SPEED_NORMAL;
+	bool recordingPPU = false;
+	bool perfOverlay = false;
+	bool governed = false;
+	LiveInput input;
+	ofstream statsFile;
+	VideoCapture *capture = NULL;
+	for (unsigned int i = 0; i < options.size(); i++) {
+		if (options[i] == "--ntsc")
+			ntsc = true;
+		else if (options[i] == "--vsync")
+			vsync = true;
+		else if (options[i] == "--scale2x")
+			upscaleFilter = UPSCALE_SCALE2X;
+		else if (options[i] == "--scale3x")
+			upscaleFilter = UPSCALE_SCALE3X;
+		else if (options[i] == "--scale4x")
+			upscaleFilter = UPSCALE_SCALE4X;
+		else if (options[i] == "--xbr2x")
+			upscaleFilter = UPSCALE_XBR2X;
+		else if (options[i] == "--xbr4x")
+			upscaleFilter = UPSCALE_XBR4X;
+		else if (options[i] == "--record-ppu" && i + 2 < options.size()) {
+			recordingPPU = con.recordPPU(options[i + 1].c_str(), atoi(options[i + 2].c_str()));
+			i += 2;
+		}
+		else if ((options[i] == "--capture" || options[i] == "--capture-pipe") && i + 1 < options.size()) {
+			string target = options[++i];
+			uint8_t format = CAPTURE_Y4M;
+			if (options[i - 1] == "--capture-pipe")
+				target = "|" + target;
+			else if (target.size() < 4 || target.compare(target.size() - 4, 4, ".y4m") != 0)
+				format = CAPTURE_RGBA;
+
+			delete capture;
+			capture = new VideoCapture(target.c_str(), format);
+			if (!capture->isOpen()) {
+				cout << "Error: failed to start capturing to " << options[i] << endl;
+				delete capture;
+				capture = NULL;
+			}
+		}
+		else if (options[i] == "--ppu-stats" && i + 1 < options.size()) {
+			statsFile.open(options[++i].c_str(), ios::out | ios::trunc);
+			if (statsFile.is_open())
+				writeStatsHeader(statsFile);
+			else
+				cout << "Error: failed to open " << options[i] << " for PPU stats" << endl;
+		}
+		else if (options[i] == "--overclock" && i + 1 < options.size())
+			overclockLines = atoi(options[++i].c_str());
+		else if (options[i] == "--overclock-vblank" && i + 1 < options.size())
+			overclockVblankLines = atoi(options[++i].c_str());
+		else if (options[i] == "--input-device" && i + 1 < options.size()) {
+			if (!input.openDevice(options[++i].c_str()))
+				cout << "Error: failed to open input device " << options[i] << endl;
+		}
+		else if (options[i] == "--perf-overlay")
+			perfOverlay = true;
+		else if (options[i] == "--governor")
+			governed = true;
+		else if (options[i] == "--run-ahead" && i + 1 < options.size())
+			runAhead = atoi(options[++i].c_str());
+		else if (options[i] == "--speed" && i + 1 < options.size())
+			speed = speedLevel(options[++i]);
+		else
+			cout << "Warning: unknown option " << options[i] << endl;
+	}
+
+	if (overclockLines < 0 || overclockVblankLines < 0) {
+		cout << "Warning: overclock lines can't be negative, ignoring them" << endl;
+		overclockLines = 0;
+		overclockVblankLines = 0;
+	}
+	con.setOverclock(overclockLines, overclockVblankLines);
+
+	if (runAhead < 0) {
+		cout << "Warning: run-ahead frames can't be negative, ignoring it" << endl;
+		runAhead = 0;
+	}
+	//The recording would be of frames that get thrown away
+	if (runAhead > 0 && recordingPPU) {
+		cout << "Warning: run-ahead doesn't work while recording the PPU, ignoring it" << endl;
+		runAhead = 0;
+	}
+	if (runAhead > 0 && !con.getMapper()->hasState()) {
+		cout << "Warning: run-ahead doesn't work with this game's mapper, ignoring it" << endl;
+		runAhead = 0;
+	}
+
+	//The NTSC image is already wider than the upscalers expect
+	if (ntsc && upscaleFilter >= 0) {
+		cout << "Warning: upscaling doesn't work with --ntsc, ignoring it" << endl;
+		upscaleFilter = -1;
+	}
+
+	uint32_t rendererFlags = SDL_RENDERER_ACCELERATED;
+	if (vsync)
+		rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+
+	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, rendererFlags);
 
 	if (!renderer) {
 		cout << "Error: failed to create renderer" << endl;
 	}
 
-	SDL_Surface *testImage = SDL_CreateRGBSurface(0, SCREEN_WIDTH, SCREEN_HEIGHT, 32, 
-								0xFF000000, 0x00FF0000, 0x0000FF00, 0x000000FF);
+	int filterThreads = (int)thread::hardware_concurrency() - 1;
+	if (filterThreads < 0)
+		filterThreads = 0;
+	if (filterThreads > FILTER_MAX_THREADS)
+		filterThreads = FILTER_MAX_THREADS;
+
+	NtscFilter *ntscFilter = NULL;
 
-	if (!testImage) {
-		cout << "Error: failed to create surface for image" << endl;
+	//What the PPU draws into, the emulation thread passes it on from there.
+	//It's always palette indices so the NTSC filter and capture get exactly
+	//what the PPU output, they're turned into colours on the way to the screen
+	uint32_t *ppuOutput = new uint32_t[SCREEN_WIDTH*SCREEN_HEIGHT];
+	con.setVideoOutput(ppuOutput, SCREEN_WIDTH*4, PIXEL_FORMAT_INDEX);
+
+	uint32_t outputPalette[OUTPUT_PALETTE_SIZE];
+	buildOutputPalette(outputPalette, PIXEL_FORMAT_RGBA);
+
+	//Size of what ends up on screen before the renderer stretches it
+	int textureWidth = SCREEN_WIDTH;
+	int textureHeight = SCREEN_HEIGHT;
+
+	if (ntsc) {
+		textureWidth = NTSC_OUTPUT_WIDTH;
+
+		ntscFilter = new NtscFilter(filterThreads, PIXEL_FORMAT_RGBA);
 	}
 
-	uint32_t (*pixels)[SCREEN_WIDTH] = (uint32_t (*)[SCREEN_WIDTH]) testImage->pixels;
+	Upscaler *upscaler = NULL;
+	uint32_t *upscaleInput = NULL;
+	int upscaledFrames = 0;
 
-	Frame frame;
+	if (upscaleFilter >= 0) {
+		upscaler = new Upscaler(filterThreads, upscaleFilter, PIXEL_FORMAT_RGBA);
+		upscaleInput = new uint32_t[SCREEN_WIDTH*SCREEN_HEIGHT];
+		textureWidth *= upscaler->getScale();
+		textureHeight *= upscaler->getScale();
+	}
 
-	RomImage rom(argv[1], false);
+	//Kept for the whole run, whatever stage comes last writes straight into
+	//it while it's locked. Nothing is kept between locks so every frame has
+	//to be written out in full
+	SDL_Texture *screenTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+								textureWidth, textureHeight);
 
-	Console con(&rom);
+	if (!screenTexture) {
+		cout << "Error: failed to create texture for the screen" << endl;
+	}
 
-	Controller *controller = con.getController1();
+	//Unfiltered frames for when the governor turns the filters off.
+	//shownTexture is whichever one the last frame went into
+	SDL_Texture *plainTexture = NULL;
+	if (governed && (ntsc || upscaler)) {
+		plainTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+								SCREEN_WIDTH, SCREEN_HEIGHT);
+	}
+	SDL_Texture *shownTexture = screenTexture;
+
+	int presentedFrames = 0;
+	double presentTime = 0;
+
+	//Blended over the top left of the picture at the same scale
+	PerfOverlay *overlay = NULL;
+	SDL_Texture *overlayTexture = NULL;
+	bool overlayShown = perfOverlay;
+	if (perfOverlay) {
+		overlay = new PerfOverlay();
+		overlayTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
+								PERF_OVERLAY_WIDTH, PERF_OVERLAY_HEIGHT);
+		SDL_SetTextureBlendMode(overlayTexture, SDL_BLENDMODE_BLEND);
+		con.setTiming(true);
+	}
 
-	int framecounter = 0;
+	TripleBuffer frames(SCREEN_WIDTH*SCREEN_HEIGHT);
 
-	bool keep_window_open = true;
-	while (keep_window_open) {
-		unsigned int start = SDL_GetTicks();
+	Emulation emu;
+	emu.con = &con;
+	emu.output = ppuOutput;
+	emu.frames = &frames;
+	emu.input = &input;
+	emu.running = true;
+	emu.displayRate = 0;
+	setSpeed(window, emu.speed, speedLevels[speed]);
+	emu.statsFile = statsFile.is_open() ? &statsFile : NULL;
+	emu.capture = capture;
+	emu.runAhead = runAhead;
+	emu.overlay = overlay;
+	emu.governor = governed ? new FrameGovernor() : NULL;
+
+	//Buttons are read the moment the game strobes the controller, not once a frame
+	con.getController1()->setInputSource(&input);
 
-		uint8_t buttonPress = 0x00;
-		uint8_t buttonRelease = 0x00;
+	thread emulator(emulate, &emu);
 
+	//Tab held down
+	bool fastForward = false;
+
+	//Presents since displayStart, for measuring the refresh rate
+	int displaySamples = 0;
+	uint64_t displayStart = 0;
+
+	bool keep_window_open = true;
+	while (keep_window_open) {
 		SDL_Event e;
 		while (SDL_PollEvent(&e) > 0) {
 			if (e.type == SDL_QUIT) {
 				keep_window_open = false;
 			}
-			else if (e.type == SDL_KEYDOWN) {
-				switch (e.key.keysym.sym) {
-					case SDLK_UP:
-						buttonPress |= BTN_UP;
-						break;
-					case SDLK_DOWN:
-						buttonPress |= BTN_DOWN;
-						break;
-					case SDLK_LEFT:
-						buttonPress |= BTN_LEFT;
-						break;
-					case SDLK_RIGHT:
-						buttonPress |= BTN_RIGHT;
-						break;
-					case SDLK_z:
-						buttonPress |= BTN_B;
-						break;
-					case SDLK_x:
-						buttonPress |= BTN_A;
-						break;
-					case SDLK_RETURN:
-						buttonPress |= BTN_START;
-						break;
-					case SDLK_RSHIFT:
-						buttonPress |= BTN_SELECT;
-						break;
+			else if (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_F1 && overlay) {
+				overlayShown = !overlayShown;
+			}
+			else if (e.type == SDL_KEYDOWN && (e.key.keysym.sym == SDLK_MINUS || e.key.keysym.sym == SDLK_EQUALS)) {
+				if (e.key.keysym.sym == SDLK_MINUS && speed > 0)
+					speed--;
+				else if (e.key.keysym.sym == SDLK_EQUALS && speed < SPEED_LEVELS - 1)
+					speed++;
+				if (!fastForward)
+					setSpeed(window, emu.speed, speedLevels[speed]);
+			}
+			else if ((e.type == SDL_KEYDOWN || e.type == SDL_KEYUP) && e.key.keysym.sym == SDLK_TAB) {
+				//Key repeats come as more key downs
+				if ((e.type == SDL_KEYDOWN) != fastForward) {
+					fastForward = e.type == SDL_KEYDOWN;
+					setSpeed(window, emu.speed, fastForward ? 0 : speedLevels[speed]);
 				}
 			}
+			//Stamped as they're taken off the queue, SDL's own timestamps
+			//are only to the ms and on a different clock
+			else if (e.type == SDL_KEYDOWN) {
+				input.press(keyButton(e.key.keysym.sym), LiveInput::now());
+			}
 			else if (e.type == SDL_KEYUP) {
-				switch (e.key.keysym.sym) {
-					case SDLK_UP:
-						buttonRelease |= BTN_UP;
-						break;
-					case SDLK_DOWN:
-						buttonRelease |= BTN_DOWN;
-						break;
-					case SDLK_LEFT:
-						buttonRelease |= BTN_LEFT;
-						break;
-					case SDLK_RIGHT:
-						buttonRelease |= BTN_RIGHT;
-						break;
-					case SDLK_z:
-						buttonRelease |= BTN_B;
-						break;
-					case SDLK_x:
-						buttonRelease |= BTN_A;
-						break;
-					case SDLK_RETURN:
-						buttonRelease |= BTN_START;
-						break;
-					case SDLK_RSHIFT:
-						buttonRelease |= BTN_SELECT;
-						break;
-				}
+				input.release(keyButton(e.key.keysym.sym), LiveInput::now());
 			}
 		}
-		
 
-		//Grab the frame
-		frame = con.getFrame();
+		//Render the newest frame on screen, frames that came and went while
+		//the last one was being presented are dropped. With vsync every pass
+		//presents since that's what keeps time
+		bool changed = frames.acquire();
+		if (changed || vsync) {
+			uint64_t presentStart = SDL_GetPerformanceCounter();
+			uint64_t convertEnd = presentStart;
+
+			if (changed) {
+				const uint32_t *frame = frames.getFront();
+
+				bool filtering = !plainTexture || emu.governor->filtersAllowed();
+				shownTexture = filtering ? screenTexture : plainTexture;
+
+				void *pixels;
+				int pitch;
+				SDL_LockTexture(shownTexture, NULL, &pixels, &pitch);
+
+				if (upscaler && filtering) {
+					for (int i = 0; i < SCREEN_WIDTH*SCREEN_HEIGHT; i++)
+						upscaleInput[i] = outputPalette[frame[i]];
+					upscaler->upscale(upscaleInput, SCREEN_WIDTH*4, SCREEN_WIDTH, SCREEN_HEIGHT, (uint32_t *) pixels, pitch);
+
+					//So the filter can be picked to fit the machine
+					upscaledFrames++;
+					if (upscaledFrames % UPSCALE_REPORT_FRAMES == 0)
+						cout << "Upscale: " << upscaler->getAverageTime() << " ms/frame" << endl;
+				}
+				else if (ntsc && filtering) {
+					//The subcarrier lands a third of a cycle further along every frame,
+					//each extra line of 341 dots puts it a third of a cycle back
+					int ntscPhase = (frames.getFrontNumber() * (1 + 2*(overclockLines + overclockVblankLines))) % 3;
+					ntscFilter->filter(frame, SCREEN_WIDTH*4, (uint32_t *) pixels, pitch, ntscPhase);
+				}
+				else {
+					for (int y = 0; y < SCREEN_HEIGHT; y++) {
+						uint32_t *row = (uint32_t *)((uint8_t *) pixels + y*pitch);
+						for (int x = 0; x < SCREEN_WIDTH; x++)
+							row[x] = outputPalette[frame[y*SCREEN_WIDTH + x]];
+					}
+				}
 
-		//Translate frame data to pixel data
-		for (int j = 0; j < SCREEN_HEIGHT; j++) {
-			for (int i = 0; i < SCREEN_WIDTH; i++) {
-				pixels[j][i] = palette[frame.buffer[i][j]];
-			}
-		}
+				SDL_UnlockTexture(shownTexture);
+				convertEnd = SDL_GetPerformanceCounter();
 
-		//Update controller status
-		controller->pressButton(buttonPress);
-		controller->releaseButton(buttonRelease);
-		
-		//Render frame on screen
-		SDL_RenderClear(renderer);
+				//What the filters cost is only seen here, on this thread
+				if (emu.governor)
+					emu.governor->frameConverted((double)(convertEnd - presentStart) * 1000 / SDL_GetPerformanceFrequency());
+			}
 
-		SDL_Texture *txt = SDL_CreateTextureFromSurface(renderer, testImage);
+			SDL_RenderClear(renderer);
+			SDL_RenderCopy(renderer, shownTexture, NULL, NULL);
 
-		SDL_RenderCopy(renderer, txt, NULL, NULL);
+			if (overlay && overlayShown) {
+				if (capture)
+					overlay->setVideoQueue(capture->getQueueDepth(), CAPTURE_QUEUE_FRAMES);
 
-		SDL_RenderPresent(renderer);
+				void *pixels;
+				int pitch;
+				SDL_LockTexture(overlayTexture, NULL, &pixels, &pitch);
+				overlay->draw((uint32_t *) pixels, pitch);
+				SDL_UnlockTexture(overlayTexture);
 
-		SDL_DestroyTexture(txt);
+				int outputWidth, outputHeight;
+				SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight);
+				SDL_Rect area = { 0, 0, PERF_OVERLAY_WIDTH * outputWidth / SCREEN_WIDTH, PERF_OVERLAY_HEIGHT * outputHeight / SCREEN_HEIGHT };
+				SDL_RenderCopy(renderer, overlayTexture, NULL, &area);
+			}
 
-		//cout << "Frame " << framecounter << " rendered" << endl;
+			//Present isn't timed with vsync on, it's mostly waiting
+			if (!vsync)
+				SDL_RenderPresent(renderer);
 
-		//framecounter++;
+			uint64_t presentEnd = SDL_GetPerformanceCounter();
+			presentTime += (double)(presentEnd - presentStart) * 1000 / SDL_GetPerformanceFrequency();
+			presentedFrames++;
 
-		//Get frame time and delay to cap framerate
-		unsigned int frameTime = SDL_GetTicks() - start;
+			if (overlay) {
+				double convert = (double)(convertEnd - presentStart) * 1000 / SDL_GetPerformanceFrequency();
+				double present = (double)(presentEnd - convertEnd) * 1000 / SDL_GetPerformanceFrequency();
+				overlay->presentedFrame(convert, present);
+			}
+			if (presentedFrames % PRESENT_REPORT_FRAMES == 0) {
+				cout << "Present: " << presentTime / PRESENT_REPORT_FRAMES << " ms/frame" << endl;
+				presentTime = 0;
+			}
 
-		if (frameTime < SCREEN_TICKS_PER_FRAME) {
-			SDL_Delay(SCREEN_TICKS_PER_FRAME - frameTime);
+			if (vsync) {
+				SDL_RenderPresent(renderer);
+
+				//Every pass presents so they come back once a refresh, if
+				//that's near enough the NES's rate the emulation can follow
+				//it and never have to drop or repeat a frame
+				uint64_t presented = SDL_GetPerformanceCounter();
+				if (displaySamples == DISPLAY_RATE_SAMPLES) {
+					double displayRate = DISPLAY_RATE_SAMPLES * (double) SDL_GetPerformanceFrequency() / (presented - displayStart);
+					if (fabs(displayRate - NES_FRAME_RATE) > NES_FRAME_RATE * DISPLAY_RATE_TOLERANCE)
+						displayRate = 0;
+					emu.displayRate.store(displayRate, memory_order_relaxed);
+					displaySamples = 0;
+				}
+				if (displaySamples == 0)
+					displayStart = presented;
+				displaySamples++;
+			}
+		}
+		else {
+			//Nothing new to show yet
+			SDL_Delay(1);
 		}
 	}
 
+	emu.running.store(false, memory_order_release);
+	emulator.join();
+
 	//Free resources
-	SDL_FreeSurface(testImage);
+	SDL_DestroyTexture(screenTexture);
+	if (plainTexture)
+		SDL_DestroyTexture(plainTexture);
+
+	delete emu.governor;
+
+	if (overlay) {
+		SDL_DestroyTexture(overlayTexture);
+		delete overlay;
+	}
+
+	if (upscaler) {
+		delete upscaler;
+		delete[] upscaleInput;
+	}
+
+	if (capture) {
+		capture->finish();
+		cout << "Capture: " << capture->getFramesWritten() << " frames written, " << capture->getFramesDropped() << " dropped" << endl;
+		delete capture;
+	}
+
+	if (ntsc)
+		delete ntscFilter;
+
+	delete[] ppuOutput;
 
 	SDL_DestroyRenderer(renderer);
 
 	SDL_DestroyWindow(window);
 
 	SDL_Quit();
-}
\ No newline at end of file
+}
@@ -0,0 +1,221 @@
+#include "LiveInput.h"
+
+#include <iostream>
+#include <chrono>
+
+#if defined(__linux__)
+//linux/input.h has its own BTN_A, BTN_START and so on, so the NES ones are
+//copied out before it's included
+static const uint8_t nesA = BTN_A;
+static const uint8_t nesB = BTN_B;
+static const uint8_t nesSelect = BTN_SELECT;
+static const uint8_t nesStart = BTN_START;
+static const uint8_t nesUp = BTN_UP;
+static const uint8_t nesDown = BTN_DOWN;
+static const uint8_t nesLeft = BTN_LEFT;
+static const uint8_t nesRight = BTN_RIGHT;
+
+#undef BTN_A
+#undef BTN_B
+#undef BTN_SELECT
+#undef BTN_START
+#undef BTN_UP
+#undef BTN_DOWN
+#undef BTN_LEFT
+#undef BTN_RIGHT
+
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+
+//Older headers only have the timeval
+#ifndef input_event_sec
+#define input_event_sec		time.tv_sec
+#define input_event_usec	time.tv_usec
+#endif
+#endif
+
+using namespace std;
+
+LiveInput::LiveInput() {
+	buttons = 0x00;
+	changeTime = 0;
+	changeCount = 0;
+	seenChanges = 0;
+
+	device = -1;
+	running = false;
+
+	resetStats();
+}
+
+LiveInput::~LiveInput() {
+	if (running.load(memory_order_relaxed)) {
+		running.store(false, memory_order_release);
+		thread.join();
+	}
+
+#if defined(__linux__)
+	if (device >= 0)
+		close(device);
+#endif
+}
+
+int64_t LiveInput::now() {
+#if defined(__linux__)
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+#else
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void LiveInput::change(uint8_t pressed, uint8_t released, int64_t time) {
+	uint8_t old = buttons.load(memory_order_relaxed);
+	uint8_t next;
+	do {
+		next = (old | pressed) & ~released;
+	} while (!buttons.compare_exchange_weak(old, next, memory_order_relaxed));
+
+	//Key repeats and keys that aren't buttons don't count as changes
+	if (next == old)
+		return;
+
+	changeTime.store(time, memory_order_relaxed);
+	changeCount.fetch_add(1, memory_order_release);
+}
+
+void LiveInput::press(uint8_t buttons, int64_t time) {
+	change(buttons, 0x00, time);
+}
+
+void LiveInput::release(uint8_t buttons, int64_t time) {
+	change(0x00, buttons, time);
+}
+
+uint8_t LiveInput::sample() {
+	uint32_t count = changeCount.load(memory_order_acquire);
+	uint8_t held = buttons.load(memory_order_relaxed);
+
+	if (count != seenChanges) {
+		seenChanges = count;
+
+		double age = (now() - changeTime.load(memory_order_relaxed)) / 1e6;
+		stats.changes++;
+		ageSum += age;
+		if (age > stats.maxAge)
+			stats.maxAge = age;
+	}
+
+	return held;
+}
+
+InputLatencyStats LiveInput::getStats() {
+	InputLatencyStats result = stats;
+	if (stats.changes)
+		result.meanAge = ageSum / stats.changes;
+	return result;
+}
+
+void LiveInput::resetStats() {
+	stats.changes = 0;
+	stats.meanAge = 0;
+	stats.maxAge = 0;
+	ageSum = 0;
+}
+
+#if defined(__linux__)
+//Same layout as the SDL keys in IXNES, plus the usual gamepad buttons
+static uint8_t deviceButton(uint16_t code) {
+	switch (code) {
+		case KEY_UP:
+		case BTN_DPAD_UP:
+			return nesUp;
+		case KEY_DOWN:
+		case BTN_DPAD_DOWN:
+			return nesDown;
+		case KEY_LEFT:
+		case BTN_DPAD_LEFT:
+			return nesLeft;
+		case KEY_RIGHT:
+		case BTN_DPAD_RIGHT:
+			return nesRight;
+		case KEY_Z:
+		case BTN_SOUTH:
+			return nesB;
+		case KEY_X:
+		case BTN_EAST:
+			return nesA;
+		case KEY_ENTER:
+		case BTN_START:
+			return nesStart;
+		case KEY_RIGHTSHIFT:
+		case BTN_SELECT:
+			return nesSelect;
+	}
+	return 0x00;
+}
+#endif
+
+void LiveInput::readDevice() {
+#if defined(__linux__)
+	pollfd waiting;
+	waiting.fd = device;
+	waiting.events = POLLIN;
+
+	while (running.load(memory_order_acquire)) {
+		//Times out now and then to see if it's time to stop
+		if (poll(&waiting, 1, INPUT_DEVICE_POLL_MS) <= 0)
+			continue;
+
+		input_event events[64];
+		ssize_t size = read(device, events, sizeof(events));
+		if (size <= 0) {
+			cout << "Error: lost the input device" << endl;
+			break;
+		}
+
+		for (unsigned int i = 0; i < size / sizeof(input_event); i++) {
+			//Value 2 is a key repeat
+			if (events[i].type != EV_KEY || events[i].value == 2)
+				continue;
+
+			uint8_t button = deviceButton(events[i].code);
+			if (!button)
+				continue;
+
+			int64_t time = (int64_t)events[i].input_event_sec * 1000000000 + (int64_t)events[i].input_event_usec * 1000;
+			if (events[i].value)
+				press(button, time);
+			else
+				release(button, time);
+		}
+	}
+#endif
+}
+
+bool LiveInput::openDevice(const char *path) {
+#if defined(__linux__)
+	if (device >= 0)
+		return false;
+
+	device = open(path, O_RDONLY | O_NONBLOCK);
+	if (device < 0)
+		return false;
+
+	//Timestamps on the same clock as now(), they're wall clock otherwise
+	int clock = CLOCK_MONOTONIC;
+	if (ioctl(device, EVIOCSCLOCKID, &clock) != 0)
+		cout << "Warning: input device timestamps aren't monotonic, latency stats will be off" << endl;
+
+	running = true;
+	thread = std::thread(&LiveInput::readDevice, this);
+	return true;
+#else
+	return false;
+#endif
+}
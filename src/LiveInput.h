@@ -0,0 +1,80 @@
+#ifndef LIVEINPUT_H
+#define LIVEINPUT_H
+
+#include "Controller.h"
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+
+//How long the device thread waits for an event before checking whether
+//it should stop, in ms
+#define INPUT_DEVICE_POLL_MS	100
+
+//How old button changes were when the game latched them since the last
+//resetStats
+struct InputLatencyStats {
+	//Changes that reached the game, several between two latches count once
+	int changes;
+
+	//Latch time minus the time the change arrived, in ms
+	double meanAge;
+	double maxAge;
+};
+
+//Controller buttons as they are right now, for Controller::setInputSource
+//
+//Whatever thread sees the host's input events calls press and release with
+//the time each one arrived, the emulation thread reads the buttons when the
+//game strobes the controller instead of once at the start of the frame. The
+//buttons are a single atomic byte so any number of threads can feed it.
+//openDevice starts a thread of its own reading a Linux input device, those
+//events come with the kernel's timestamps
+class LiveInput : public InputSource {
+	std::atomic<uint8_t> buttons;
+
+	//Arrival time of the last change in ns and how many there have been, so
+	//the emulation thread can tell whether a latch picked up a new one
+	std::atomic<int64_t> changeTime;
+	std::atomic<uint32_t> changeCount;
+
+	//Only touched by the thread calling sample
+	uint32_t seenChanges;
+	InputLatencyStats stats;
+	double ageSum;
+
+	int device;
+	std::atomic<bool> running;
+	std::thread thread;
+
+	void change(uint8_t pressed, uint8_t released, int64_t time);
+
+	void readDevice();
+
+public:
+	LiveInput();
+
+	//Stops the device thread if there is one
+	~LiveInput();
+
+	//Monotonic time in ns, the clock press and release times are on
+	static int64_t now();
+
+	void press(uint8_t buttons, int64_t time);
+
+	void release(uint8_t buttons, int64_t time);
+
+	//Buttons held right now, called by the controller when it's latched
+	uint8_t sample();
+
+	//Reads keys and gamepad buttons from an evdev device (/dev/input/event*)
+	//on a thread of its own, alongside whatever else calls press and
+	//release. Returns false if it couldn't be opened or isn't supported here
+	bool openDevice(const char *path);
+
+	InputLatencyStats getStats();
+
+	void resetStats();
+};
+
+#endif
@@ -36,6 +36,8 @@ void MMC1::writeRegister(uint16_t address, uint8_t data) {
 		prgRAMDisabled = data & 0x10;
 		prgBank = data & 0x0F;
 	}
+
+	updatePPUPages();
 }
 
 uint32_t MMC1::translatePrgRomAddress(uint16_t address) {
@@ -85,6 +87,18 @@ uint32_t MMC1::translateChrRomAddress(uint16_t address) {
 	}
 }
 
+void MMC1::updatePPUPages() {
+	for (int i = 0; i < 8; i++) {
+		if (chrBankMode == CHRMODE_RAM)
+			chrPages[i] = chrRAM + ((i * PPU_PAGE_SIZE) % chrRAMSize);
+		else
+			chrPages[i] = chrROM + translateChrRomAddress(i * PPU_PAGE_SIZE);
+	}
+
+	for (int i = 0; i < 4; i++)
+		nametablePages[i] = vram + (mirroringTable[i] * PPU_PAGE_SIZE);
+}
+
 uint8_t MMC1::cpuRead(uint16_t address) {
 	//PRG-RAM region
 	if (address < 0x8000 && address >= 0x6000) {
@@ -240,6 +254,8 @@ MMC1::MMC1(Console *con, RomImage *rom) {
 	prgBank = 0x00;
 
 	prgRAMDisabled = 0x00;
+
+	updatePPUPages();
 }
 
 MMC1::~MMC1() {
@@ -84,6 +84,9 @@ class MMC1: public Mapper {
 
 	uint32_t translateChrRomAddress(uint16_t address);
 
+	//Points the PPU pages at the current CHR banks and mirrored nametables
+	void updatePPUPages();
+
 public:
 	MMC1(Console *con, RomImage *rom);
 
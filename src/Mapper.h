@@ -2,10 +2,37 @@
 #define MAPPER_H
 
 #include <cstdint>
+#include <cstddef>
+
+//Size of the pages the PPU fetches through
+#define PPU_PAGE_SIZE	0x0400
 
 //Abstract base class for Mappers
 class Mapper {
+protected:
+	//Memory currently mapped into the PPU's address space, CHR in eight
+	//1KB pages ($0000-$1FFF) and the four nametables ($2000-$2FFF, which
+	//$3000-$3EFF mirrors). Mappers have to keep these up to date whenever
+	//banking or mirroring changes, the PPU reads through them for rendering
+	uint8_t *chrPages[8];
+
+	uint8_t *nametablePages[4];
+
+	//Set by mappers that need to see every rendering fetch (e.g. MMC3
+	//watching A12), the PPU then calls ppuFetch before each one
+	bool fetchNotify;
+
 public:
+	Mapper() {
+		for (int i = 0; i < 8; i++)
+			chrPages[i] = NULL;
+		for (int i = 0; i < 4; i++)
+			nametablePages[i] = NULL;
+		fetchNotify = false;
+	}
+
+	virtual ~Mapper() {}
+
 	virtual uint8_t cpuRead(uint16_t address) = 0;
 
 	virtual uint8_t debugCpuRead(uint16_t address) = 0;
@@ -17,6 +44,27 @@ public:
 	virtual uint8_t debugPpuRead(uint16_t address) = 0;
 
 	virtual void ppuWrite(uint16_t address, uint8_t data) = 0;
+
+	//Only called when fetchNotify is set
+	virtual void ppuFetch(uint16_t) {}
+
+	uint8_t **getChrPages() { return chrPages; }
+
+	uint8_t **getNametablePages() { return nametablePages; }
+
+	bool notifiesFetches() { return fetchNotify; }
+
+	//Snapshot of the mapper's RAM and registers, see Console::saveState.
+	//Mappers that can be snapshotted override all four, loadState has to
+	//leave the PPU pages pointing where they did. The console won't run
+	//ahead with any that don't
+	virtual bool hasState() { return false; }
+
+	virtual size_t stateSize() { return 0; }
+
+	virtual void saveState(uint8_t *) {}
+
+	virtual void loadState(const uint8_t *) {}
 };
 
 #endif
\ No newline at end of file
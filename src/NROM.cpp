@@ -2,6 +2,8 @@
 #include "ROM.h"
 #include "Console.h"
 
+#include <cstring>
+
 uint8_t NROM::cpuRead(uint16_t address) {
 	//PRG-RAM region
 	if (address < 0x8000 && address >= 0x6000) {
@@ -46,6 +48,14 @@ void NROM::cpuWrite(uint16_t address, uint8_t data) {
 
 }
 
+void NROM::updatePPUPages() {
+	for (int i = 0; i < 8; i++)
+		chrPages[i] = chrROM + (i * PPU_PAGE_SIZE);
+
+	for (int i = 0; i < 4; i++)
+		nametablePages[i] = vram + (mirroringTable[i] * PPU_PAGE_SIZE);
+}
+
 uint8_t NROM::ppuRead(uint16_t address) {
 	if (address < 0x2000) {
 		return chrROM[address];
@@ -114,10 +124,44 @@ NROM::NROM(Console *con, RomImage *rom) {
 		mirroringTable[2] = 0;
 		mirroringTable[3] = 1;
 	}
+
+	updatePPUPages();
 }
 
 NROM::~NROM() {
 	delete rom;
 	delete vram;
 	delete prgRAM;
-}
\ No newline at end of file
+}
+
+bool NROM::hasState() {
+	return true;
+}
+
+//Nametables, PRG-RAM and CHR-RAM. The pages never move so there's nothing
+//else to keep
+size_t NROM::stateSize() {
+	return vramSize + prgRAMSize + (chrROMSize == 0 ? 0x2000 : 0);
+}
+
+void NROM::saveState(uint8_t *state) {
+	memcpy(state, vram, vramSize);
+	state += vramSize;
+	if (prgRAMSize != 0) {
+		memcpy(state, prgRAM, prgRAMSize);
+		state += prgRAMSize;
+	}
+	if (chrROMSize == 0)
+		memcpy(state, chrROM, 0x2000);
+}
+
+void NROM::loadState(const uint8_t *state) {
+	memcpy(vram, state, vramSize);
+	state += vramSize;
+	if (prgRAMSize != 0) {
+		memcpy(prgRAM, state, prgRAMSize);
+		state += prgRAMSize;
+	}
+	if (chrROMSize == 0)
+		memcpy(chrROM, state, 0x2000);
+}
@@ -31,6 +31,9 @@ class NROM: public Mapper {
 
 	uint8_t mirroringTable[4];
 
+	//Points the PPU pages at the current CHR bank and mirrored nametables
+	void updatePPUPages();
+
 public:
 	NROM(Console *con, RomImage *rom);
 
@@ -47,6 +50,14 @@ public:
 	uint8_t debugPpuRead(uint16_t address);
 
 	void ppuWrite(uint16_t address, uint8_t data);
+
+	bool hasState();
+
+	size_t stateSize();
+
+	void saveState(uint8_t *state);
+
+	void loadState(const uint8_t *state);
 };
 
 #endif
\ No newline at end of file
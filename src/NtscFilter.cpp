@@ -0,0 +1,245 @@
+#include "NtscFilter.h"
+#include "Palette.h"
+
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+//Voltages the PPU puts out, relative to sync. Each colour is a square wave
+//between a low and a high level picked by the top two bits of the index
+static const float signalLow[4] = {0.350f, 0.518f, 0.962f, 1.550f};
+static const float signalHigh[4] = {1.094f, 1.506f, 1.962f, 1.962f};
+#define SIGNAL_BLACK	0.518f
+#define SIGNAL_WHITE	1.962f
+
+//Emphasis bits pull the signal down during the part of the subcarrier cycle
+//belonging to their colour
+#define SIGNAL_ATTENUATION	0.746f
+
+//Lines up the decoder's colour burst with the palette's idea of hue 1
+#define NTSC_HUE	3.9
+
+//Samples of black around the line so the edge columns don't need special cases
+#define NTSC_MARGIN	NTSC_TAPS
+
+//True if a colour's square wave is high at the given sample phase
+static bool inColorPhase(int color, int phase) {
+	return (color + phase) % NTSC_SUBCARRIER_SAMPLES < 6;
+}
+
+NtscFilter::NtscFilter(int threads, uint8_t format) {
+	this->format = format;
+
+	input = NULL;
+	inputPitch = 0;
+	output = NULL;
+	outputPitch = 0;
+	phase = 0;
+
+	generation = 0;
+	stopping = false;
+
+	nextRow = 240;
+	rowsDone = 240;
+
+	buildTables();
+
+	for (int i = 0; i < threads; i++)
+		workers.push_back(thread(&NtscFilter::work, this));
+}
+
+NtscFilter::~NtscFilter() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void NtscFilter::buildTables() {
+	for (int start = 0; start < 3; start++) {
+		for (int index = 0; index < 512; index++) {
+			int color = index & 0x0F;
+			int level = (index >> 4) & 0x03;
+			int emphasis = index >> 6;
+
+			//$xE/$xF are the same black as $0D but $xD on levels 1-3 aren't
+			if (color > 13)
+				level = 1;
+
+			float low = signalLow[level];
+			float high = signalHigh[level];
+			//Colour 0 is flat at the high level, $xD-$xF at the low one
+			if (color == 0)
+				low = high;
+			if (color > 12)
+				high = low;
+
+			for (int i = 0; i < NTSC_SAMPLES_PER_PIXEL; i++) {
+				int samplePhase = start * 4 + i;
+
+				float voltage = inColorPhase(color, samplePhase) ? high : low;
+
+				if (((emphasis & 0x01) && inColorPhase(0, samplePhase))
+				 || ((emphasis & 0x02) && inColorPhase(4, samplePhase))
+				 || ((emphasis & 0x04) && inColorPhase(8, samplePhase)))
+					voltage *= SIGNAL_ATTENUATION;
+
+				signal[start][index][i] = (voltage - SIGNAL_BLACK) / (SIGNAL_WHITE - SIGNAL_BLACK);
+			}
+		}
+	}
+
+	//Luma is the average over one subcarrier cycle which cancels the colour
+	//out, I and Q are the signal multiplied by the subcarrier over two. Then
+	//the usual YIQ to RGB matrix is folded in
+	for (int phase = 0; phase < NTSC_SUBCARRIER_SAMPLES; phase++) {
+		for (int k = 0; k < NTSC_TAPS; k++) {
+			float y = 0;
+			if (k >= NTSC_TAPS/2 - 6 && k < NTSC_TAPS/2 + 6)
+				y = 1.0f / 12;
+
+			double angle = M_PI * (phase + k + NTSC_HUE) / 6;
+			float i = cos(angle) / 12;
+			float q = sin(angle) / 12;
+
+			kernels[phase][0][k] = y + 0.946882f*i + 0.623557f*q;
+			kernels[phase][1][k] = y - 0.274788f*i - 0.635691f*q;
+			kernels[phase][2][k] = y - 1.108545f*i + 1.709007f*q;
+		}
+	}
+
+	//Columns are spread evenly over the line, each one centered on its window
+	for (int x = 0; x < NTSC_OUTPUT_WIDTH; x++)
+		columnStart[x] = (2*x + 1) * NTSC_LINE_SAMPLES / (2*NTSC_OUTPUT_WIDTH) - NTSC_TAPS/2;
+}
+
+void NtscFilter::work() {
+	uint64_t seen = 0;
+
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+
+		filterRows();
+	}
+}
+
+void NtscFilter::filterRows() {
+	int row;
+	while ((row = nextRow.fetch_add(NTSC_ROWS_PER_JOB)) < 240) {
+		int end = row + NTSC_ROWS_PER_JOB;
+		if (end > 240)
+			end = 240;
+
+		for (int i = row; i < end; i++)
+			filterRow(i);
+
+		rowsDone.fetch_add(end - row, memory_order_release);
+	}
+}
+
+void NtscFilter::filter(const uint32_t *input, int inputPitch, uint32_t *output, int outputPitch, int phase) {
+	{
+		lock_guard<mutex> guard(lock);
+		this->input = input;
+		this->inputPitch = inputPitch;
+		this->output = output;
+		this->outputPitch = outputPitch;
+		this->phase = phase;
+		rowsDone = 0;
+		nextRow = 0;
+		generation++;
+	}
+	wake.notify_all();
+
+	filterRows();
+
+	while (rowsDone.load(memory_order_acquire) < 240)
+		this_thread::yield();
+}
+
+void NtscFilter::filterRow(int row) {
+	const uint32_t *in = (const uint32_t *)((const uint8_t *)input + row * inputPitch);
+	uint32_t *out = (uint32_t *)((uint8_t *)output + row * outputPitch);
+
+	//A line is 341*8 samples so every line starts 4 samples further along
+	//the subcarrier than the one above
+	int linePhase = (phase + row) % 3;
+
+	alignas(32) float line[NTSC_MARGIN + NTSC_LINE_SAMPLES + NTSC_MARGIN];
+	memset(line, 0, NTSC_MARGIN * sizeof(float));
+	memset(line + NTSC_MARGIN + NTSC_LINE_SAMPLES, 0, NTSC_MARGIN * sizeof(float));
+
+	//Pixels are 8 samples, so they start on every third of a cycle in turn
+	float *samples = line + NTSC_MARGIN;
+	for (int x = 0; x < 256; x++) {
+		memcpy(samples, signal[(linePhase + 2*x) % 3][in[x] & 0x1FF], NTSC_SAMPLES_PER_PIXEL * sizeof(float));
+		samples += NTSC_SAMPLES_PER_PIXEL;
+	}
+
+	for (int x = 0; x < NTSC_OUTPUT_WIDTH; x++) {
+		int start = columnStart[x];
+		const float *window = line + NTSC_MARGIN + start;
+		const float (*kernel)[NTSC_TAPS] = kernels[(linePhase*4 + start + NTSC_SUBCARRIER_SAMPLES) % NTSC_SUBCARRIER_SAMPLES];
+
+		//Room for a fourth lane so the SSE path can store straight into it
+		int rgb[4];
+
+#if defined(__AVX__)
+		__m256 r = _mm256_setzero_ps();
+		__m256 g = _mm256_setzero_ps();
+		__m256 b = _mm256_setzero_ps();
+		for (int k = 0; k < NTSC_TAPS; k += 8) {
+			__m256 s = _mm256_loadu_ps(window + k);
+			r = _mm256_add_ps(r, _mm256_mul_ps(s, _mm256_loadu_ps(kernel[0] + k)));
+			g = _mm256_add_ps(g, _mm256_mul_ps(s, _mm256_loadu_ps(kernel[1] + k)));
+			b = _mm256_add_ps(b, _mm256_mul_ps(s, _mm256_loadu_ps(kernel[2] + k)));
+		}
+		__m128 r4 = _mm_add_ps(_mm256_castps256_ps128(r), _mm256_extractf128_ps(r, 1));
+		__m128 g4 = _mm_add_ps(_mm256_castps256_ps128(g), _mm256_extractf128_ps(g, 1));
+		__m128 b4 = _mm_add_ps(_mm256_castps256_ps128(b), _mm256_extractf128_ps(b, 1));
+#elif defined(__SSE2__)
+		__m128 r4 = _mm_setzero_ps();
+		__m128 g4 = _mm_setzero_ps();
+		__m128 b4 = _mm_setzero_ps();
+		for (int k = 0; k < NTSC_TAPS; k += 4) {
+			__m128 s = _mm_loadu_ps(window + k);
+			r4 = _mm_add_ps(r4, _mm_mul_ps(s, _mm_loadu_ps(kernel[0] + k)));
+			g4 = _mm_add_ps(g4, _mm_mul_ps(s, _mm_loadu_ps(kernel[1] + k)));
+			b4 = _mm_add_ps(b4, _mm_mul_ps(s, _mm_loadu_ps(kernel[2] + k)));
+		}
+#endif
+
+#if defined(__SSE2__)
+		//Sum each channel's four lanes at once, ending up with R, G, B, 0
+		__m128 a4 = _mm_setzero_ps();
+		_MM_TRANSPOSE4_PS(r4, g4, b4, a4);
+		__m128 sum = _mm_add_ps(_mm_add_ps(r4, g4), _mm_add_ps(b4, a4));
+		sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+		_mm_storeu_si128((__m128i *)rgb, _mm_cvtps_epi32(_mm_mul_ps(sum, _mm_set1_ps(255.0f))));
+#else
+		for (int c = 0; c < 3; c++) {
+			float sum = 0;
+			for (int k = 0; k < NTSC_TAPS; k++)
+				sum += window[k] * kernel[c][k];
+			rgb[c] = sum <= 0 ? 0 : sum >= 1 ? 255 : (int)(sum * 255 + 0.5f);
+		}
+#endif
+
+		out[x] = packPixel(rgb[0], rgb[1], rgb[2], format);
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef NTSCFILTER_H
+#define NTSCFILTER_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+//The PPU outputs 8 samples of composite signal per pixel at 12 samples per
+//colour subcarrier cycle, so a line is 2048 samples
+#define NTSC_SAMPLES_PER_PIXEL	8
+#define NTSC_LINE_SAMPLES		(256*NTSC_SAMPLES_PER_PIXEL)
+#define NTSC_SUBCARRIER_SAMPLES	12
+
+//Width of the filtered image, about 7 columns for every 3 pixels so the
+//colour fringes have room to show up
+#define NTSC_OUTPUT_WIDTH		602
+
+//Samples that go into each output column, two subcarrier cycles for the
+//chroma and the middle one for the luma
+#define NTSC_TAPS				24
+
+//Rows handed to a worker at a time
+#define NTSC_ROWS_PER_JOB		8
+
+//Composite video filter
+//
+//Turns a frame of EEEPPPPPP output palette indices (see PIXEL_FORMAT_INDEX)
+//back into the signal the PPU would have sent to the TV and decodes it again,
+//which gets the colour bleed and dot crawl of a real NTSC picture. Both
+//halves are table driven: the signal for every index at every phase a pixel
+//can start on is worked out up front, and so is a kernel for every
+//subcarrier phase that turns 24 samples straight into R, G and B. Decoding a
+//column is then just three dot products, done with SSE2 (or AVX when built
+//for it). Rows are split up between a pool of worker threads and whoever
+//called filter()
+class NtscFilter {
+	uint8_t format;
+
+	//Signal for each index starting at each subcarrier phase a pixel can start
+	//on (0, 4 or 8 samples), levels are 0 for black and 1 for white
+	float signal[3][512][NTSC_SAMPLES_PER_PIXEL];
+
+	//R, G and B weights of the samples going into a column for each
+	//subcarrier phase of the first sample
+	float kernels[NTSC_SUBCARRIER_SAMPLES][3][NTSC_TAPS];
+
+	//First sample of each output column
+	int columnStart[NTSC_OUTPUT_WIDTH];
+
+	//Current frame
+	const uint32_t *input;
+	int inputPitch;
+	uint32_t *output;
+	int outputPitch;
+	int phase;
+
+	std::vector<std::thread> workers;
+
+	std::mutex lock;
+	std::condition_variable wake;
+
+	//Bumped by filter() so the workers know there's a new frame
+	uint64_t generation;
+
+	bool stopping;
+
+	std::atomic<int> nextRow;
+	std::atomic<int> rowsDone;
+
+	void buildTables();
+
+	void work();
+
+	//Grabs rows off the frame until there are none left
+	void filterRows();
+
+	void filterRow(int row);
+
+public:
+	//threads is the number of workers on top of the thread calling filter(),
+	//format is one of the PIXEL_FORMAT_* values in Palette.h
+	NtscFilter(int threads, uint8_t format);
+
+	~NtscFilter();
+
+	//Filters a 256x240 frame of indices into a NTSC_OUTPUT_WIDTHx240 image,
+	//pitches are the length of a row in bytes. phase (0-2) is where the
+	//subcarrier is at the start of the frame in thirds of a cycle, it moves
+	//on by one every frame which is what makes the dots crawl
+	void filter(const uint32_t *input, int inputPitch, uint32_t *output, int outputPitch, int phase);
+};
+
+#endif
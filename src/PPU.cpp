@@ -1,18 +1,41 @@
 #include "PPU.h"
 #include "Console.h"
+#include "Mapper.h"
+#include "Palette.h"
+#include "Rasterizer.h"
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 void PPU::writeVRAM(uint16_t address, uint8_t data) {
 	//Not palette RAM, hand off to console for memory mapping
 	if ((address & 0x3FFF) < 0x3F00) {
+		if (deferFrame)
+			drawLoggedLines();
+
 		console->ppuWrite(address, data);
+
+		//Keep the attribute cache up to date, a nametable can show up in more
+		//than one slot depending on mirroring
+		if ((address & 0x2000) && (address & 0x03FF) >= 0x03C0) {
+			uint8_t *page = nametablePages[(address >> 10) & 0x03];
+			for (int i = 0; i < 4; i++) {
+				if (attrCachePages[i] == page)
+					expandAttrByte(i, address & 0x003F, data);
+			}
+		}
 	}
 	//Palette RAM, handle access and mirroring internally
 	else {
+		logChange(CHANGE_PALETTE, address & 0x1F, data);
+		stats.paletteWrites++;
+
 		//if background entry, mirror corresponding entries in bg and sprite palettes
 		if ((address & 0x0003) == 0) {
 			paletteRAM[0x00 | (address & 0x0F)] = data;
@@ -36,6 +59,16 @@ uint8_t PPU::readVRAM(uint16_t address) {
 	}
 }
 
+uint8_t PPU::fetchVRAM(uint16_t address) {
+	if (fetchNotify)
+		mapper->ppuFetch(address);
+
+	if (address < 0x2000)
+		return chrPages[address >> 10][address & 0x03FF];
+	else
+		return nametablePages[(address >> 10) & 0x03][address & 0x03FF];
+}
+
 bool PPU::renderingEnabled() {
 	return ( (ppuControl2 & CONTROL2_BG_RNDR) || (ppuControl2 & CONTROL2_SPR_RNDR) );
 }
@@ -44,7 +77,7 @@ bool PPU::renderingEnabled() {
 //Bit manipulation based on how the accessAddress register is used
 //during rendering. See description of rendering (wherever I end up putting that)
 uint8_t PPU::retrieveNameTableByte(uint16_t address) {
-	return readVRAM((address & 0x0FFF) | 0x2000);	
+	return fetchVRAM((address & 0x0FFF) | 0x2000);
 }
 
 //Attribute table contains the upper two bits of the palette entry
@@ -64,18 +97,41 @@ uint8_t PPU::retrieveNameTableByte(uint16_t address) {
 //			---------------------------------
 //All of which is horrendously complicated
 uint8_t PPU::retrieveAttrTableBits(uint16_t address) {
-	//Calculates the address of the appropriate byte in the attribute table
-	//						   Nametable region offset   Attr offset    Nametable select     Y select                    X Select									
-	uint16_t attributeAddress = 0x2000                  | 0x03C0       | (address & 0x0C00) | ((address & 0x0380) >> 4) | ((address & 0x001C) >> 2);
-	//Calculates which square within the byte that the tile belongs to
-	//					   X coordinate				   Y coordinate
-	uint8_t squareNumber = ((address & 0x0002) >> 1) | ((address & 0x0040) >> 5);
-	
-	//DEBUG
-	//cout << "Attr fetch:" << endl << "\t" << hex << attributeAddress << ": " << +readVRAM(attributeAddress) << endl;
-	
-	//Retrieves the byte from VRAM, shifts the appropriate bits to the end and masks the rest away
-	return (readVRAM(attributeAddress) >> (2 * squareNumber)) & 0x03;
+	//The fetch still happens as far as the mapper is concerned
+	if (fetchNotify)
+		mapper->ppuFetch(0x23C0 | (address & 0x0C00) | ((address & 0x0380) >> 4) | ((address & 0x001C) >> 2));
+
+	//The cache is laid out the same way the access address is
+	//		Nametable select				  Coarse Y					Coarse X
+	return attrCache[(address >> 10) & 0x03][(address >> 5) & 0x1F][address & 0x1F];
+}
+
+//Attribute byte index is YYYXXX, each one covers a 4*4 block of tiles
+void PPU::expandAttrByte(uint8_t nametable, uint8_t index, uint8_t data) {
+	int top = (index >> 3) * 4;
+	int left = (index & 0x07) * 4;
+
+	for (int y = top; y < top + 4; y++) {
+		for (int x = left; x < left + 4; x++) {
+			//Same square numbering as described above
+			uint8_t squareNumber = ((x & 0x02) >> 1) | (y & 0x02);
+			attrCache[nametable][y][x] = (data >> (2 * squareNumber)) & 0x03;
+		}
+	}
+}
+
+void PPU::rebuildAttrCache(uint8_t nametable) {
+	attrCachePages[nametable] = nametablePages[nametable];
+
+	for (int i = 0; i < 64; i++)
+		expandAttrByte(nametable, i, nametablePages[nametable][0x03C0 + i]);
+}
+
+void PPU::nametablesChanged() {
+	for (int i = 0; i < 4; i++) {
+		if (attrCachePages[i] != nametablePages[i])
+			rebuildAttrCache(i);
+	}
 }
 
 //Pattern table addresses are structured like so:
@@ -95,7 +151,7 @@ uint8_t PPU::retrievePatternTableByte(bool patternTable, uint8_t patternByte, bo
 	//DEBUG
 	//cout << "PT fetch:" << endl << "\t" << hex << patternAddress << ": " << +readVRAM(patternAddress) << endl;
 
-	return readVRAM(patternAddress);
+	return fetchVRAM(patternAddress);
 }
 
 //The following several functions were pulled out of the cycle function for readability
@@ -164,92 +220,46 @@ uint8_t reverseByte(uint8_t n) {
 	return ret;
 }
 
-void PPU::fetchBGTile() {
-	//cout << +cycles << "\t" << +cycles % 8 << endl;
-	//Nametable fetch
-	if (cycles % 8 == 2) {
-		currentPattern = readVRAM((accessAddress & 0x0FFF) | 0x2000);
-		
-		//DEBUG
-		//cout << "Tile #" << dec << +cycles/8 << endl;
-		//cout << "NT fetch:" << endl << "\t" << hex << ((accessAddress & 0x0FFF) | 0x2000) << ": " << +currentPattern << endl;
-	}
-	//Attribute fetch
-	else if (cycles % 8 == 4) {
-		//cout << "DEBUG" << endl;
-		attrLatchBuffer = retrieveAttrTableBits(accessAddress);
-	}
-	//Lower pattern table fetch
-	else if (cycles % 8 == 6) {
-		patternBuffer0 = reverseByte(retrievePatternTableByte(ppuControl1 & CONTROL1_BG_PT, currentPattern, 0, accessAddress >> 12));
-	}
-	//Higher pattern table fetch/course X increment
-	else if (cycles % 8 == 0) {
-		patternBuffer1 = reverseByte(retrievePatternTableByte(ppuControl1 & CONTROL1_BG_PT, currentPattern, 1, accessAddress >> 12));
-		
-		incrementHorizontal();
-	}
-}
-
-void PPU::fetchSpriteData() {
+//Fetches one plane of the pattern for the sprite currently being loaded from
+//secondary OAM. The attributes and x position are loaded with the high plane
+void PPU::fetchSpritePattern(bool plane) {
 	//calculates which sprite object from secondary oam
 	//to pull data from
-	int16_t currentSprite = (cycles - 257)/8;
-	//Lower pattern table fetch
-	if (cycles % 8 == 6) {
-		//Sprite index was used during sprite evaluation to keep track
-		//of how many sprites have been found for the current scanline
-		//So if we have more sprites to load, grab from secondary OAM
-		//Otherwise fill with transparent data
-		if (currentSprite < spriteIndex) {
-			//If sprites are 8x16 the pattern table select bit is ignored
-			//and bit 0 from the tile index is used to indicate the appropriate pattern table
-			//bit 4 from the range comparison is then used to set bit 0 of the tile index
-			if (ppuControl1 & CONTROL1_SPR_SIZE) {
-				uint8_t pt = retrievePatternTableByte(oamSecondary[currentSprite*4+1] & 0x01, (oamSecondary[currentSprite*4+1] & 0xFE) | ((oamSecondary[currentSprite*4+0] & 0x08) >> 3), 0, oamSecondary[currentSprite*4+0] & 0x07);
-				//check horizontal flip and reverse byte as necessary
-				if (oamSecondary[currentSprite*4+2] & 0x40)
-					spriteShift[currentSprite*2+0] = pt;
-				else
-					spriteShift[currentSprite*2+0] = reverseByte(pt);
-			}
-			else {
-				uint8_t pt = retrievePatternTableByte(ppuControl1 & CONTROL1_SPR_PT, oamSecondary[currentSprite*4+1], 0, oamSecondary[currentSprite*4+0] & 0x07);
-				//check horizontal flip and reverse byte as necessary
-				if (oamSecondary[currentSprite*4+2] & 0x40)
-					spriteShift[currentSprite*2+0] = pt;
-				else
-					spriteShift[currentSprite*2+0] = reverseByte(pt);
-			}
+	int16_t currentSprite = (cycles - 257) >> 3;
+	stats.patternFetches++;
+	//Sprite index was used during sprite evaluation to keep track
+	//of how many sprites have been found for the current scanline
+	//So if we have more sprites to load, grab from secondary OAM
+	//Otherwise fill with transparent data
+	if (spriteLagDots)
+		catchUpSprites();
+
+	if (currentSprite < spriteIndex) {
+		uint8_t *sprite = &oamSecondary[currentSprite*4];
+		uint8_t pt;
+		//If sprites are 8x16 the pattern table select bit is ignored
+		//and bit 0 from the tile index is used to indicate the appropriate pattern table
+		//bit 4 from the range comparison is then used to set bit 0 of the tile index
+		if (ppuControl1 & CONTROL1_SPR_SIZE) {
+			pt = retrievePatternTableByte(sprite[1] & 0x01, (sprite[1] & 0xFE) | ((sprite[0] & 0x08) >> 3), plane, sprite[0] & 0x07);
 		}
 		else {
-			spriteShift[currentSprite*2+0] = 0x00;
+			pt = retrievePatternTableByte(ppuControl1 & CONTROL1_SPR_PT, sprite[1], plane, sprite[0] & 0x07);
 		}
-	}
-	//Higher pattern table fetch
-	else if (cycles % 8 == 0) {
-		if (currentSprite < spriteIndex) {
-			if (ppuControl1 & CONTROL1_SPR_SIZE) {
-				uint8_t pt = retrievePatternTableByte(oamSecondary[currentSprite*4+1] & 0x01, (oamSecondary[currentSprite*4+1] & 0xFE) | ((oamSecondary[currentSprite*4+0] & 0x08) >> 3), 1, oamSecondary[currentSprite*4+0] & 0x07);
-				//check horizontal flip and reverse byte as necessary
-				if (oamSecondary[currentSprite*4+2] & 0x40)
-					spriteShift[currentSprite*2+1] = pt;
-				else
-					spriteShift[currentSprite*2+1] = reverseByte(pt);
-			}
-			else {
-				uint8_t pt = retrievePatternTableByte(ppuControl1 & CONTROL1_SPR_PT, oamSecondary[currentSprite*4+1], 1, oamSecondary[currentSprite*4+0] & 0x07);
-				//check horizontal flip and reverse byte as necessary
-				if (oamSecondary[currentSprite*4+2] & 0x40)
-					spriteShift[currentSprite*2+1] = pt;
-				else
-					spriteShift[currentSprite*2+1] = reverseByte(pt);
-			}
-			spriteAttr[currentSprite] = oamSecondary[currentSprite*4+2];
-			spriteXCounter[currentSprite] = oamSecondary[currentSprite*4+3];
+		//check horizontal flip and reverse byte as necessary
+		if (sprite[2] & 0x40)
+			spriteShift[currentSprite*2+plane] = pt;
+		else
+			spriteShift[currentSprite*2+plane] = reverseByte(pt);
+
+		if (plane) {
+			spriteAttr[currentSprite] = sprite[2];
+			spriteXCounter[currentSprite] = sprite[3];
 		}
-		else {
-			spriteShift[currentSprite*2+1] = 0x00;
+	}
+	else {
+		spriteShift[currentSprite*2+plane] = 0x00;
+		if (plane) {
 			spriteAttr[currentSprite] = 0x20; //behind background
 			spriteXCounter[currentSprite] = 0xFF; //At right edge of screen
 		}
@@ -351,7 +361,7 @@ void PPU::checkSpriteOverflow() {
 		//If we have 8x16 sprites, we check 0 <= range <= 15
 		if (ppuControl1 & CONTROL1_SPR_SIZE) {
 			if (range >= 0 && range <= 15) {
-				ppuStatus |= STATUS_SPR_OVFLW;
+				setSpriteOverflow();
 				spriteMemAddress += 4;
 				readingSprite = 3;
 			}
@@ -377,7 +387,7 @@ void PPU::checkSpriteOverflow() {
 		//If we have 8x8 sprites, we check 0 <= range <= 7
 		else {
 			if (range >= 0 && range <= 7) {
-				ppuStatus |= STATUS_SPR_OVFLW;
+				setSpriteOverflow();
 				spriteMemAddress += 4;
 				readingSprite = 3;
 			}
@@ -394,15 +404,164 @@ void PPU::checkSpriteOverflow() {
 	}
 }
 
+void PPU::setSpriteOverflow() {
+	ppuStatus |= STATUS_SPR_OVFLW;
+	if (overflowStatsLine != scanline) {
+		overflowStatsLine = scanline;
+		stats.overflowLines++;
+	}
+}
+
+void PPU::spriteEvalStep() {
+	//If we've run through all of the OAM (becuase OAM is 256 bytes)
+	//then we're done evaluating sprites for this scanline so do nothing
+	if (spriteMemAddress >= 256) {
+		//Do nothing
+	}
+	//This is the part that evaluates sprites to be added to the secondary OAM
+	else if (spriteIndex < 8) {
+		loadSprites();
+	}
+	//Buggy overflow check
+	else {
+		checkSpriteOverflow();
+	}
+}
+
+//Sets one bit per OAM byte in mask if it's in range of the scanline when
+//treated as a Y coordinate, so the overflow check's misaligned reads can
+//use it as well
+static void spritesInRange(const uint8_t *oam, int scanline, int height, uint64_t *mask) {
+#if defined(__SSE2__)
+	//0 <= scanline - y < height, unsigned bytes work since scanline < 240
+	__m128i line = _mm_set1_epi8((char)scanline);
+	__m128i maxRange = _mm_set1_epi8((char)(height - 1));
+	for (int i = 0; i < 4; i++) {
+		uint64_t bits = 0;
+		for (int j = 0; j < 4; j++) {
+			__m128i y = _mm_loadu_si128((const __m128i *)(oam + i*64 + j*16));
+			__m128i above = _mm_cmpeq_epi8(_mm_max_epu8(y, line), line);
+			__m128i range = _mm_subs_epu8(line, y);
+			__m128i inRange = _mm_and_si128(above, _mm_cmpeq_epi8(_mm_min_epu8(range, maxRange), range));
+			bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(inRange) << (j*16);
+		}
+		mask[i] = bits;
+	}
+#else
+	for (int i = 0; i < 4; i++) {
+		uint64_t bits = 0;
+		for (int j = 0; j < 64; j++) {
+			int range = scanline - oam[i*64 + j];
+			if (range >= 0 && range < height)
+				bits |= (uint64_t)1 << j;
+		}
+		mask[i] = bits;
+	}
+#endif
+}
+
+//The state machine spends 1 step on a sprite that's out of range and 4 on
+//one that's copied, so the first 8 in range always fit in the 96 steps and
+//the step count tells which dot the overflow check gets to each byte on
+void PPU::evaluateSprites() {
+	memcpy(oamSecondaryStart, oamSecondary, 32);
+	sprite0TrackerStart = sprite0Tracker;
+
+	int height = (ppuControl1 & CONTROL1_SPR_SIZE) ? 16 : 8;
+	uint64_t mask[4];
+	spritesInRange(oam, scanline, height, mask);
+
+	//Pick out the Y coordinates, every 4th byte
+	uint64_t candidates = 0;
+	for (int i = 0; i < 4; i++) {
+		uint64_t bits = mask[i] & 0x1111111111111111ull;
+		bits = (bits | (bits >> 3)) & 0x0303030303030303ull;
+		bits = (bits | (bits >> 6)) & 0x000F000F000F000Full;
+		bits = (bits | (bits >> 12)) & 0x000000FF000000FFull;
+		bits = (bits | (bits >> 24)) & 0x000000000000FFFFull;
+		candidates |= bits << (i*16);
+	}
+
+	int step = 0;
+	int sprite = 0;
+	spriteIndex = 0;
+	while (spriteIndex < 8 && candidates) {
+		int found = __builtin_ctzll(candidates);
+		candidates &= candidates - 1;
+
+		uint8_t *entry = &oamSecondary[spriteIndex*4];
+		uint8_t *source = &oam[found*4];
+		entry[0] = scanline - source[0];
+		entry[1] = source[1];
+		entry[2] = source[2];
+		entry[3] = source[3];
+		if (entry[2] & 0x80)
+			entry[0] = (~entry[0]) & 0x0F;
+
+		//Same sprite 0 hit conditions as loadSprites
+		if (found == 0 && ! (source[3] == 255 || (ppuControl2 & CONTROL2_CLIP_SPR && source[3] < 8)))
+			sprite0Tracker |= 0x02;
+
+		step += (found - sprite) + 4;
+		sprite = found + 1;
+		spriteIndex++;
+	}
+
+	//Follow the overflow check's diagonal walk through OAM, but only if
+	//something it could read is in range at all
+	spriteOverflowDot = 0;
+	if (spriteIndex == 8) {
+		int address = sprite*4;
+		bool any = false;
+		if (address < 256) {
+			any = (mask[address >> 6] >> (address & 63)) != 0;
+			for (int i = (address >> 6) + 1; i < 4; i++)
+				any |= mask[i] != 0;
+		}
+
+		while (any && address < 256 && step < SPRITE_EVAL_STEPS) {
+			if ((mask[address >> 6] >> (address & 63)) & 1) {
+				spriteOverflowDot = SPRITE_EVAL_FIRST_DOT + step*2;
+				break;
+			}
+			address += (address % 4 == 3) ? 1 : 5;
+			step++;
+		}
+	}
+
+	spriteEvalFast = true;
+}
+
+void PPU::replaySpriteEvaluation() {
+	spriteEvalFast = false;
+
+	memcpy(oamSecondary, oamSecondaryStart, 32);
+	sprite0Tracker = sprite0TrackerStart;
+	spriteMemAddress = 0;
+	spriteIndex = 0;
+	readingSprite = 0;
+
+	//Dots already run, the flag gets set again here if it was reached
+	for (int dot = SPRITE_EVAL_FIRST_DOT; dot < cycles && dot <= SPRITE_EVAL_LAST_DOT; dot += 2)
+		spriteEvalStep();
+}
+
 bool PPU::isTransparent(uint8_t pixel) {
 	return (pixel & 0x03) == 0x00;
 }
 
-void PPU::calculatePixel() {
+uint8_t PPU::backgroundPixel() {
 	uint16_t xSelector = 0x01 << fineX;
 
+	return 0x00 | (((attrShift1 & xSelector) != 0) << 3) | (((attrShift0 & xSelector) != 0) << 2) | (((patternShift1 & xSelector) != 0) << 1) | (((patternShift0 & xSelector) != 0) << 0);
+}
+
+void PPU::calculatePixel() {
+	if (spriteLagDots)
+		catchUpSprites();
+
 	//Calculate the background pixel palette value
-	uint8_t bgPixel = 0x00 | (((attrShift1 & xSelector) != 0) << 3) | (((attrShift0 & xSelector) != 0) << 2) | (((patternShift1 & xSelector) != 0) << 1) | (((patternShift0 & xSelector) != 0) << 0);
+	uint8_t bgPixel = backgroundPixel();
 
 	//DEBUG
 	//cout << "Pixel #" << dec << +cycles << endl;
@@ -423,6 +582,10 @@ void PPU::calculatePixel() {
 			}
 			//determine whether to raise sprite0 hit flag
 			if (i == 0 && ((sprite0Tracker & 0x01) == 0x01) && !isTransparent(sprPixel) && !isTransparent(bgPixel)) {
+				if (stats.sprite0HitLine < 0) {
+					stats.sprite0HitLine = scanline;
+					stats.sprite0HitDot = cycles;
+				}
 				ppuStatus |= STATUS_SPR0_HIT;
 			} 
 			spriteShift[2*i+0] >>= 1;
@@ -449,15 +612,251 @@ void PPU::calculatePixel() {
 	}
 }
 
+void PPU::outputPixel() {
+	uint8_t x = cycles - 4;
+
+	//Monochrome mode only keeps the brightness bits of the palette entry
+	uint8_t pixel = pixelBuffer[x];
+	if (ppuControl2 & CONTROL2_COLOR)
+		pixel &= 0x30;
+
+	frame.buffer[x][scanline] = pixel;
+
+	//Emphasis bits sit at the top of PPUMASK, so shifting left once puts
+	//them right above the 6 palette bits in the lookup table index
+	uint16_t index = ((ppuControl2 & 0xE0) << 1) | pixel;
+
+	currentLineHash = (currentLineHash ^ (index | (x << 9))) * LINE_HASH_PRIME;
+	lineOutput = true;
+
+	if (videoOutput) {
+		uint32_t *row = (uint32_t *)((uint8_t *)videoOutput + scanline * videoPitch);
+		row[x] = outputPalette[index];
+	}
+}
+
+void PPU::finishLineHash(int line, uint32_t hash, bool output) {
+	if (!output)
+		return;
+
+	if (hash != lineHash[line]) {
+		lineDirty[line] = true;
+		linesChanged = true;
+	}
+	lineHash[line] = hash;
+}
+
+//Stands in for calculatePixel on skipped and deferred frames
+//Only sprite 0's slot can do anything visible to the CPU, so that one is
+//shifted as it goes and the other slots are left for catchUpSprites
+void PPU::checkSprite0Hit() {
+	spriteLagDots++;
+
+	//Sprite 0 is always the first sprite found, so it sits in slot 0
+	if (spriteXCounter[0] == 0) {
+		if ((sprite0Tracker & 0x01) && !(ppuStatus & STATUS_SPR0_HIT)) {
+			uint16_t xSelector = 0x01 << fineX;
+			bool bgOpaque = (patternShift0 & xSelector) || (patternShift1 & xSelector);
+			bool sprOpaque = (spriteShift[0] & 0x01) || (spriteShift[1] & 0x01);
+			if (bgOpaque && sprOpaque) {
+				if (stats.sprite0HitLine < 0) {
+					stats.sprite0HitLine = scanline;
+					stats.sprite0HitDot = cycles;
+				}
+				ppuStatus |= STATUS_SPR0_HIT;
+			}
+		}
+		spriteShift[0] >>= 1;
+		spriteShift[1] >>= 1;
+	}
+	else {
+		spriteXCounter[0] -= 1;
+	}
+}
+
+//Does what calculatePixel would have done to the other sprite slots over
+//spriteLagDots pixels: count down the x counter, then shift once per pixel
+void PPU::catchUpSprites() {
+	for (int i = 1; i < 8; i++) {
+		if (spriteLagDots <= spriteXCounter[i]) {
+			spriteXCounter[i] -= spriteLagDots;
+		}
+		else {
+			int shift = spriteLagDots - spriteXCounter[i];
+			spriteXCounter[i] = 0;
+			spriteShift[2*i+0] = shift < 8 ? spriteShift[2*i+0] >> shift : 0;
+			spriteShift[2*i+1] = shift < 8 ? spriteShift[2*i+1] >> shift : 0;
+		}
+	}
+	spriteLagDots = 0;
+}
+
+void PPU::logScanline() {
+	ScanlineLog &entry = scanlineLog[scanline];
+
+	if (spriteLagDots)
+		catchUpSprites();
+
+	loggedLine = scanline;
+
+	entry.firstDot = cycles;
+	entry.partial = cycles != 1;
+	entry.control2 = ppuControl2;
+	memcpy(entry.palette, paletteRAM, 32);
+	memcpy(entry.spriteShift, spriteShift, 16);
+	memcpy(entry.spriteAttr, spriteAttr, 8);
+	memcpy(entry.spriteXCounter, spriteXCounter, 8);
+	entry.changeCount = 0;
+
+	entry.background.accessAddress = accessAddress;
+	entry.background.fineX = fineX;
+	entry.background.control1 = ppuControl1;
+	entry.background.patternShift0 = patternShift0;
+	entry.background.patternShift1 = patternShift1;
+	entry.background.patternBuffer0 = patternBuffer0;
+	entry.background.patternBuffer1 = patternBuffer1;
+	entry.background.attrShift0 = attrShift0;
+	entry.background.attrShift1 = attrShift1;
+	entry.background.attrLatch = attrLatch;
+	entry.background.attrLatchBuffer = attrLatchBuffer;
+	entry.background.currentPattern = currentPattern;
+	memcpy(entry.chrPages, chrPages, sizeof(entry.chrPages));
+	memcpy(entry.nametablePages, nametablePages, sizeof(entry.nametablePages));
+
+	//Sprite 0 hit needs the background as it goes, and so does a mapper
+	//watching the fetches
+	bgLagging = cycles <= 256 && !(sprite0Tracker & 0x01) && !fetchNotify;
+	entry.bgLogged = !bgLagging;
+}
+
+void PPU::logChange(uint8_t type, uint8_t address, uint8_t data) {
+	//Anything written outside of a line being drawn gets picked up when
+	//the next one starts
+	if (!deferFrame || scanline != loggedLine || cycles > 259)
+		return;
+
+	ScanlineLog &entry = scanlineLog[scanline];
+
+	//Turning rendering on or off partway through leaves stale pixels
+	if (type == CHANGE_MASK && ((ppuControl2 ^ data) & (CONTROL2_BG_RNDR | CONTROL2_SPR_RNDR)))
+		entry.partial = true;
+
+	if (entry.changeCount < SCANLINE_MAX_CHANGES) {
+		ScanlineChange &change = entry.changes[entry.changeCount++];
+		change.dot = cycles;
+		change.type = type;
+		change.address = address;
+		change.data = data;
+	}
+}
+
+void PPU::catchUpBackground() {
+	bgLagging = false;
+
+	//Nothing's out of date by now, the rasterizer has the whole line
+	if (cycles >= BG_LAG_EXACT)
+		return;
+
+	ScanlineLog &entry = scanlineLog[scanline];
+
+	BackgroundState bg = entry.background;
+	runBackground(entry, dotActions[lineType[scanline]][(entry.control2 >> 3) & 0x03], cycles - 1, bg, entry.bgPixel);
+	entry.bgLogged = true;
+
+	//The address kept moving the whole time
+	patternShift0 = bg.patternShift0;
+	patternShift1 = bg.patternShift1;
+	patternBuffer0 = bg.patternBuffer0;
+	patternBuffer1 = bg.patternBuffer1;
+	attrShift0 = bg.attrShift0;
+	attrShift1 = bg.attrShift1;
+	attrLatch = bg.attrLatch;
+	attrLatchBuffer = bg.attrLatchBuffer;
+	currentPattern = bg.currentPattern;
+}
+
+void PPU::drawLoggedLines() {
+	if (rasterizerBusy) {
+		rasterizer->finish();
+		rasterizerBusy = false;
+	}
+
+	//The current line can still be changed up to its last output dot
+	int lines = scanline;
+	if (scanline < VISIBLE_LINES && cycles > 259)
+		lines++;
+	if (lines > VISIBLE_LINES)
+		lines = VISIBLE_LINES;
+
+	if (lines > rasterizedLines) {
+		rasterizer->start(scanlineLog, rasterizedLines, lines, &frame, videoOutput, videoPitch, outputPalette);
+		rasterizer->finish();
+		rasterizedLines = lines;
+	}
+}
+
+void PPU::pagesChanging() {
+	if (bgLagging)
+		catchUpBackground();
+}
+
 //Increments the cycle and scanline counters
 void PPU::incrementCycle() {
 	cycles++;
 	frameEnd = false;
 	scanlineEnd = false;
 	//Wrap-around cycles to 0 and increment line after 340
-	if (cycles > 340) {
+	//The frame is reported finished a few dots before the wrap, the console
+	//finishes its CPU cycle and stops before the next frame is decided so a
+	//displayNextFrame() in between applies to the frame that comes next
+	if (scanline == 261 && cycles == FRAME_END_DOT) {
+		if (deferFrame) {
+			if (rasterizerBusy) {
+				rasterizer->finish();
+				rasterizerBusy = false;
+			}
+			for (int i = 0; i < VISIBLE_LINES; i++)
+				finishLineHash(i, scanlineLog[i].outputHash, scanlineLog[i].output);
+		}
+
+		if (renderFrame && forceDirty) {
+			for (int i = 0; i < VISIBLE_LINES; i++)
+				lineDirty[i] = true;
+			linesChanged = true;
+			forceDirty = false;
+		}
+		lastFrameChanged = renderFrame && linesChanged;
+
+		frameEnd = true;
+		frameRendered = renderFrame;
+
+		lastFrameStats = stats;
+		resetStats();
+	}
+	else if (cycles > 340 && repeatLine()) {
+		cycles = 0;
+		scanlineEnd = true;
+		bgLagging = false;
+	}
+	else if (cycles > 340) {
+		bgLagging = false;
+
+		if (scanline < VISIBLE_LINES && renderFrame && !deferFrame) {
+			finishLineHash(scanline, currentLineHash, lineOutput);
+			currentLineHash = LINE_HASH_START;
+			lineOutput = false;
+		}
+
 		scanline++;
 		scanlineEnd = true;
+
+		//All of the visible lines are logged, draw the rest during vblank
+		if (scanline == VISIBLE_LINES && deferFrame && rasterizedLines < VISIBLE_LINES) {
+			rasterizer->start(scanlineLog, rasterizedLines, VISIBLE_LINES, &frame, videoOutput, videoPitch, outputPalette);
+			rasterizedLines = VISIBLE_LINES;
+			rasterizerBusy = true;
+		}
+
 		//cout << "Scanline: " << dec << scanline << endl;
 		cycles = 0;
 		//Wrap-around scanlines to 0 and flip frame parity after line 261 
@@ -469,7 +868,45 @@ void PPU::incrementCycle() {
 			}
 			frameParity = ~frameParity;
 			frameNumber++;
-			frameEnd = true;
+
+			//Decide whether the frame that's starting gets drawn
+			if (hideFrame) {
+				renderFrame = false;
+				hideFrame = false;
+			}
+			else if (forceRender || frameskipCounter >= frameskip) {
+				renderFrame = true;
+				frameskipCounter = 0;
+				forceRender = false;
+			}
+			else {
+				renderFrame = false;
+				frameskipCounter++;
+			}
+
+			if (!deferredRendering && rasterizer) {
+				delete rasterizer;
+				rasterizer = NULL;
+				free(scanlineLog);
+				scanlineLog = NULL;
+			}
+
+			if (renderFrame) {
+				for (int i = 0; i < VISIBLE_LINES; i++)
+					lineDirty[i] = false;
+				linesChanged = false;
+			}
+
+			deferFrame = renderFrame && deferredRendering;
+			if (deferFrame) {
+				loggedLine = -1;
+				rasterizedLines = 0;
+				for (int i = 0; i < VISIBLE_LINES; i++) {
+					scanlineLog[i].firstDot = 0;
+					scanlineLog[i].partial = true;
+					scanlineLog[i].changeCount = 0;
+				}
+			}
 		}
 	}
 
@@ -478,6 +915,148 @@ void PPU::incrementCycle() {
 		resetCountdown--;
 }
 
+bool PPU::repeatLine() {
+	int extra = 0;
+	if (scanline == OVERCLOCK_LINE_BEFORE_NMI)
+		extra = extraLinesBeforeNMI;
+	else if (scanline == OVERCLOCK_LINE_AFTER_NMI)
+		extra = extraLinesAfterNMI;
+
+	if (extraLinesRun < extra) {
+		extraLinesRun++;
+		return true;
+	}
+
+	extraLinesRun = 0;
+	return false;
+}
+
+//Fills in the dot scheduler tables
+//Each entry is the set of DOT_* actions for one dot of one kind of scanline
+//with one combination of the BG/sprite rendering bits. Working all of this
+//out once here means cycle() doesn't have to re-derive it every dot
+void PPU::initializeDotTables() {
+	for (int line = 0; line < 262; line++) {
+		if (line < 240)
+			lineType[line] = LINE_VISIBLE;
+		else if (line == 240)
+			lineType[line] = LINE_POSTRENDER;
+		else if (line == 241)
+			lineType[line] = LINE_VBLANK_START;
+		else if (line < 261)
+			lineType[line] = LINE_VBLANK;
+		else
+			lineType[line] = LINE_PRERENDER;
+	}
+
+	for (int type = 0; type < LINE_TYPE_COUNT; type++) {
+		for (int mode = 0; mode < 4; mode++) {
+			//mode is PPUMASK bits 3 and 4 shifted down
+			bool bgEnabled = mode & (CONTROL2_BG_RNDR >> 3);
+			bool renderingOn = mode != 0;
+
+			for (int dot = 0; dot < 341; dot++) {
+				uint32_t actions = 0;
+
+				if (type == LINE_VBLANK_START) {
+					if (dot == 1)
+						actions |= DOT_SET_VBL;
+				}
+				else if (type == LINE_PRERENDER) {
+					//Clear vblank flag, sprite 0 hit, and overflow flags at end of vblank
+					if (dot == 1)
+						actions |= DOT_CLEAR_FLAGS;
+					if (renderingOn) {
+						//reset horizontal offset at end of bg fetches for this scanline
+						if (dot == 257)
+							actions |= DOT_COPY_HORIZ;
+						//reset vertical offset at end of frame
+						else if (dot == 280)
+							actions |= DOT_COPY_VERT;
+					}
+					else if (dot >= 257 && dot <= 320) {
+						actions |= DOT_SPR_RESET;
+					}
+					else if (dot >= 321 && dot <= 336 && bgEnabled) {
+						actions |= bgFetchPhase(dot);
+					}
+				}
+				else if (type == LINE_VISIBLE && renderingOn) {
+					//Memory fetches for BG tiles
+					if (bgEnabled) {
+						if ((dot >= 1 && dot <= 256) || (dot >= 321 && dot <= 336))
+							actions |= bgFetchPhase(dot);
+						//Increment Y at end of bg fetches for this scanline
+						if (dot == 256)
+							actions |= DOT_INC_VERT;
+						//reset horizontal offset at end of bg fetches for this scanline
+						else if (dot == 257)
+							actions |= DOT_COPY_HORIZ;
+					}
+
+					//Memory fetches for sprites
+					//(Sprite evaluation is only disabled when rendering is completely
+					//disabled, if BG rendering is enabled, disabling sprite rendering only
+					//hides the sprites, but they are still evaluated)
+					if (dot >= 257 && dot <= 320) {
+						if (dot % 8 == 6)
+							actions |= DOT_SPR_PT_LOW;
+						else if (dot % 8 == 0)
+							actions |= DOT_SPR_PT_HIGH;
+					}
+
+					//First 64 cycles spent clearing out secondary OAM
+					//then sprite evaluation, both on even cycles
+					if (dot >= 1 && dot <= 64 && dot % 2 == 0)
+						actions |= DOT_OAM_CLEAR;
+					else if (dot >= 65 && dot <= 256 && dot % 2 == 0)
+						actions |= DOT_SPR_EVAL;
+
+					if (dot >= 1 && dot <= 256)
+						actions |= DOT_PIXEL;
+
+					if (dot > 0 && dot < 337) {
+						actions |= DOT_SHIFT;
+						//every 8 cycles load shift registers from buffers
+						if (dot % 8 == 0 && (dot <= 256 || dot >= 321))
+							actions |= DOT_RELOAD;
+					}
+
+					//Write pixels to video output 3 frames after calculation
+					if (dot >= 4 && dot <= 259)
+						actions |= DOT_OUTPUT;
+
+					//The the sprite memory pointer is set to 0 in each tick
+					//during the sprite tile loading process
+					if (dot >= 257 && dot <= 320)
+						actions |= DOT_SPR_RESET;
+
+					if (dot == 340)
+						actions |= DOT_LINE_END;
+				}
+
+				dotActions[type][mode][dot] = actions;
+			}
+		}
+	}
+}
+
+//Returns which of the 4 background fetches happens on the given dot
+uint32_t PPU::bgFetchPhase(int dot) {
+	switch (dot % 8) {
+		case 2:
+			return DOT_BG_NT;
+		case 4:
+			return DOT_BG_AT;
+		case 6:
+			return DOT_BG_PT_LOW;
+		case 0:
+			return DOT_BG_PT_HIGH;
+		default:
+			return 0;
+	}
+}
+
 //This function performs a PPU cycle
 //3 things are happening (more or less) in parallel:
 	//1. Memory fetches
@@ -491,94 +1070,84 @@ void PPU::incrementCycle() {
 //||| ++-------------- nametable select
 //+++----------------- fine Y scroll
 //
-//NOTE: Because the PPU has to operate cycle by cycle, this function rapidly became
-//a rat's nest of if statements determining what state the PPU is in. Hopefully I'll come
-//back to this some time in the future and fix it up to be more readable and maintainable
+//What happens on each dot is looked up in the dot scheduler tables
+//(see initializeDotTables), so all this does is carry out the actions
 void PPU::cycle() {
-	//Code for non-rendering/pre-rendering period
-	if (scanline > 239) {
-		if (scanline == 241 && cycles == 1) {
-			ppuStatus |= STATUS_VBL;
-			if (ppuControl1 & CONTROL1_VBL) {
-				console->raiseNMI();
-			}
-		}
-		else if (scanline == 261) {
-			//Clear vblank flag, sprite 0 hit, and overflow flags at end of vblank
-			if (cycles == 1) {
-				ppuStatus &= ~STATUS_VBL;
-				ppuStatus &= ~STATUS_SPR0_HIT;
-				ppuStatus &= ~STATUS_SPR_OVFLW;
-			}
-			//reset horizontal offset at end of bg fetches for this scanline
-			if (renderingEnabled()) {
-				if (cycles == 257) {
-					//clear out old horizontal data
-					accessAddress &= 0x7BE0;
-					//Mask out the horizontal data from the temp address and use it
-					//to set the access address
-					accessAddress |= temporaryAddress & 0x041F;
-				}
-				//reset vertical offset at end of frame
-				else if (cycles == 280) {
-					//clear out the old vert data
-					accessAddress &= 0x041F;
-					//Masks out the vert data from the temp address and use it
-					//to set the access address
-					accessAddress |= temporaryAddress & 0x7BE0;
-				}
-			}
-			else if (cycles >= 257 && cycles <= 320) {
-				spriteMemAddress = 0;
-			}
-			else if (cycles >= 321 && cycles <= 336) {
-				if (ppuControl2 & CONTROL2_BG_RNDR) {
-					fetchBGTile();
-				}
-			}
-		}
-		incrementCycle();
-		return;
-	}
+	uint32_t actions = dotActions[lineType[scanline]][(ppuControl2 >> 3) & 0x03][cycles];
 
-	//Code for rendering period
-
-	//Do nothing if rendering is disabled
-	if (!renderingEnabled()) {
+	//Nothing to do on most dots outside of rendering
+	if (!actions) {
 		incrementCycle();
 		return;
 	}
 
+	//Flags
+	if (actions & DOT_SET_VBL) {
+		ppuStatus |= STATUS_VBL;
+		if (ppuControl1 & CONTROL1_VBL) {
+			console->raiseNMI();
+		}
+	}
+	if (actions & DOT_CLEAR_FLAGS) {
+		ppuStatus &= ~STATUS_VBL;
+		ppuStatus &= ~STATUS_SPR0_HIT;
+		ppuStatus &= ~STATUS_SPR_OVFLW;
+	}
 
 	//Memory fetch code
 
+	//The rasterizer does the background fetches and shifts itself on lines
+	//that don't need them here, only the address still has to move
+	bool bgSkip = bgLagging && cycles < BG_LAG_SKIP_END;
+
 	//Memory fetches for BG tiles
-	if (ppuControl2 & CONTROL2_BG_RNDR) {
-		if ((cycles >= 1 && cycles <= 256) || (cycles >= 321 && cycles <= 336)) {
-			fetchBGTile();
-		}
-		//Increment Y at end of bg fetches for this scanline
-		if (cycles == 256) {
-			incrementVertical();
-		}
-		//reset horizontal offset at end of bg fetches for this scanline
-		else if (cycles == 257) {
-			//clear out old horizontal data
-			accessAddress &= 0x7BE0;
-			//Mask out the horizontal data from the temp address and use it
-			//to set the access address
-			accessAddress |= temporaryAddress & 0x041F;
-		}
+	if (actions & DOT_BG_NT) {
+		if (!bgSkip)
+			currentPattern = retrieveNameTableByte(accessAddress);
+		stats.nametableFetches++;
+	}
+	else if (actions & DOT_BG_AT) {
+		if (!bgSkip)
+			attrLatchBuffer = retrieveAttrTableBits(accessAddress);
+		stats.attributeFetches++;
+	}
+	else if (actions & DOT_BG_PT_LOW) {
+		stats.patternFetches++;
+		if (!bgSkip)
+			patternBuffer0 = reverseByte(retrievePatternTableByte(ppuControl1 & CONTROL1_BG_PT, currentPattern, 0, accessAddress >> 12));
+	}
+	//Higher pattern table fetch/course X increment
+	else if (actions & DOT_BG_PT_HIGH) {
+		stats.patternFetches++;
+		if (!bgSkip)
+			patternBuffer1 = reverseByte(retrievePatternTableByte(ppuControl1 & CONTROL1_BG_PT, currentPattern, 1, accessAddress >> 12));
+		incrementHorizontal();
+	}
+
+	if (actions & DOT_INC_VERT) {
+		incrementVertical();
+	}
+	if (actions & DOT_COPY_HORIZ) {
+		//clear out old horizontal data
+		accessAddress &= 0x7BE0;
+		//Mask out the horizontal data from the temp address and use it
+		//to set the access address
+		accessAddress |= temporaryAddress & 0x041F;
+	}
+	if (actions & DOT_COPY_VERT) {
+		//clear out the old vert data
+		accessAddress &= 0x041F;
+		//Masks out the vert data from the temp address and use it
+		//to set the access address
+		accessAddress |= temporaryAddress & 0x7BE0;
 	}
 
 	//Memory fetches for sprites
-	//(Sprite evaluation is only disabled when rendering is completely
-	//disabled, if BG rendering is enabled, disabling sprite rendering only
-	//hides the sprites, but they are still evaluated)
-	if ((ppuControl2 & CONTROL2_SPR_RNDR) || (ppuControl2 & CONTROL2_BG_RNDR)) {
-		if ((cycles >= 257 && cycles <= 320)) {
-			fetchSpriteData();
-		}
+	if (actions & DOT_SPR_PT_LOW) {
+		fetchSpritePattern(0);
+	}
+	else if (actions & DOT_SPR_PT_HIGH) {
+		fetchSpritePattern(1);
 	}
 
 	//END Memory fetch code
@@ -586,10 +1155,8 @@ void PPU::cycle() {
 	//Sprite evaluation
 
 	//First 64 cycles spent clearing out secondary OAM
-	if (cycles >= 1 && cycles <= 64) {
-		if (cycles % 2 == 0) {
-			oamSecondary[cycles/2 - 1] = 0xFF;
-		}
+	if (actions & DOT_OAM_CLEAR) {
+		oamSecondary[cycles/2 - 1] = 0xFF;
 	}
 	//Cycles 65-256: sprite evaluation
 	//NOTE: technically reads are supposed to happen on odd cycles and
@@ -598,22 +1165,17 @@ void PPU::cycle() {
 	//cause any problems, you'd have to be real fiddly about timing to make use
 	//of this behavior. However, if there are problems with sprite evaluation
 	//this is something to check
-	else if (cycles >= 65 && cycles <= 256) {
-		if (cycles % 2 == 0) {
-			//I can't tell if I hate this or not, maybe it's just because it's so late at night
-			//It's just a check that says if we've run through all of the OAM (becuase OAM is
-			//256 bytes) then we're done evaluating sprites for this scanline so do nothing
-			if (spriteMemAddress >= 256) {
-				//Do nothing
-			}
-			//This is the part that evaluates sprites to be added to the secondary OAM
-			else if (spriteIndex < 8) {
-				loadSprites();
-			}
-			//Buggy overflow check
-			else {
-				checkSpriteOverflow();
-			}
+	else if (actions & DOT_SPR_EVAL) {
+		//The whole line is evaluated in one go when it starts from scratch
+		if (cycles == SPRITE_EVAL_FIRST_DOT && spriteMemAddress == 0 && spriteIndex == 0 && readingSprite == 0)
+			evaluateSprites();
+
+		if (spriteEvalFast) {
+			if (cycles == spriteOverflowDot)
+				setSpriteOverflow();
+		}
+		else {
+			spriteEvalStep();
 		}
 	}
 
@@ -622,24 +1184,37 @@ void PPU::cycle() {
 	//Pixel rendering code
 
 	//Calculate pixels and place in buffer
-	if (cycles >= 1 && cycles <= 256) {
-		calculatePixel();
+	//On skipped frames only sprite 0 hit detection is kept
+	//Deferred frames leave the drawing to the rasterizer, logging the
+	//background pixel for it on lines it doesn't fetch for itself
+	if (actions & DOT_PIXEL) {
+		if (!renderFrame) {
+			checkSprite0Hit();
+		}
+		else if (deferFrame) {
+			if (scanline != loggedLine)
+				logScanline();
+			if (!bgLagging)
+				scanlineLog[scanline].bgPixel[cycles-1] = backgroundPixel();
+			checkSprite0Hit();
+		}
+		else {
+			calculatePixel();
+		}
 	}
 
-	if (cycles > 0 && cycles < 337) {
+	if ((actions & DOT_SHIFT) && !bgSkip) {
 		//Shift registers
 		patternShift0 >>= 1;
 		patternShift1 >>= 1;
 
 		//every 8 cycles load shift registers from buffers
-		if ((cycles >= 1 && cycles <= 256) || (cycles >=321 && cycles <= 336)) {
-			if (cycles % 8 == 0) {
-				patternShift0 |= patternBuffer0 << 8;
-				patternShift1 |= patternBuffer1 << 8;
-				attrLatch = attrLatchBuffer;
-			}
-		}		
-		
+		if (actions & DOT_RELOAD) {
+			patternShift0 |= patternBuffer0 << 8;
+			patternShift1 |= patternBuffer1 << 8;
+			attrLatch = attrLatchBuffer;
+		}
+
 		attrShift0 >>= 1;
 		attrShift0 |= (attrLatch & 0x01) << 7;
 		attrShift1 >>= 1;
@@ -647,25 +1222,28 @@ void PPU::cycle() {
 	}
 
 	//Write pixels to video output 3 frames after calculation
-	if (cycles >= 4 && cycles <= 259) {
-		frame.buffer[cycles-4][scanline] = pixelBuffer[cycles-4];
+	if ((actions & DOT_OUTPUT) && renderFrame) {
+		if (!deferFrame)
+			outputPixel();
+		else if (scanline != loggedLine)
+			logScanline();
 	}
 
 	//END Rendering code
 
 	//End of cycle cleanup
 
-	//The the sprite memory pointer is set to 0 in each tick
-	//during the sprite tile loading process
-	if (cycles >= 257 && cycles <= 320) {
+	if (actions & DOT_SPR_RESET) {
 		spriteMemAddress = 0;
+		spriteEvalFast = false;
 	}
 
 	//Clean up the rest of the sprite global variables at end of scanline
-	if (cycles == 340) {
+	if (actions & DOT_LINE_END) {
 		spriteIndex = 0;
 		sprite0Tracker >>= 1;
 		readingSprite = 0;
+		spriteEvalFast = false;
 	}
 
 	incrementCycle();
@@ -697,11 +1275,25 @@ bool PPU::isPaletteMemory(uint16_t address) {
 PPU::PPU(Console *con) {
 	console = con;
 
+	mapper = con->getMapper();
+	chrPages = mapper->getChrPages();
+	nametablePages = mapper->getNametablePages();
+	fetchNotify = mapper->notifiesFetches();
+
+	for (int i = 0; i < 4; i++)
+		rebuildAttrCache(i);
+
 	paletteRAM = (uint8_t *)malloc(32);
 
 	oam = (uint8_t *) malloc(256);
 
 	oamSecondary = (uint8_t *) malloc(64);
+	memset(oamSecondary, 0xFF, 64);
+
+	//Lines that aren't drawn until rendering is enabled would otherwise show
+	//whatever was in memory, which also makes recorded frames unrepeatable
+	memset(&frame, 0, sizeof(frame));
+	memset(pixelBuffer, 0, sizeof(pixelBuffer));
 
 	ppuControl1 = 0x00;
 	ppuControl2 = 0x00;
@@ -716,6 +1308,9 @@ PPU::PPU(Console *con) {
 	fineX = 0;
 	writeToggle = 0;
 	spriteIndex = 0;
+	readingSprite = 0;
+	spriteEvalFast = false;
+	spriteOverflowDot = 0;
 	spriteMemAddress = 0x00;
 	patternShift0 = 0x0000;
 	patternShift1 = 0x0000;
@@ -727,10 +1322,50 @@ PPU::PPU(Console *con) {
 	attrLatchBuffer = 0x00;
 	currentPattern = 0x00;
 	sprite0Tracker = 0;
+	spriteLagDots = 0;
 	resetCountdown = RESET_COUNTDOWN_START;
 
 	frameNumber = 1;
 
+	resetStats();
+	lastFrameStats = stats;
+
+	initializeDotTables();
+
+	extraLinesBeforeNMI = 0;
+	extraLinesAfterNMI = 0;
+	extraLinesRun = 0;
+
+	frameskip = 0;
+	frameskipCounter = 0;
+	renderFrame = true;
+	frameRendered = true;
+	forceRender = false;
+	hideFrame = false;
+
+	rasterizer = NULL;
+	scanlineLog = NULL;
+	deferredRendering = false;
+	deferFrame = false;
+	loggedLine = -1;
+	rasterizedLines = 0;
+	rasterizerBusy = false;
+	bgLagging = false;
+
+	videoOutput = NULL;
+	videoPitch = 0;
+	buildOutputPalette(outputPalette, PIXEL_FORMAT_RGBA);
+
+	for (int i = 0; i < VISIBLE_LINES; i++) {
+		lineHash[i] = LINE_HASH_START;
+		lineDirty[i] = true;
+	}
+	currentLineHash = LINE_HASH_START;
+	lineOutput = false;
+	linesChanged = true;
+	lastFrameChanged = true;
+	forceDirty = true;
+
 	for (int i = 0; i < 16; i++)
 		spriteShift[i] = 0x00;
 	for (int i = 0; i < 8; i++) {
@@ -740,7 +1375,11 @@ PPU::PPU(Console *con) {
 }
 
 PPU::~PPU() {
-	delete paletteRAM;
+	delete rasterizer;
+	free(scanlineLog);
+	free(paletteRAM);
+	free(oam);
+	free(oamSecondary);
 }
 
 //TODO: NMI code for PPUCTRL write
@@ -756,9 +1395,35 @@ void PPU::writeRegister(uint8_t regAddr, uint8_t data) {
 	//Writing data to any PPU register fills the latch with the data written
 	registerLatch = data;
 
+	stats.registerWrites[regAddr & 0x07]++;
+	if (isRendering()) {
+		bool midLine = scanline < VISIBLE_LINES && cycles >= 1 && cycles <= 256;
+		if (regAddr == PPUDATA) {
+			stats.dataWritesRendering++;
+		}
+		else if (regAddr == PPUSCROLL || regAddr == PPUADDR) {
+			stats.scrollWritesRendering++;
+			if (midLine)
+				stats.midLineScrollWrites++;
+		}
+		else if (regAddr == PPUCTRL) {
+			stats.controlWritesRendering++;
+			if (midLine)
+				stats.midLineControlWrites++;
+		}
+	}
+
 	if (regAddr == PPUCTRL) {
 		//writes to PPUCTRL ignored for a period after powerup/reset
 		if (resetCountdown == 0) {
+			//Sprite size changes what the rest of the evaluation finds
+			if (spriteEvalFast && ((ppuControl1 ^ data) & CONTROL1_SPR_SIZE))
+				replaySpriteEvaluation();
+
+			//Switches the background pattern table
+			if (bgLagging && ((ppuControl1 ^ data) & CONTROL1_BG_PT))
+				catchUpBackground();
+
 			ppuControl1 = data;
 
 			//clear out old nametable data;
@@ -775,6 +1440,15 @@ void PPU::writeRegister(uint8_t regAddr, uint8_t data) {
 	else if (regAddr == PPUMASK) {
 		//writes to PPUMASK ignored for a period after powerup/reset
 		if (resetCountdown == 0) {
+			//Turning rendering off stops the evaluation partway through
+			if (spriteEvalFast && ((ppuControl2 ^ data) & (CONTROL2_BG_RNDR | CONTROL2_SPR_RNDR)))
+				replaySpriteEvaluation();
+
+			//So does fetching and shifting
+			if (bgLagging && ((ppuControl2 ^ data) & (CONTROL2_BG_RNDR | CONTROL2_SPR_RNDR)))
+				catchUpBackground();
+
+			logChange(CHANGE_MASK, 0, data);
 			ppuControl2 = data;
 		}
 	}
@@ -803,6 +1477,8 @@ void PPU::writeRegister(uint8_t regAddr, uint8_t data) {
 				temporaryAddress &= 0x001F;
 				temporaryAddress |= (0xF8 & data) >> 3;
 				//new fine x assignment
+				if (bgLagging)
+					catchUpBackground();
 				fineX = data & 0x07;
 				//Toggle w
 				writeToggle= 1;
@@ -841,6 +1517,8 @@ void PPU::writeRegister(uint8_t regAddr, uint8_t data) {
 				//toggle w
 				writeToggle = 0;
 				//set accessaddress
+				if (bgLagging)
+					catchUpBackground();
 				accessAddress = temporaryAddress;
 			}
 		}
@@ -860,6 +1538,8 @@ void PPU::writeRegister(uint8_t regAddr, uint8_t data) {
 		else { //access during rendering
 			//write ignored
 			//pathologically increment by performing a coarse x increment and a y increment
+			if (bgLagging)
+				catchUpBackground();
 			incrementHorizontal();
 			incrementVertical();
 		}
@@ -877,6 +1557,9 @@ uint8_t PPU::readRegister(uint8_t regAddr) {
 		registerLatch |= ppuStatus & 0xE0;
 	}
 	else if (regAddr == OAMDATA) {
+		//Shows where the evaluation has got to
+		if (spriteEvalFast)
+			replaySpriteEvaluation();
 		registerLatch = oam[spriteMemAddress & 0xFF];
 	}
 	else if (regAddr == PPUDATA) {
@@ -888,6 +1571,8 @@ uint8_t PPU::readRegister(uint8_t regAddr) {
 				incrementVAddress();
 			else {
 				//pathological increment during rendering
+				if (bgLagging)
+					catchUpBackground();
 				incrementHorizontal();
 				incrementVertical();
 			}
@@ -911,6 +1596,8 @@ uint8_t PPU::debugReadRegister(uint8_t regAddr) {
 		ret = (ppuStatus & 0xE0) | (registerLatch & 0x1F);
 	}
 	else if (regAddr == OAMDATA) {
+		if (spriteEvalFast)
+			replaySpriteEvaluation();
 		ret = oam[spriteMemAddress & 0xFF];
 	}
 	else if (regAddr == PPUDATA) {
@@ -930,6 +1617,284 @@ uint8_t PPU::debugPaletteRead(uint16_t address) {
 	return paletteRAM[address & 0x1F];
 }
 
+void PPU::debugPaletteWrite(uint16_t address, uint8_t data) {
+	paletteRAM[address & 0x1F] = data;
+}
+
+uint8_t PPU::debugOAMRead(uint8_t address) {
+	return oam[address];
+}
+
+void PPU::debugOAMWrite(uint8_t address, uint8_t data) {
+	//Unlike OAMDATA this works during rendering
+	if (spriteEvalFast)
+		replaySpriteEvaluation();
+	oam[address] = data;
+}
+
+void PPU::setVideoOutput(uint32_t *buffer, int pitch, uint8_t format) {
+	videoOutput = buffer;
+	videoPitch = pitch;
+	buildOutputPalette(outputPalette, format);
+
+	//Whatever is in the new buffer has nothing to do with the last frame
+	forceDirty = true;
+}
+
+void PPU::setFrameskip(uint8_t ratio) {
+	frameskip = ratio;
+	frameskipCounter = 0;
+}
+
+bool PPU::runDots(int dots) {
+	bool ended = false;
+	for (int i = 0; i < dots; i++) {
+		cycle();
+		if (frameEnd)
+			ended = true;
+	}
+	return ended;
+}
+
+int PPU::dotsUntilEvent() {
+	int position = scanline * 341 + cycles;
+	//Dots that set vblank and report the end of the frame, then the last dots
+	//of the lines the extra ones repeat. Positions don't count extra lines so
+	//distances past them come out short, which is safe
+	int events[4] = { 241 * 341 + 1, 261 * 341 + FRAME_END_DOT - 1,
+		OVERCLOCK_LINE_BEFORE_NMI * 341 + 340, OVERCLOCK_LINE_AFTER_NMI * 341 + 340 };
+	int eventCount = (extraLinesBeforeNMI || extraLinesAfterNMI) ? 4 : 2;
+
+	int until = 262 * 341;
+	for (int i = 0; i < eventCount; i++) {
+		int distance = events[i] - position;
+		//Wrapping around might skip a dot on odd frames, so assume it does
+		if (distance < 0)
+			distance += 262 * 341 - 1;
+		if (distance < until)
+			until = distance;
+	}
+
+	//The event dot itself has to be run too
+	return until + 1;
+}
+
+void PPU::setDeferredRendering(bool enabled, int threads) {
+	deferredRendering = enabled;
+
+	if (enabled && !rasterizer) {
+		rasterizer = new Rasterizer(threads, dotActions[LINE_VISIBLE]);
+		scanlineLog = (ScanlineLog *) malloc(VISIBLE_LINES * sizeof(ScanlineLog));
+	}
+}
+
+void PPU::setOverclock(int beforeNMI, int afterNMI) {
+	extraLinesBeforeNMI = beforeNMI;
+	extraLinesAfterNMI = afterNMI;
+}
+
+bool PPU::onExtraLine() {
+	return extraLinesRun != 0;
+}
+
+void PPU::resetStats() {
+	memset(&stats, 0, sizeof(stats));
+	stats.sprite0HitLine = -1;
+	stats.sprite0HitDot = -1;
+	overflowStatsLine = -1;
+}
+
+void PPU::oamDMAStarted() {
+	stats.oamDMAs++;
+}
+
+PPUStats PPU::getFrameStats() {
+	return lastFrameStats;
+}
+
+void PPU::displayNextFrame() {
+	forceRender = true;
+}
+
+void PPU::hideNextFrame() {
+	hideFrame = true;
+}
+
+//Registers, latches, shift registers, timing and the tables that live
+//outside the object. Output (the frame, dirty tracking, frameskip, which
+//frames get drawn or deferred), settings and pointers aren't in it, and
+//neither is the attribute cache, that's rebuilt from VRAM by vramLoaded
+struct PPUState {
+	uint8_t ppuControl1;
+	uint8_t ppuControl2;
+	uint8_t ppuStatus;
+	uint8_t readBuffer;
+	uint8_t registerLatch;
+	int16_t scanline;
+	int16_t cycles;
+	bool frameParity;
+	uint16_t accessAddress;
+	uint16_t temporaryAddress;
+	uint8_t fineX;
+	bool writeToggle;
+	uint8_t spriteIndex;
+	uint16_t spriteMemAddress;
+	uint16_t patternShift0;
+	uint16_t patternShift1;
+	uint8_t patternBuffer0;
+	uint8_t patternBuffer1;
+	uint8_t attrShift0;
+	uint8_t attrShift1;
+	uint8_t attrLatch;
+	uint8_t attrLatchBuffer;
+	uint8_t currentPattern;
+	uint8_t spriteShift[16];
+	uint8_t spriteAttr[8];
+	uint8_t spriteXCounter[8];
+	uint8_t sprite0Tracker;
+	uint16_t spriteLagDots;
+	uint8_t readingSprite;
+	bool spriteEvalFast;
+	uint16_t spriteOverflowDot;
+	uint8_t oamSecondaryStart[32];
+	uint8_t sprite0TrackerStart;
+	uint16_t resetCountdown;
+	bool frameEnd;
+	bool scanlineEnd;
+	int extraLinesRun;
+	uint64_t frameNumber;
+	PPUStats stats;
+	PPUStats lastFrameStats;
+	int16_t overflowStatsLine;
+	uint8_t oam[256];
+	uint8_t oamSecondary[32];
+	uint8_t paletteRAM[32];
+};
+
+size_t PPU::stateSize() {
+	return sizeof(PPUState);
+}
+
+void PPU::saveState(uint8_t *state) {
+	if (bgLagging)
+		catchUpBackground();
+
+	PPUState saved;
+	saved.ppuControl1 = ppuControl1;
+	saved.ppuControl2 = ppuControl2;
+	saved.ppuStatus = ppuStatus;
+	saved.readBuffer = readBuffer;
+	saved.registerLatch = registerLatch;
+	saved.scanline = scanline;
+	saved.cycles = cycles;
+	saved.frameParity = frameParity;
+	saved.accessAddress = accessAddress;
+	saved.temporaryAddress = temporaryAddress;
+	saved.fineX = fineX;
+	saved.writeToggle = writeToggle;
+	saved.spriteIndex = spriteIndex;
+	saved.spriteMemAddress = spriteMemAddress;
+	saved.patternShift0 = patternShift0;
+	saved.patternShift1 = patternShift1;
+	saved.patternBuffer0 = patternBuffer0;
+	saved.patternBuffer1 = patternBuffer1;
+	saved.attrShift0 = attrShift0;
+	saved.attrShift1 = attrShift1;
+	saved.attrLatch = attrLatch;
+	saved.attrLatchBuffer = attrLatchBuffer;
+	saved.currentPattern = currentPattern;
+	memcpy(saved.spriteShift, spriteShift, sizeof(spriteShift));
+	memcpy(saved.spriteAttr, spriteAttr, sizeof(spriteAttr));
+	memcpy(saved.spriteXCounter, spriteXCounter, sizeof(spriteXCounter));
+	saved.sprite0Tracker = sprite0Tracker;
+	saved.spriteLagDots = spriteLagDots;
+	saved.readingSprite = readingSprite;
+	saved.spriteEvalFast = spriteEvalFast;
+	saved.spriteOverflowDot = spriteOverflowDot;
+	memcpy(saved.oamSecondaryStart, oamSecondaryStart, sizeof(oamSecondaryStart));
+	saved.sprite0TrackerStart = sprite0TrackerStart;
+	saved.resetCountdown = resetCountdown;
+	saved.frameEnd = frameEnd;
+	saved.scanlineEnd = scanlineEnd;
+	saved.extraLinesRun = extraLinesRun;
+	saved.frameNumber = frameNumber;
+	saved.stats = stats;
+	saved.lastFrameStats = lastFrameStats;
+	saved.overflowStatsLine = overflowStatsLine;
+	memcpy(saved.oam, oam, 256);
+	memcpy(saved.oamSecondary, oamSecondary, 32);
+	memcpy(saved.paletteRAM, paletteRAM, 32);
+	memcpy(state, &saved, sizeof(saved));
+}
+
+void PPU::loadState(const uint8_t *state) {
+	PPUState saved;
+	memcpy(&saved, state, sizeof(saved));
+	ppuControl1 = saved.ppuControl1;
+	ppuControl2 = saved.ppuControl2;
+	ppuStatus = saved.ppuStatus;
+	readBuffer = saved.readBuffer;
+	registerLatch = saved.registerLatch;
+	scanline = saved.scanline;
+	cycles = saved.cycles;
+	frameParity = saved.frameParity;
+	accessAddress = saved.accessAddress;
+	temporaryAddress = saved.temporaryAddress;
+	fineX = saved.fineX;
+	writeToggle = saved.writeToggle;
+	spriteIndex = saved.spriteIndex;
+	spriteMemAddress = saved.spriteMemAddress;
+	patternShift0 = saved.patternShift0;
+	patternShift1 = saved.patternShift1;
+	patternBuffer0 = saved.patternBuffer0;
+	patternBuffer1 = saved.patternBuffer1;
+	attrShift0 = saved.attrShift0;
+	attrShift1 = saved.attrShift1;
+	attrLatch = saved.attrLatch;
+	attrLatchBuffer = saved.attrLatchBuffer;
+	currentPattern = saved.currentPattern;
+	memcpy(spriteShift, saved.spriteShift, sizeof(spriteShift));
+	memcpy(spriteAttr, saved.spriteAttr, sizeof(spriteAttr));
+	memcpy(spriteXCounter, saved.spriteXCounter, sizeof(spriteXCounter));
+	sprite0Tracker = saved.sprite0Tracker;
+	spriteLagDots = saved.spriteLagDots;
+	readingSprite = saved.readingSprite;
+	spriteEvalFast = saved.spriteEvalFast;
+	spriteOverflowDot = saved.spriteOverflowDot;
+	memcpy(oamSecondaryStart, saved.oamSecondaryStart, sizeof(oamSecondaryStart));
+	sprite0TrackerStart = saved.sprite0TrackerStart;
+	resetCountdown = saved.resetCountdown;
+	frameEnd = saved.frameEnd;
+	scanlineEnd = saved.scanlineEnd;
+	extraLinesRun = saved.extraLinesRun;
+	frameNumber = saved.frameNumber;
+	stats = saved.stats;
+	lastFrameStats = saved.lastFrameStats;
+	overflowStatsLine = saved.overflowStatsLine;
+	memcpy(oam, saved.oam, 256);
+	memcpy(oamSecondary, saved.oamSecondary, 32);
+	memcpy(paletteRAM, saved.paletteRAM, 32);
+
+	bgLagging = false;
+}
+
+void PPU::vramLoaded() {
+	for (int i = 0; i < 4; i++)
+		rebuildAttrCache(i);
+}
+
+bool PPU::frameDisplayed() {
+	return frameRendered;
+}
+
+bool PPU::frameChanged() {
+	return lastFrameChanged;
+}
+
+bool PPU::lineChanged(int line) {
+	return lastFrameChanged && lineDirty[line];
+}
+
 bool PPU::endOfFrame() {
 	return frameEnd;
 }
@@ -18,6 +18,7 @@
 #define PPU_H
 
 #include <cstdint>
+#include <cstddef>
 
 #define CONTROL1_NT_X		0x01 //X Scroll name table selection
 #define CONTROL1_NT_Y		0x02 //Y scroll name table selection
@@ -37,10 +38,10 @@
 #define CONTROL2_COLOR		0x01 //Controls whether system is in color or monochome mode
 									//0 - color
 									//1 - monochrome
-#define CONTROL2_CLIP_LEFT	0x02 //Controls whether the left 8 pixels are clipped
+#define CONTROL2_CLIP_BG	0x02 //Controls whether the background is shown in the left 8 pixels
 									//0 - clipped
 									//1 - shown
-#define CONTROL2_CLIP_RGHT	0x04 //Controls whether the right 8 pixels are clipped (same as CLIP_LEFT)
+#define CONTROL2_CLIP_SPR	0x04 //Controls whether sprites are shown in the left 8 pixels (same as CLIP_BG)
 #define CONTROL2_BG_RNDR	0x08 //Controls whether the background is rendered
 									//0 - background rendering off
 									//1 - background rnedering on
@@ -70,10 +71,130 @@
 #define PPUADDR		6
 #define PPUDATA		7
 
+//Dot on the pre-render line where the frame is reported finished, far enough
+//before the wrap that the console stops inside the same frame
+#define FRAME_END_DOT	336
+
+//Lines repeated by setOverclock, neither does anything on any dot
+#define OVERCLOCK_LINE_BEFORE_NMI	240
+#define OVERCLOCK_LINE_AFTER_NMI	260
+
+//Sprite evaluation runs on every other dot from 66 to 256
+#define SPRITE_EVAL_FIRST_DOT	66
+#define SPRITE_EVAL_LAST_DOT	256
+#define SPRITE_EVAL_STEPS		96
+
+//Deferred lines the rasterizer fetches the background for skip the PPU's
+//own fetches and shifts before BG_LAG_SKIP_END. The last tile's are still
+//done so the fetch and shift registers are back to what they should be by
+//BG_LAG_EXACT without having to go back over the line
+#define BG_LAG_SKIP_END		249
+#define BG_LAG_EXACT		265
+
+//FNV-1a, used for the per-line output hashes
+#define LINE_HASH_START		2166136261u
+#define LINE_HASH_PRIME		16777619u
+
+//Scanline types for the dot scheduler
+#define LINE_VISIBLE		0 //0-239
+#define LINE_POSTRENDER		1 //240
+#define LINE_VBLANK_START	2 //241
+#define LINE_VBLANK			3 //242-260
+#define LINE_PRERENDER		4 //261
+#define LINE_TYPE_COUNT		5
+
+//Actions the dot scheduler can perform on a single dot
+#define DOT_BG_NT			0x00000001 //Background nametable fetch
+#define DOT_BG_AT			0x00000002 //Background attribute fetch
+#define DOT_BG_PT_LOW		0x00000004 //Background low pattern table fetch
+#define DOT_BG_PT_HIGH		0x00000008 //Background high pattern table fetch and coarse X increment
+#define DOT_INC_VERT		0x00000010 //Y increment
+#define DOT_COPY_HORIZ		0x00000020 //Copy horizontal bits from temporaryAddress to accessAddress
+#define DOT_COPY_VERT		0x00000040 //Copy vertical bits from temporaryAddress to accessAddress
+#define DOT_SPR_PT_LOW		0x00000080 //Sprite low pattern table fetch
+#define DOT_SPR_PT_HIGH		0x00000100 //Sprite high pattern table fetch, attribute and x position load
+#define DOT_OAM_CLEAR		0x00000200 //Clear one byte of secondary OAM
+#define DOT_SPR_EVAL		0x00000400 //Sprite evaluation step
+#define DOT_PIXEL			0x00000800 //Calculate a pixel
+#define DOT_SHIFT			0x00001000 //Shift the background shift registers
+#define DOT_RELOAD			0x00002000 //Reload the background shift registers from the fetch buffers
+#define DOT_OUTPUT			0x00004000 //Write a pixel to the frame
+#define DOT_SPR_RESET		0x00008000 //Reset the sprite memory address
+#define DOT_LINE_END		0x00010000 //End of scanline sprite cleanup
+#define DOT_SET_VBL			0x00020000 //Set vblank flag and raise NMI
+#define DOT_CLEAR_FLAGS		0x00040000 //Clear vblank, sprite 0 hit and overflow flags
+
+//Forward declaration of Console class
+class Console;
+class Mapper;
+class Rasterizer;
+struct ScanlineLog;
+
+typedef struct Frame Frame;
+
+struct Frame {
+	uint8_t buffer[256][240];
+};
+
+//What the PPU got up to over one frame, see getFrameStats
+//"While rendering" means rendering was enabled on a visible or the pre-render
+//line, same as when the PPU ignores OAM and PPUDATA accesses
+struct PPUStats {
+	//CPU writes to each register, indexed by PPUCTRL-PPUDATA
+	uint32_t registerWrites[8];
+
+	//PPUDATA writes while rendering, these get dropped and scramble the address
+	uint32_t dataWritesRendering;
+
+	//PPUSCROLL/PPUADDR and PPUCTRL writes while rendering, and the ones among
+	//them that landed on dots 1-256 of a visible line where they split the line
+	uint32_t scrollWritesRendering;
+	uint32_t controlWritesRendering;
+	uint32_t midLineScrollWrites;
+	uint32_t midLineControlWrites;
+
+	//Lines the sprite overflow flag was set on (normally only the first one,
+	//the flag isn't cleared until the pre-render line)
+	uint32_t overflowLines;
+
+	//Line and dot sprite 0 hit was first set on, -1 if it wasn't
+	int16_t sprite0HitLine;
+	int16_t sprite0HitDot;
+
+	//OAM DMAs started
+	uint32_t oamDMAs;
+
+	//PPUDATA writes to palette RAM
+	uint32_t paletteWrites;
+
+	//Rendering fetches, pattern fetches include the sprite ones
+	uint32_t nametableFetches;
+	uint32_t attributeFetches;
+	uint32_t patternFetches;
+};
+
 class PPU {
 private:
 	Console *console;
 
+	//The mapper's CHR and nametable pages, rendering fetches read straight
+	//out of these instead of going through the console
+	Mapper *mapper;
+	uint8_t **chrPages;
+	uint8_t **nametablePages;
+
+	//Whether the mapper wants to see every rendering fetch
+	bool fetchNotify;
+
+	//Attribute table expanded out to one 2-bit palette select per tile for
+	//each of the four nametables, indexed by coarse Y then coarse X straight
+	//from the access address. Rows 30 and 31 are off the bottom of the
+	//nametable but still get attribute fetches if the game scrolls into
+	//them, they use the last attribute row same as the real thing.
+	//attrCachePages is the nametable page each one was built from
+	uint8_t attrCache[4][32][32];
+	uint8_t *attrCachePages[4];
+
 	//Registers used by the CPU to program the PPU
 	//see definitions at top for information on what each bit does
 	uint8_t ppuControl1;
@@ -87,8 +208,8 @@ private:
 	//See readRegister and writeRegister definitions
 	uint8_t registerLatch;
 
-	//pointer to memory region containing VRAM (16k)
-	uint8_t *vram;
+	//pointer to memory region containing palette RAM 32 bytes
+	uint8_t *paletteRAM;
 
 	//256 byte object attribute memory
 	//holds 64, 4-byte sprite attribute data
@@ -149,7 +270,7 @@ private:
 
 	//Used to hold location of top left corner of screen during rendering
 	//This lets the rendering loop know where to reset x/y in accessAddress
-	//to at the end of each sca reduced phone-crashing power spikes, until…nline/frame
+	//to at the end of each scanline/frame
 	uint16_t temporaryAddress;
 
 	//3-bit register used to determine fine x scroll within tile
@@ -186,7 +307,7 @@ private:
 	//Holds attribute information, shifted right every cycle
 	//See rendering code for more in-depth explanation
 	uint8_t attrShift0;
-	uint8_t attrShift1;	
+	uint8_t attrShift1;
 
 	//Holds attribute data to be shifted into the attribute shift registers
 	//reloaded every 8 cycles
@@ -200,7 +321,7 @@ private:
 	uint8_t currentPattern;
 
 	//Used for sprite part of rendering pipeline
-	//Loaded during 
+	//Loaded during
 	uint8_t spriteShift[16];
 	uint8_t spriteAttr[8];
 	uint8_t	spriteXCounter[8];
@@ -214,45 +335,173 @@ private:
 	//With this setup, when sprite evaluation finds sprite 0 in range, it can set bit 2,
 	//when the hit conditions are met, the renderer can check bit 1, and at the end of
 	//the scanline, this can be shifted right so that 'next line' becomes 'current line'
-	uint8_t sprite0Tracker; 
+	uint8_t sprite0Tracker;
+
+	//Pixels drawn by checkSprite0Hit where sprite slots 1-7 weren't shifted
+	//They're caught up by catchUpSprites before anything looks at them
+	uint16_t spriteLagDots;
 
 	//Used to keep track of sprite evaluation state
 	// 0 	- checking ranges
 	// 1-3 	- found in-range sprite, copy data then decrement
 	uint8_t readingSprite;
 
+	//Set while the current line's sprites were all evaluated at once on the
+	//first evaluation dot (see evaluateSprites) instead of one step per dot.
+	//Until dot 257 anything that could see or change the state machine
+	//partway through has to call replaySpriteEvaluation first
+	bool spriteEvalFast;
+
+	//Dot the state machine would have set the sprite overflow flag on, 0 if
+	//it wouldn't have
+	uint16_t spriteOverflowDot;
+
+	//Secondary OAM and sprite0Tracker from before the fast evaluation, so
+	//the state machine can be run from the start if it's needed
+	uint8_t oamSecondaryStart[32];
+	uint8_t sprite0TrackerStart;
+
 	//Buffer used to store rendering results during the 3 cycles between calculation and output
 	uint8_t pixelBuffer[256];
 
 	//Buffer used to store the pallette data for the frame
-	uint8_t frameBuffer[256][240];
+	Frame frame;
+
+	//Video output stage (see setVideoOutput)
+	//When videoOutput is not NULL, every pixel written to the frame is also
+	//written to this buffer as a final 32-bit colour. videoPitch is the
+	//distance in bytes between the start of two rows
+	uint32_t *videoOutput;
+	int videoPitch;
+
+	//Colour lookup table for the video output stage, indexed by
+	//	EEEPPPPPP
+	//	|||++++++-- P: palette index (masked with $30 in monochrome mode)
+	//	+++-------- E: emphasis bits from PPUMASK (CONTROL2_TINT_R/G/B)
+	uint32_t outputPalette[512];
+
+	//Frameskip (see setFrameskip)
+	//On skipped frames the PPU keeps all of its timing and memory accesses
+	//but doesn't work out pixel colours or write anything to the frame
+	uint8_t frameskip;
+	uint8_t frameskipCounter;
+
+	//True if the current frame is being drawn
+	bool renderFrame;
+
+	//True if the last completed frame was drawn
+	bool frameRendered;
+
+	//Set by displayNextFrame to draw the next frame regardless of frameskip
+	bool forceRender;
+
+	//Set by hideNextFrame to skip the next frame regardless of everything
+	//else, it doesn't count towards frameskip
+	bool hideFrame;
+
+	//Dirty tracking, see frameChanged
+	//Every pixel output on a line goes into currentLineHash, at the end of
+	//the line it's compared with lineHash, the hash from the last time that
+	//line was output. Lines that aren't output at all keep what they had so
+	//they can't have changed. forceDirty marks everything changed after the
+	//output buffer moves
+	uint32_t lineHash[240];
+	uint32_t currentLineHash;
+	bool lineOutput;
+	bool lineDirty[240];
+	bool linesChanged;
+	bool lastFrameChanged;
+	bool forceDirty;
+
+	//Deferred rendering, see setDeferredRendering
+	//deferFrame is decided at the start of each frame, while it is set the
+	//visible lines are logged into scanlineLog instead of being drawn, and
+	//loggedLine is the last line that started drawing
+	Rasterizer *rasterizer;
+	ScanlineLog *scanlineLog;
+	bool deferredRendering;
+	bool deferFrame;
+	int16_t loggedLine;
+
+	//Lines of this frame handed to the rasterizer so far, and whether it's
+	//still drawing them
+	int16_t rasterizedLines;
+	bool rasterizerBusy;
+
+	//Set while the current line's background is left for the rasterizer, the
+	//fetch and shift registers are out of date until BG_LAG_EXACT. Anything
+	//that would change how the rest of the line is fetched or looks at the
+	//registers before then has to call catchUpBackground first
+	bool bgLagging;
+
+	//Dot scheduler tables, see initializeDotTables
+	//lineType maps a scanline to one of the LINE_* types and dotActions holds the
+	//DOT_* actions for every dot of each type, for each combination of the
+	//BG_RNDR and SPR_RNDR bits (PPUMASK bits 3-4)
+	uint8_t lineType[262];
+	uint32_t dotActions[LINE_TYPE_COUNT][4][341];
 
 	//upon reset, certain registers cannot be written until ~29,658 cycles have passed
 	//This variable counts down until that point has been reached
 	uint16_t resetCountdown;
 
-	//This will get more complex later on when I implement mirroring
-	//For now it's just a simple placeholder for maintainability's sake
-	void writeVRAM(uint16_t address, uint8_t data) {
-		vram[address & 0x3FFF] = data;
-	}
+	//set at the end of the frame and reset at the beginning of the next cycle
+	bool frameEnd;
+
+	//set at the end of the scanline and reset at the beginning of the next cycle
+	bool scanlineEnd;
+
+	//Extra copies of the idle lines to run each frame (see setOverclock) and
+	//how many of the current line's copies have been run so far, while that's
+	//non-zero the PPU is on an extra line
+	int extraLinesBeforeNMI;
+	int extraLinesAfterNMI;
+	int extraLinesRun;
+
+	//Called at the end of each line, true if it should run again as an
+	//extra line instead of moving on to the next
+	bool repeatLine();
+
+	//Number of frames rendered since power on
+	uint64_t frameNumber;
+
+	//Counters for the frame in progress and the last finished one, the current
+	//ones are moved over and cleared when the frame ends
+	PPUStats stats;
+	PPUStats lastFrameStats;
+
+	//Last line counted in stats.overflowLines
+	int16_t overflowStatsLine;
+
+	//Sets the sprite overflow flag, counting the line the first time
+	void setSpriteOverflow();
+
+	void resetStats();
+
+	//Palette RAM is handled internally, everything else is handed off
+	//to the console for memory mapping
+	void writeVRAM(uint16_t address, uint8_t data);
+
+	//Palette RAM is handled internally, everything else is handed off
+	//to the console for memory mapping
+	uint8_t readVRAM(uint16_t address);
+
+	//Rendering fetch from pattern tables/nametables, reads through the
+	//mapper's pages. Never used for palette RAM
+	uint8_t fetchVRAM(uint16_t address);
 
-	//Maintainability placeholder until I develop more sophisticated memory handling
-	uint8_t readVRAM(uint16_t address) {
-		return vram[address & 0x3FFF];
-	}
+	//True if either background or sprite rendering is enabled
+	bool renderingEnabled();
 
 	//Retrieves appropriate byte in name table based on rendering address
 	//Bit manipulation based on how the accessAddress register is used
 	//during rendering. See description of rendering (wherever I end up putting that)
-	uint8_t retrieveNameTableByte(uint16_t address) {
-		return readVRAM((address & 0x0FFF) | 0x2000);	
-	}
+	uint8_t retrieveNameTableByte(uint16_t address);
 
 	//Attribute table contains the upper two bits of the palette entry
 	//It is 64 bytes in size, creating an 8*8 grid which divides the screen
 	//Into 4*4 tile groups corresponding to each byte. Each of those groups is
-	//further divided into 4 2*2 squares. Each of these squares corresponds to 
+	//further divided into 4 2*2 squares. Each of these squares corresponds to
 	//two bits in the byte. The bits are layed out like so: 33221100 corresponding
 	//to the four squares which are layed out like so:
 	//			---------------------------------
@@ -265,16 +514,13 @@ private:
 	//			|	$A 	$B 		|	$E 	$F 		|
 	//			---------------------------------
 	//All of which is horrendously complicated
-	uint8_t retrieveAttrTableBits(uint16_t address) {
-		//Calculates the address of the appropriate byte in the attribute table
-		//						   Nametable region offset   Attr offset    Nametable select     Y select                    X Select									
-		uint8_t attributeAddress = 0x2000                  | 0x03C0       | (address & 0x0C00) | ((address & 0x0380) >> 4) | ((address & 0x001C) >> 2);
-		//Calculates which square within the byte that the tile belongs to
-		//					   X coordinate				   Y coordinate
-		uint8_t squareNumber = ((address & 0x0002) >> 1) | ((address & 0x0040) >> 5);
-		//Retrieves the byte from VRAM, shifts the appropriate bits to the end and masks the rest away
-		return (readVRAM(attributeAddress) >> (2 * squareNumber)) & 0x03;
-	}
+	uint8_t retrieveAttrTableBits(uint16_t address);
+
+	//Expands one attribute byte into the 16 tiles it covers
+	void expandAttrByte(uint8_t nametable, uint8_t index, uint8_t data);
+
+	//Rebuilds the attribute cache for one nametable from VRAM
+	void rebuildAttrCache(uint8_t nametable);
 
 	//Pattern table addresses are structured like so:
 	//	0HBBBBBBBBPTTT
@@ -287,328 +533,82 @@ private:
 	//and it returns the the bits corresponding to the appropriate part of the
 	//appropriate pattern. See rendering function for more detailed description of
 	//what these bits mean and how they are used
-	uint8_t retrievePatternTableByte(bool patternTable, uint8_t patternByte, bool plane, uint8_t yOffset) {
-		uint16_t patternAddress = (patternTable << 11) | (patternByte << 4) | (plane << 3) | yOffset;
-		return readVRAM(patternAddress);
-	}
+	uint8_t retrievePatternTableByte(bool patternTable, uint8_t patternByte, bool plane, uint8_t yOffset);
 
 	//The following several functions were pulled out of the cycle function for readability
 	//Halfway through inplementing cycle it become an unmanagable tangle of nested ifs
 
-	void incrementHorizontal() {
-		//get current coarse x
-		uint8_t x = accessAddress & 0x001F;
-		//increment it
-		x++;
-		//did x overflow?
-		if (x == 0x20)
-		{
-			//reset x to 0
-			x = 0;
-			//flip horizontal nametable bit in address
-			accessAddress ^= 0x0400;
-		}
-		//clear coarse x
-		accessAddress &= 0xFFE0;
-		//set new coarse x
-		accessAddress |= x; 
-	}
-
-	void incrementVertical() {
-		//Check to see if fine y will overflow
-		if (accessAddress & 0x7000 != 0x7000)
-			//if it doesn't, just increment fine y
-			accessAddress += 0x1000;
-		else {
-			//else set fine y to 0
-			accessAddress &= 0x0FFF;
-			//grab coarse y
-			uint8_t y = (accessAddress & 0x03E0) >> 5;
-
-			//Coarse Y wraparound behavior is slightly complicated
-			//if y is 29, it wraps around to 0 and the vertical nametable is switched
-			//During normal rendering y should never be more than 29
-			//However, it can be set manually to 30 or 31
-			//If this is encountered during y increment, 30 is incremented to 31
-			//and 31 is wrapped around to 0 WITHOUT switching vertical nametables
-			if (y == 29) {
-				y = 0;
-				accessAddress ^= 0x8000;
-			}
-			else if (y == 31) {
-				y = 0;
-			}
-			else {
-				y++;
-			}
-
-			//Finally, clear the old coarse y and set it to the new one
-			accessAddress &= 0x7C1F;
-			accessAddress |= y << 5;
-		}
-	}
-
-	void fetchBGTile() {
-		//Nametable fetch
-		if (cycles % 8 == 2) {
-			currentPattern = readVRAM(accessAddress);
-		}
-		//Attribute fetch
-		else if (cycles % 8 == 4) {
-			attrLatchBuffer = retrieveAttrTableBits(accessAddress);
-		}
-		//Lower pattern table fetch
-		else if (cycles % 8 == 6) {
-			patternBuffer0 = retrievePatternTableByte(ppuControl2 & CONTROL1_BG_PT, currentPattern, 0, accessAddress >> 12);
-		}
-		//Higher pattern table fetch/course X increment
-		else if (cycles % 8 == 0) {
-			patternBuffer1 = retrievePatternTableByte(ppuControl2 & CONTROL1_BG_PT, currentPattern, 1, accessAddress >> 12);
-			
-			incrementHorizontal();
-		}
-	}
-
-	void fetchSpriteData() {
-		//calculates which sprite object from secondary oam
-		//to pull data from
-		int16_t currentSprite = (cycles - 257)/8;
-		//Lower pattern table fetch
-		if (cycles % 8 == 6) {
-			//Sprite index was used during sprite evaluation to keep track
-			//of how many sprites have been found for the current scanline
-			//So if we have more sprites to load, grab from secondary OAM
-			//Otherwise fill with transparent data
-			if (currentSprite < spriteIndex) {
-				//If sprites are 8x16 the pattern table select bit is ignored
-				//and bit 0 from the tile index is used to indicate the appropriate pattern table
-				//bit 4 from the range comparison is then used to set bit 0 of the tile index
-				if (ppuControl1 & CONTROL1_SPR_SIZE) {
-					spriteShift[currentSprite*2+0] = retrievePatternTableByte(oamSecondary[currentSprite*4+1] & 0x01, (oamSecondary[currentSprite*4+1] & 0xFE) | ((oamSecondary[currentSprite*4+0] & 0x08) >> 3), 0, oamSecondary[currentSprite*4+0] & 0x07);
-				}
-				else {
-					spriteShift[currentSprite*2+0] = retrievePatternTableByte(ppuControl2 & CONTROL1_SPR_PT, oamSecondary[currentSprite*4+1], 0, oamSecondary[currentSprite*4+0] & 0x07);
-				}
-			}
-			else {
-				spriteShift[currentSprite*2+0] = 0x00;
-			}
-		}
-		//Higher pattern table fetch
-		else if (cycles % 8 == 0) {
-			if (currentSprite < spriteIndex) {
-				if (ppuControl1 & CONTROL1_SPR_SIZE) {
-					spriteShift[currentSprite*2+1] = retrievePatternTableByte(oamSecondary[currentSprite*4+1] & 0x01, (oamSecondary[currentSprite*4+1] & 0xFE) | ((oamSecondary[currentSprite*4+0] & 0x08) >> 3), 1, oamSecondary[currentSprite*4+0] & 0x07);
-				}
-				else {
-					spriteShift[currentSprite*2+1] = retrievePatternTableByte(ppuControl2 & CONTROL1_SPR_PT, oamSecondary[currentSprite*4+1], 1, oamSecondary[currentSprite*4+0] & 0x07);
-				}
-				spriteAttr[currentSprite] = oamSecondary[currentSprite*4+2];
-				spriteXCounter[currentSprite] = oamSecondary[currentSprite*4+3];
-			}
-			else {
-				spriteShift[currentSprite*2+1] = 0x00;
-				spriteAttr[currentSprite] = 0x20; //behind background
-				spriteXCounter[currentSprite] = 0xFF; //At right edge of screen
-			}
-		}
-	}
-
-	void loadSprites() {
-		if (!readingSprite) {
-			//Find position of the top of the sprite relative to the current scanline
-			int16_t range = scanline - oam[spriteMemAddress];
-			//If we have 8x16 sprites, we check 0 <= range <= 15
-			if (ppuControl1 & CONTROL1_SPR_SIZE) {
-				if (range >= 0 && range <= 15) {
-					oamSecondary[spriteIndex*4+0] = oam[spriteMemAddress];
-					//If the sprite found is sprite 0, set the tracker
-					if (spriteMemAddress == 0) {
-						//Sprite 0 hit is not detected at x = 255 or at 0-7 if the background
-						//or sprites are hidden in this area
-						if (! (oam[spriteMemAddress+3] == 255 || (ppuControl2 & CONTROL2_CLIP_LEFT && oam[spriteMemAddress+3] >= 0 && oam[spriteMemAddress+3] < 8)))
-							sprite0Tracker |= 0x02;
-					}
-					spriteMemAddress +=1;
-					readingSprite = 3;
-				}
-				else {
-					spriteMemAddress += 4;
-				}
-			}
-			//If we have 8x8 sprites, we check 0 <= range <= 7
-			else {
-				if (range >= 0 && range <= 7) {
-					oamSecondary[spriteIndex*4+0] = oam[spriteMemAddress];
-					//If the sprite found is sprite 0, set the tracker
-					if (spriteMemAddress == 0) {
-						sprite0Tracker |= 0x02;
-					}
-					spriteMemAddress +=1;
-					readingSprite = 3;
-				}
-				else {
-					spriteMemAddress += 4;
-				}
-			}
-		}
-		//Copy tile index byte
-		else if (readingSprite == 3) {
-			oamSecondary[spriteIndex*4+1] = oam[spriteMemAddress];
-			spriteMemAddress +=1;
-			readingSprite -= 1;
-		}
-		//Copy attribute byte
-		else if (readingSprite == 2) {
-			oamSecondary[spriteIndex*4+2] = oam[spriteMemAddress];
-			//if the vertical flip byte is set, bitwise invert the range
-			if (oamSecondary[spriteIndex*4+2] & 0x80) {
-				oamSecondary[spriteIndex*4+0] = (~oamSecondary[spriteIndex*4+0]) & 0x0F;
-			}
-			spriteMemAddress +=1;
-			readingSprite -= 1;
-		}
-		else if (readingSprite == 1) {
-			oamSecondary[spriteIndex*4+3] = oam[spriteMemAddress];
-			spriteMemAddress += 1;
-			spriteIndex += 1;
-			readingSprite -= 1;
-		}
-	}
-
-	void checkSpriteOverflow() {
-		//If sprite overflow evaluation detects an in-range sprite, it
-		//reads the next 3 bytes (for some reason) instead of just jumping
-		//to the next sprite. As far as I can tell these are just some sort
-		//of garbage reads that don't affect anything. Probably something to
-		//do with reusing the hardware for normal sprite evaluation.
-		//Regardless, because of the address increment bug, the logic
-		//I used for normal sprite evaluation no longer works here
-		//So 'readingSprite' is just a counter that gets set to 3 when
-		//an in-range sprite is detected and decremented until it reaches 0
-		//Simulating the 3 garbage r/w cycles
-		if (!readingSprite) {
-			//Find position of the top of the sprite relative to the current scanline
-			int16_t range = scanline - oam[spriteMemAddress];
-			//If we have 8x16 sprites, we check 0 <= range <= 15
-			if (ppuControl1 & CONTROL1_SPR_SIZE) {
-				if (range >= 0 && range <= 15) {
-					ppuStatus |= STATUS_SPR_OVFLW;
-					spriteMemAddress += 4;
-					readingSprite = 3;
-				}
-				else {
-					//So here the particulars of the internal representation of the OAM 
-					//address become relevant, and this is why the original logic fails
-					//The 8-byte sprite memory address can be thought of as divided into
-					//two sub-registers, n (bits 7-2) and m (bits 0-1). Normally they act
-					//as one 8-byte register, but when checking for sprite overflow, if
-					//the value checked is not in range, both both n and m are incremented
-					//without carry on m. So when m does not overflow, 0x101 = 5 is added.
-					//But when m = 3, it wraps around to 0, so effectively 3 is subtracted
-					//from the address. After the +4 from the n increment this becomes a
-					//a net +1 to the address. This m increment causes bytes that aren't y 
-					//coordinates to be evaluated as if they were, making the sprite overflow
-					//flag unreliable
-					if (spriteMemAddress % 4 == 3)
-						spriteMemAddress += 1;
-					else
-						spriteMemAddress += 5;
-				}
-			}
-			//If we have 8x8 sprites, we check 0 <= range <= 7
-			else {
-				if (range >= 0 && range <= 7) {
-					ppuStatus |= STATUS_SPR_OVFLW;
-					spriteMemAddress += 4;
-					readingSprite = 3;
-				}
-				else {
-					if (spriteMemAddress % 4 == 3)
-						spriteMemAddress += 1;
-					else
-						spriteMemAddress += 5;
-				}
-			}
-		}
-		else {
-			readingSprite -= 1;
-		}
-	}
-
-	bool isTransparent(uint8_t pixel) {
-		return (pixel & 0x03) == 0x00;
-	}
-
-	void calculatePixel() {
-		uint16_t xSelector = 0x01 << fineX;
-
-		//Calculate the background pixel palette value
-		uint8_t bgPixel = ((attrShift1 & xSelector) << 3) | ((attrShift0 & xSelector) << 2) | ((patternShift1 & xSelector) << 1) | ((patternShift0 & xSelector) << 0);
-
-		uint8_t sprPixel = 0x00;
-
-		//holds sprite priority bit
-		bool priority = 0;
-
-		//Loop through sprites to see if there is a sprite
-		for (int i = 0; i < 8; i++) {
-			//If we've reached the x coordinate of the sprite, check it and shift the shift registers
-			if (spriteXCounter[i] == 0) {
-				if (isTransparent(sprPixel)) {
-					priority = spriteAttr[i] & 0x10;
-					sprPixel = ((spriteAttr[i] & 0x03) << 2) | ((spriteShift[2*i+1] & 0x01) << 1) | ((spriteShift[2*i+0] & 0x01) << 0);
-				}
-				//determine whether to raise sprite0 hit flag
-				if (i == 0 && ((sprite0Tracker & 0x01) == 0x01) && !isTransparent(sprPixel) && !isTransparent(bgPixel)) {
-					ppuStatus |= STATUS_SPR0_HIT;
-				} 
-				spriteShift[2*i+0] >>= 1;
-				spriteShift[2*i+1] >>= 1;
-			}
-			//Otherwise decrement the x counter
-			else {
-				spriteXCounter[i] -= 1;
-			}
-		}
-
-		//determine whether to use sprite pixel or background pixel
-		if ((ppuControl2 & CONTROL2_BG_RNDR) && !(ppuControl2 && CONTROL2_SPR_RNDR)) {
-			pixelBuffer[cycles-1] = readVRAM(bgPixel | 0x3F00);
-		}
-		else if (!(ppuControl2 & CONTROL2_BG_RNDR) && (ppuControl2 && CONTROL2_SPR_RNDR)) {
-			pixelBuffer[cycles-1] = readVRAM(sprPixel | 0x3F00);
-		}
-		else {
-			if ((priority == 0 || isTransparent(bgPixel)) && !isTransparent(sprPixel))
-				pixelBuffer[cycles-1] = readVRAM(sprPixel | 0x3F00);
-			else
-				pixelBuffer[cycles-1] = readVRAM(bgPixel | 0x3F00);
-		}
-	}
+	void incrementHorizontal();
+
+	void incrementVertical();
+
+	void fetchSpritePattern(bool plane);
+
+	void initializeDotTables();
+
+	uint32_t bgFetchPhase(int dot);
+
+	void loadSprites();
+
+	void checkSpriteOverflow();
+
+	//One step of the sprite evaluation state machine
+	void spriteEvalStep();
+
+	//Does everything the evaluation dots of this line would do, using the
+	//state machine's own step counts to work out when things happen
+	void evaluateSprites();
+
+	//Drops the fast evaluation and runs the state machine up to the current
+	//dot instead, the rest of the line carries on one step at a time
+	void replaySpriteEvaluation();
+
+	bool isTransparent(uint8_t pixel);
+
+	void calculatePixel();
+
+	//Cut down calculatePixel used on skipped frames
+	void checkSprite0Hit();
+
+	//Applies spriteLagDots to sprite slots 1-7
+	void catchUpSprites();
+
+	//4-bit background pixel being shifted out on the current dot
+	uint8_t backgroundPixel();
+
+	//Compares a finished line's output hash with last time's
+	void finishLineHash(int line, uint32_t hash, bool output);
+
+	//Starts the scanline log entry for the current line
+	void logScanline();
+
+	//Records a write that changes how the rest of the current line is drawn
+	void logChange(uint8_t type, uint8_t address, uint8_t data);
+
+	//Runs the background for the part of the current line bgLagging skipped
+	//into its log entry, the rest of the line is logged as it goes
+	void catchUpBackground();
+
+	//Draws every finished line the rasterizer hasn't been given yet and
+	//waits for it, before anything writes to VRAM it could be reading
+	void drawLoggedLines();
+
+	//Writes the pixel for the current dot to the frame and, if set, the video output
+	void outputPixel();
 
 	//Increments the cycle and scanline counters
-	void incrementCycle() {
-		cycles++;
-		//Wrap-around cycles to 0 and increment line after 340
-		if (cycles > 340) {
-			scanline++;
-			cycles = 0;
-			//Wrap-around scanlines to 0 and flip frame parity after line 261 
-			if (scanline > 261) {
-				scanline = 0;
-				//On odd frames skip cycle 0 on first scanline
-				if (frameParity = 0) {
-					cycles = 1;
-				}
-				frameParity = ~frameParity;
-			}
-		}
-
-		//decrement countdown
-		if (resetCountdown > 0)
-			resetCountdown--;
-	}
+	void incrementCycle();
+
+	bool isRendering();
+
+	//After reads/writes to PPUDATA, accessAddress is incremented
+	void incrementVAddress();
+
+	//Determines whether the given address points to palette memory
+	//Used primarily to determine whether to use buffering behaviour
+	//for PPUDATA read
+	bool isPaletteMemory(uint16_t address);
+public:
 
 	//This function performs a PPU cycle
 	//3 things are happening (more or less) in parallel:
@@ -623,383 +623,126 @@ private:
 	//||| ++-------------- nametable select
 	//+++----------------- fine Y scroll
 	//
-	//NOTE: Because the PPU has to operate cycle by cycle, this function rapidly became
-	//a rat's nest of if statements determining what state the PPU is in. Hopefully I'll come
-	//back to this some time in the future and fix it up to be more readable and maintainable
-	void cycle() {
-		//Code for non-rendering/pre-rendering period
-		if (scanline > 239) {
-			if (scanline == 241 && cycles == 1) {
-				ppuStatus |= STATUS_VBL;
-				if (ppuControl1 & CONTROL1_VBL) {
-					//raise NMI
-				}
-			}
-			else if (scanline == 261) {
-				//Clear vblank flag, sprite 0 hit, and overflow flags at end of vblank
-				if (cycles == 1) {
-					ppuStatus &= ~STATUS_VBL;
-					ppuStatus &= ~STATUS_SPR0_HIT;
-					ppuStatus &= ~STATUS_SPR_OVFLW;
-				}
-				//reset vertical offset at end of frame
-				else if (cycles == 280) {
-					//clear out the old vert data
-					accessAddress &= 0x041F;
-					//Masks out the vert data from the temp address and use it
-					//to set the access address
-					accessAddress |= temporaryAddress & 0x7BE0;
-				}
-				else if (cycles >= 257 && cycles <= 320) {
-					spriteMemAddress = 0;
-				}
-				else if (cycles >= 321 && cycles <= 336) {
-					fetchBGTile();
-				}
-			}
-			incrementCycle();
-			return;
-		}
-
-		//Code for rendering period
-
-		//Do nothing if rendering is disabled
-		if (! ( (ppuControl2 & CONTROL2_BG_RNDR) || (ppuControl2 & CONTROL2_SPR_RNDR) ) ) {
-			incrementCycle();
-			return;
-		}
-
-
-		//Memory fetch code
-
-		//Memory fetches for BG tiles
-		if (ppuControl2 & CONTROL2_BG_RNDR) {
-			if ((cycles >= 1 && cycles <= 256) || (cycles >= 321 && cycles <= 336)) {
-				fetchBGTile();
-			}
-			//Increment Y at end of bg fetches for this scanline
-			if (cycles == 256) {
-				incrementVertical();
-			}
-			//reset horizontal offset at end of bg fetches for this scanline
-			else if (cycles == 257) {
-				//clear out old horizontal data
-				accessAddress &= 0x7BE0;
-				//Mask out the horizontal data from the temp address and use it
-				//to set the access address
-				accessAddress |= temporaryAddress & 0x041F;
-			}
-		}
-
-		//Memory fetches for sprites
-		//(Sprite evaluation is only disabled when rendering is completely
-		//disabled, if BG rendering is enabled, disabling sprite rendering only
-		//hides the sprites, but they are still evaluated)
-		if (ppuControl2 & CONTROL2_SPR_RNDR || ppuControl2 & CONTROL2_BG_RNDR) {
-			if ((cycles >= 257 && cycles <= 320)) {
-				fetchSpriteData();
-			}
-		}
-
-		//END Memory fetch code
-
-		//Sprite evaluation
-
-		//First 64 cycles spent clearing out secondary OAM
-		if (cycles >= 1 && cycles <= 64) {
-			if (cycles % 2 == 0) {
-				oamSecondary[cycles/2 - 1] = 0xFF;
-			}
-		}
-		//Cycles 65-256: sprite evaluation
-		//NOTE: technically reads are supposed to happen on odd cycles and
-		//writes are supposed to happen on even cycles. To make things a little
-		//simpler, I made it all happen on the even cycles. Pretty sure this won't
-		//cause any problems, you'd have to be real fiddly about timing to make use
-		//of this behavior. However, if there are problems with sprite evaluation
-		//this is something to check
-		else if (cycles >= 65 && cycles <= 256) {
-			if (cycles % 2 == 0) {
-				//I can't tell if I hate this or not, maybe it's just because it's so late at night
-				//It's just a check that says if we've run through all of the OAM (becuase OAM is
-				//256 bytes) then we're done evaluating sprites for this scanline so do nothing
-				if (spriteMemAddress >= 256) {
-					//Do nothing
-				}
-				//This is the part that evaluates sprites to be added to the secondary OAM
-				else if (spriteIndex < 8) {
-					loadSprites();
-				}
-				//Buggy overflow check
-				else {
-					checkSpriteOverflow();
-				}
-			}
-		}
-
-		//END Sprite evaluation code
-
-		//Pixel rendering code
-
-		//Calculate pixels and place in buffer
-		if (cycles >= 1 && cycles <= 256) {
-			calculatePixel();
-		}
-
-		//Shift registers
-		patternShift0 >>= 1;
-		patternShift1 >>= 1;
-
-		//every 8 cycles load shift registers from buffers
-		if ((cycles >= 1 && cycles <= 256) || (cycles >=321 && cycles <= 336)) {
-			if (cycles % 8 == 0) {
-				patternShift0 |= patternBuffer0 << 8;
-				patternShift1 |= patternBuffer1 << 8;
-				attrLatch = attrLatchBuffer;
-			}
-		}		
-		
-		attrShift0 >>= 1;
-		attrShift0 |= (attrLatch & 0x01) << 7;
-		attrShift1 >>= 1;
-		attrShift1 |= (attrLatch & 0x02) << 6;
-
-
-		//Write pixels to video output 3 frames after calculation
-		if (cycles >= 4 && cycles <= 259) {
-			frameBuffer[cycles-4][scanline] = pixelBuffer[cycles-4];
-		}
-
-		//END Rendering code
-
-		//End of cycle cleanup
-
-		//The the sprite memory pointer is set to 0 in each tick
-		//during the sprite tile loading process
-		if (cycles >= 257 || cycles <= 320) {
-			spriteMemAddress = 0;
-		}
-
-		//Clean up the rest of the sprite global variables at end of scanline
-		if (cycles == 340) {
-			spriteIndex = 0;
-			sprite0Tracker >>= 1;
-			readingSprite = 0;
-		}
-
-		incrementCycle();
-	}
-
-	bool isRendering() {
-		//		Rendering is enabled  AND    We are in the rendering period     OR the pre-render line
-		return (ppuControl2 & 0x18)   &&   ( (scanline >= 0 && scanline <= 239) || scanline == 261 );
-	}
-
-	//After reads/writes to PPUDATA, accessAddress is incremented
-	void incrementVAddress() {
-		//Amount to increment by is determined by CONTROL1_INC
-		if (ppuControl1 & CONTROL1_INC == 0x00) {
-			accessAddress += 0x0001;
-		}
-		else { //if CONTROL1_INC is set
-			accessAddress += 0x0010;
-		}
-	}
+	//What happens on each dot is looked up in the dot scheduler tables
+	//(see initializeDotTables), so all this does is carry out the actions
+	void cycle();
 
-	//Determines whether the given address points to palette memory
-	//Used primarily to determine whether to use buffering behaviour
-	//for PPUDATA read
-	bool isPaletteMemory(uint16_t address) {
-		return (address & 0x3FFF) < 0x3F00;
-	}
-public:
+	PPU(Console *con);
 
-	PPU(Console *con) {
-		console = con;
-
-		ppuControl1 = 0x00;
-		ppuControl2 = 0x00;
-		ppuStatus = 0xA0;
-		readBuffer = 0x00;
-		registerLatch = 0x00;
-		scanline = 0;
-		cycles = 0;
-		frameParity = 0;
-		accessAddress = 0x0000;
-		temporaryAddress = 0x0000;
-		fineX = 0;
-		writeToggle = 0;
-		spriteIndex = 0;
-		spriteMemAddress = 0x00;
-		patternShift0 = 0x0000;
-		patternShift1 = 0x0000;
-		patternBuffer0 0x00;
-		patternBuffer1 = 0x00;
-		attrShift0 = 0x00;
-		attrShift1 = 0x00;
-		attrLatch = 0x00;
-		attrLatchBuffer = 0x00;
-		currentPattern = 0x00;
-		sprite0Tracker = 0;
-		resetCountdown = RESET_COUNTDOWN_START;
-
-		for (int i = 0; i < 16; i++)
-			spriteShift[i] = 0x00;
-		for (int i = 0; i < 8; i++)
-			spriteAttr[i] = 0x00;
-			spriteXCounter[i] = 0x00;
-	}
+	~PPU();
 
 	//TODO: NMI code for PPUCTRL write
 	//writes data to register specified by regAddr
-	void writeRegister(uint8_t regAddr, uint8_t data) {
-		//Access to PPU registers occurs through a latch which holds
-		//the last value read/written, the various aspects of how this
-		//affects execution will be explained as they come up in code
-		//
-		//Writing data to any PPU register fills the latch with the data written
-		registerLatch = data;
-
-		if (regAddr == PPUCTRL) {
-			//writes to PPUCTRL ignored for a period after powerup/reset
-			if (resetCountdown == 0) {
-				ppuControl1 = data;
-
-				//clear out old nametable data;
-				temporaryAddress &= 0x0C00;
-				//replace with new nametable data
-				temporaryAddress |= (data & 0x03) << 10;
-
-				//If PPUSTATUS vblank is still set and PPUCONTROL raiseNMI is toggled on, NMI is raised immediately
-				if (ppuStatus & STATUS_VBL && ppuControl1 & CONTROL1_VBL) {
-					//raise NMI
-				}
-			}
-		}
-		else if (regAddr == PPUMASK) {
-			//writes to PPUMASK ignored for a period after powerup/reset
-			if (resetCountdown == 0) {
-				ppuControl2 = data;
-			}
-		}
-		else if (regAddr == PPUSTATUS) {
-			//PPUSTATUS is read-only
-		}
-		else if (regAddr == OAMADDR) {
-			if (!isRendering()) {
-				spriteMemAddress = data;
-			}
-		}
-		else if (regAddr == OAMDATA) {
-			if (!isRendering()) {
-				oam[spriteMemAddress] = data;
-				spriteMemAddress++;
-			}
-		}
-		else if (regAddr == PPUSCROLL) {
-			//writes to PPUSCROLL ignored for a period after powerup/reset
-			if (resetCountdown == 0) {
-				//Writing horizontal scroll
-				if (writeToggle == 0) {
-					//clear out coarse x from t and fill with coarse x from data
-					temporaryAddress &= 0x001F;
-					temporaryAddress |= (0xF8 & data) >> 3;
-					//new fine x assignment
-					fineX = data & 0x07;
-					//Toggle w
-					writeToggle= 1;
-				}
-				//Writing vertical scroll
-				else if (writeToggle == 1) {
-					//clearing out vertical scroll from t
-					temporaryAddress &= 0x0C1F;
-					//Setting coarse y
-					temporaryAddress |= (data & 0xF8) << 2;
-					//setting fine y
-					temporaryAddress |= (data & 0x07) << 12;
-					//toggle w
-					writeToggle = 0;
-				}
-			}
-		}
-		else if (regAddr == PPUADDR) {
-			//writes to PPUADDR ignored for a period after powerup/reset
-			if (resetCountdown == 0) {
-				//write high byte
-				if (writeToggle == 0) {
-					//clearing out high byte
-					temporaryAddress &= 0x00FF;
-					//setting new high byte
-					temporaryAddress |= (data & 0x3F) << 8;
-					//write toggle
-					writeToggle = 1;
-				}
-				//write low byte and setting accessAddress
-				else if (writeToggle == 1) {
-					//clearing out low byte
-					temporaryAddress &= 0xFF00;
-					//setting new low byte
-					temporaryAddress |= data;
-					//toggle w
-					writeToggle = 0;
-					//set accessaddress
-					accessAddress = temporaryAddress;
-				}
-			}
-		}
-		else if (regAddr == PPUDATA) {
-			//PPUDATA access is only strictly legal outside of rendering
-			//Access during rendering causes accessAddress to increment
-			//in a pathological way and can result in a random location
-			//being accessed. Because of this, writes during rendering are
-			//ignored (though accessAddress is still incremented because there
-			//are 2 games which make use of this for mid-frame graphics trickery).
-			if (!isRendering()) {
-				writeVRAM(accessAddress, data);
-				incrementVAddress();
-			}
-			else { //access during rendering
-				//write ignored
-				//pathologically increment by performing a coarse x increment and a y increment
-				incrementHorizontal();
-				incrementVertical();
-			}
-		}
-	}
+	void writeRegister(uint8_t regAddr, uint8_t data);
 
 	//reads data from register specified by regAddr
-	uint8_t readRegister(uint8_t regAddr) {
-		//Reading any readable port will fill the latch with the bits read
-		if (regAddr == PPUSTATUS) {
-			//only the 3 highest bits of PPUSTATUS exist in hardware, so only
-			//the 3 highest bits of the latch are affected
-			registerLatch &= 0x1F;
-			registerLatch |= ppuStatus & 0xE0;
-		}
-		else if (regAddr == OAMDATA) {
-			registerLatch = oam[spriteMemAddress];
-		}
-		else if (regAddr == PPUDATA) {
-			//Buffered non-palette read
-			if (!isPaletteMemory(accessAddress)) {
-				registerLatch = readBuffer;
-				readBuffer = readVRAM(accessAddress);
-				if (!isRendering())
-					incrementVAddress();
-				else {
-					//pathological increment during rendering
-					incrementHorizontal();
-					incrementVertical();
-				}
-			}
-			else { //Palette data read
-				registerLatch = readVRAM(accessAddress)
-			}
-		}
-		//Reading a write-only register returns the current value of the latch
-		return registerLatch;
-	}
+	uint8_t readRegister(uint8_t regAddr);
+
+	//Same as readRegister, but without any of the side effects
+	uint8_t debugReadRegister(uint8_t regAddr);
+
+	uint8_t debugPaletteRead(uint16_t address);
+
+	//Direct access to palette RAM and OAM for tools, no mirroring is done
+	void debugPaletteWrite(uint16_t address, uint8_t data);
+
+	uint8_t debugOAMRead(uint8_t address);
+
+	void debugOAMWrite(uint8_t address, uint8_t data);
+
+	//Has to be called after anything that might have changed the mapper's
+	//nametable pages, rebuilds the attribute cache for any that moved
+	void nametablesChanged();
+
+	//Has to be called before anything that might change the mapper's CHR or
+	//nametable pages
+	void pagesChanging();
+
+	//Runs the given number of dots back to back, returns true if the frame
+	//ended during them
+	bool runDots(int dots);
+
+	//Number of dots that can be run before the PPU next does something the
+	//rest of the console has to see on the exact cycle it happens (setting
+	//vblank/raising NMI, finishing the frame, and starting or finishing the
+	//extra lines). Never overestimates
+	int dotsUntilEvent();
+
+	//Sets up the video output stage
+	//
+	//buffer is a 256x240 image of 32-bit pixels, pitch is the length
+	//of a row in bytes and format is one of the PIXEL_FORMAT_* values
+	//in Palette.h. Passing NULL as the buffer turns the output stage off
+	void setVideoOutput(uint32_t *buffer, int pitch, uint8_t format);
+
+	//Runs extra lines each frame that the CPU gets to use but nothing else
+	//does, for games that slow down because their logic doesn't fit in a
+	//frame. beforeNMI lines go after the last visible line, afterNMI lines go
+	//at the end of vblank. 0 and 0 is a normal NES
+	void setOverclock(int beforeNMI, int afterNMI);
+
+	//True while the PPU is on one of the extra lines, the console stops the
+	//APU for them so the sound keeps the same timing
+	bool onExtraLine();
+
+	//Counts an OAM DMA, the console calls this when one starts since the
+	//PPU only sees the OAMDATA writes
+	void oamDMAStarted();
+
+	//Counters for the last finished frame
+	PPUStats getFrameStats();
+
+	//Only draw one frame out of every ratio+1 (0 draws every frame)
+	//Sprite 0 hit, sprite overflow, vblank/NMI timing and all VRAM fetches
+	//are unaffected by skipped frames
+	void setFrameskip(uint8_t ratio);
+
+	//Moves drawing off the emulating thread. Visible lines are logged as
+	//they go by and drawn during vblank by a pool of the given number of worker threads,
+	//the frame is done by the time it's reported finished. Sprite 0 hit is
+	//still worked out as the line goes. The workers fetch the background
+	//straight out of VRAM, so writing to it waits for any lines logged before
+	//the write to be drawn first. Takes effect from the next frame
+	void setDeferredRendering(bool enabled, int threads);
+
+	//Makes sure the next frame is drawn regardless of the frameskip ratio
+	void displayNextFrame();
+
+	//Skips the next frame, for frames that are run but never shown (see
+	//Console::runFrameAhead). Takes priority over displayNextFrame
+	void hideNextFrame();
+
+	//Snapshot of the PPU, see Console::saveState. Anything to do with output
+	//(the frame, dirty tracking, frameskip, the video output and deferred
+	//rendering settings) isn't part of the state and is left alone by
+	//loadState, so the last frame drawn stays on screen and compares right
+	//against the next one
+	size_t stateSize();
+
+	void saveState(uint8_t *state);
+
+	void loadState(const uint8_t *state);
+
+	//Has to be called once the mapper's state is loaded as well, rebuilds
+	//the attribute cache from the nametables
+	void vramLoaded();
+
+	//True if the last completed frame was drawn. When this is false the frame
+	//and video output still hold the last frame that was
+	bool frameDisplayed();
+
+	//True if the last completed frame looks any different from the frame
+	//drawn before it. Always false for skipped frames
+	bool frameChanged();
+
+	//Same as frameChanged for a single line of the last completed frame
+	bool lineChanged(int line);
+
+	bool endOfFrame();
+
+	bool endOfScanline();
 
+	Frame getFrame();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,181 @@
+#include "PPURecorder.h"
+#include "PPU.h"
+#include "Mapper.h"
+
+#include <cstring>
+
+using namespace std;
+
+uint32_t hashFrame(const Frame &frame) {
+	uint32_t hash = PPU_LOG_HASH_START;
+	for (int x = 0; x < 256; x++) {
+		for (int y = 0; y < 240; y++)
+			hash = (hash ^ frame.buffer[x][y]) * PPU_LOG_HASH_PRIME;
+	}
+	return hash;
+}
+
+PPURecorder::PPURecorder(const char *filename, PPU *ppu, Mapper *mapper, int frames) {
+	this->ppu = ppu;
+	this->mapper = mapper;
+
+	lastTime = 0;
+	framesLeft = frames;
+
+	file.open(filename, ios::out | ios::binary | ios::trunc);
+	if (!file.is_open())
+		return;
+
+	file.write(PPU_LOG_MAGIC, strlen(PPU_LOG_MAGIC));
+	writeByte(PPU_LOG_VERSION);
+
+	//Power on state
+	writeEvent(PPU_LOG_OAM, 0);
+	for (int i = 0; i < 256; i++)
+		writeByte(ppu->debugOAMRead(i));
+
+	writeEvent(PPU_LOG_PALETTE, 0);
+	for (int i = 0; i < 32; i++)
+		writeByte(ppu->debugPaletteRead(i));
+
+	for (int i = 0; i < 8; i++)
+		chrPages[i] = NULL;
+	for (int i = 0; i < 4; i++)
+		nametablePages[i] = NULL;
+
+	pagesChanged(0);
+
+	flush();
+}
+
+PPURecorder::~PPURecorder() {
+	if (!file.is_open())
+		return;
+
+	writeEvent(PPU_LOG_END, lastTime);
+	flush();
+	file.close();
+}
+
+bool PPURecorder::isOpen() {
+	return file.is_open();
+}
+
+void PPURecorder::writeByte(uint8_t data) {
+	buffer.push_back(data);
+}
+
+void PPURecorder::writeEvent(uint8_t type, uint64_t time) {
+	writeByte(type);
+
+	uint64_t delta = time - lastTime;
+	lastTime = time;
+
+	//LEB128, 7 bits at a time with the top bit set on all but the last byte
+	do {
+		uint8_t byte = delta & 0x7F;
+		delta >>= 7;
+		if (delta)
+			byte |= 0x80;
+		writeByte(byte);
+	} while (delta);
+}
+
+void PPURecorder::flush() {
+	file.write((const char *)buffer.data(), buffer.size());
+	buffer.clear();
+}
+
+bool PPURecorder::chrWritable(uint16_t address) {
+	uint8_t original = mapper->debugPpuRead(address);
+	mapper->ppuWrite(address, original ^ 0xFF);
+	bool writable = mapper->debugPpuRead(address) != original;
+	mapper->ppuWrite(address, original);
+	return writable;
+}
+
+uint16_t PPURecorder::pageId(uint8_t *page, uint16_t address) {
+	map<uint8_t *, uint16_t>::iterator found = pageIds.find(page);
+	if (found != pageIds.end())
+		return found->second;
+
+	uint16_t id = pageIds.size();
+	pageIds[page] = id;
+
+	//Nametables are always RAM
+	uint8_t flags = 0x00;
+	if (address >= 0x2000 || chrWritable(address))
+		flags |= PPU_PAGE_WRITABLE;
+
+	writeEvent(PPU_LOG_PAGE, lastTime);
+	writeByte(id & 0xFF);
+	writeByte(id >> 8);
+	writeByte(flags);
+	for (int i = 0; i < PPU_PAGE_SIZE; i++)
+		writeByte(page[i]);
+
+	return id;
+}
+
+void PPURecorder::registerWrite(uint64_t time, uint8_t reg, uint8_t data) {
+	writeEvent(PPU_LOG_WRITE, time);
+	writeByte(reg);
+	writeByte(data);
+}
+
+void PPURecorder::registerRead(uint64_t time, uint8_t reg, uint8_t data) {
+	writeEvent(PPU_LOG_READ, time);
+	writeByte(reg);
+	writeByte(data);
+}
+
+void PPURecorder::dmaWrite(uint64_t time, uint8_t data) {
+	writeEvent(PPU_LOG_DMA, time);
+	writeByte(data);
+}
+
+void PPURecorder::pagesChanged(uint64_t time) {
+	uint8_t **chr = mapper->getChrPages();
+	uint8_t **nametables = mapper->getNametablePages();
+
+	bool changed = false;
+	for (int i = 0; i < 8; i++)
+		changed |= chr[i] != chrPages[i];
+	for (int i = 0; i < 4; i++)
+		changed |= nametables[i] != nametablePages[i];
+
+	//Most mapper writes are PRG bank switches
+	if (!changed)
+		return;
+
+	uint16_t ids[12];
+	for (int i = 0; i < 8; i++) {
+		chrPages[i] = chr[i];
+		ids[i] = pageId(chr[i], i * PPU_PAGE_SIZE);
+	}
+	for (int i = 0; i < 4; i++) {
+		nametablePages[i] = nametables[i];
+		ids[8 + i] = pageId(nametables[i], 0x2000 + i * PPU_PAGE_SIZE);
+	}
+
+	writeEvent(PPU_LOG_MAP, time);
+	for (int i = 0; i < 12; i++) {
+		writeByte(ids[i] & 0xFF);
+		writeByte(ids[i] >> 8);
+	}
+}
+
+bool PPURecorder::frameEnded(uint64_t time, const Frame &frame, bool drawn) {
+	writeEvent(PPU_LOG_FRAME, time);
+	writeByte(drawn);
+	if (drawn) {
+		uint32_t hash = hashFrame(frame);
+		for (int i = 0; i < 4; i++)
+			writeByte(hash >> (8 * i));
+	}
+
+	flush();
+
+	framesLeft--;
+	return framesLeft <= 0;
+}
@@ -0,0 +1,105 @@
+#ifndef PPURECORDER_H
+#define PPURECORDER_H
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <vector>
+
+#define PPU_LOG_MAGIC		"IXPPULOG"
+#define PPU_LOG_VERSION		1
+
+//Events in a PPU log
+//Every event starts with its type and the number of PPU dots since the last
+//event as an unsigned LEB128 varint, followed by
+#define PPU_LOG_WRITE		0 //register, data		CPU write to a PPU register
+#define PPU_LOG_READ		1 //register, data		CPU read of a PPU register and the value it got
+#define PPU_LOG_DMA			2 //data				OAM DMA write to OAMDATA
+#define PPU_LOG_PAGE		3 //id (2), flags, 1KB	contents of a CHR/nametable page the first time it's mapped
+#define PPU_LOG_MAP			4 //8 CHR ids, 4 nametable ids (2 each)	pages mapped into the PPU's address space
+#define PPU_LOG_OAM			5 //256 bytes			OAM contents
+#define PPU_LOG_PALETTE		6 //32 bytes			palette RAM contents
+#define PPU_LOG_FRAME		7 //drawn, hash (4)		the console finished a frame, hash only if it was drawn
+#define PPU_LOG_END			8 //					end of the log
+
+//Flags for PPU_LOG_PAGE
+#define PPU_PAGE_WRITABLE	0x01
+
+//FNV-1a over the frame buffer, used to check replays against the recording
+#define PPU_LOG_HASH_START	2166136261u
+#define PPU_LOG_HASH_PRIME	16777619u
+
+class PPU;
+class Mapper;
+
+struct Frame;
+
+//Hash of a frame's palette indices as stored in the log
+uint32_t hashFrame(const Frame &frame);
+
+//Records everything the PPU sees from the rest of the console
+//
+//The log starts at power on with the contents of OAM, palette RAM and the
+//pages the mapper has mapped, after that the PPU only ever changes because
+//of register accesses and bank switches so replaying those on the same dots
+//reproduces it exactly. Pages are identified by where they live in memory,
+//the contents are only written the first time a page shows up and the
+//replay keeps its own copy up to date through PPUDATA writes.
+//Events are buffered and written out once a frame
+class PPURecorder {
+	std::ofstream file;
+
+	std::vector<uint8_t> buffer;
+
+	PPU *ppu;
+	Mapper *mapper;
+
+	//Dot the last event happened on
+	uint64_t lastTime;
+
+	//Frames left to record
+	int framesLeft;
+
+	std::map<uint8_t *, uint16_t> pageIds;
+
+	//Pages mapped when the last PPU_LOG_MAP was written
+	uint8_t *chrPages[8];
+	uint8_t *nametablePages[4];
+
+	void writeByte(uint8_t data);
+
+	void writeEvent(uint8_t type, uint64_t time);
+
+	//Writes the page out if it's new, returns its id
+	uint16_t pageId(uint8_t *page, uint16_t address);
+
+	//Whether writes to the CHR page mapped at address stick, checked by
+	//flipping a byte through the mapper and putting it back
+	bool chrWritable(uint16_t address);
+
+	void flush();
+
+public:
+	//Starts recording frames frames into filename
+	//The PPU has to be in its power on state
+	PPURecorder(const char *filename, PPU *ppu, Mapper *mapper, int frames);
+
+	//Ends the log and closes the file
+	~PPURecorder();
+
+	bool isOpen();
+
+	void registerWrite(uint64_t time, uint8_t reg, uint8_t data);
+
+	void registerRead(uint64_t time, uint8_t reg, uint8_t data);
+
+	void dmaWrite(uint64_t time, uint8_t data);
+
+	//Called after every mapper write, only logs anything if the pages moved
+	void pagesChanged(uint64_t time);
+
+	//Returns true once all of the frames have been recorded
+	bool frameEnded(uint64_t time, const Frame &frame, bool drawn);
+};
+
+#endif
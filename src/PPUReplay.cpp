@@ -0,0 +1,268 @@
+#include "PPUReplay.h"
+#include "PPURecorder.h"
+#include "Console.h"
+#include "PPU.h"
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+
+using namespace std;
+
+ReplayMapper::ReplayMapper() {
+	for (int i = 0; i < 8; i++)
+		chrIds[i] = 0;
+}
+
+ReplayMapper::~ReplayMapper() {
+	for (unsigned int i = 0; i < pages.size(); i++)
+		free(pages[i]);
+}
+
+void ReplayMapper::setPage(uint16_t id, uint8_t flags, const uint8_t *data) {
+	if (id >= pages.size()) {
+		pages.resize(id + 1, NULL);
+		writable.resize(id + 1, false);
+	}
+
+	if (!pages[id])
+		pages[id] = (uint8_t *) malloc(PPU_PAGE_SIZE);
+
+	memcpy(pages[id], data, PPU_PAGE_SIZE);
+	writable[id] = flags & PPU_PAGE_WRITABLE;
+}
+
+void ReplayMapper::mapPages(const uint16_t *ids) {
+	for (int i = 0; i < 8; i++) {
+		chrIds[i] = ids[i];
+		chrPages[i] = pages[ids[i]];
+	}
+	for (int i = 0; i < 4; i++)
+		nametablePages[i] = pages[ids[8 + i]];
+}
+
+uint8_t ReplayMapper::cpuRead(uint16_t) {
+	return 0x00;
+}
+
+uint8_t ReplayMapper::debugCpuRead(uint16_t) {
+	return 0x00;
+}
+
+void ReplayMapper::cpuWrite(uint16_t, uint8_t) {
+}
+
+uint8_t ReplayMapper::ppuRead(uint16_t address) {
+	if (address < 0x2000)
+		return chrPages[address >> 10][address & 0x03FF];
+	else
+		return nametablePages[(address >> 10) & 0x03][address & 0x03FF];
+}
+
+uint8_t ReplayMapper::debugPpuRead(uint16_t address) {
+	return ppuRead(address);
+}
+
+void ReplayMapper::ppuWrite(uint16_t address, uint8_t data) {
+	if (address < 0x2000) {
+		if (writable[chrIds[address >> 10]])
+			chrPages[address >> 10][address & 0x03FF] = data;
+	}
+	else {
+		nametablePages[(address >> 10) & 0x03][address & 0x03FF] = data;
+	}
+}
+
+PPUReplay::PPUReplay(const char *filename) {
+	loaded = false;
+
+	ifstream file(filename, ios::in | ios::binary | ios::ate);
+	if (!file.is_open())
+		return;
+
+	streampos size = file.tellg();
+	file.seekg(0, ios::beg);
+	log.resize(size);
+	file.read((char *)log.data(), size);
+	file.close();
+
+	loaded = decode();
+}
+
+bool PPUReplay::isLoaded() {
+	return loaded;
+}
+
+bool PPUReplay::decode() {
+	size_t magic = strlen(PPU_LOG_MAGIC);
+	if (log.size() < magic + 1 || memcmp(log.data(), PPU_LOG_MAGIC, magic) != 0 || log[magic] != PPU_LOG_VERSION)
+		return false;
+
+	//Bytes of payload after the timestamp for each event type
+	const size_t payloadSize[] = { 2, 2, 1, 3 + PPU_PAGE_SIZE, 24, 256, 32, 1, 0 };
+
+	size_t position = magic + 1;
+	uint64_t time = 0;
+
+	while (position < log.size()) {
+		PPUReplayEvent event;
+		event.type = log[position++];
+		if (event.type > PPU_LOG_END)
+			return false;
+
+		uint64_t delta = 0;
+		int shift = 0;
+		uint8_t byte;
+		do {
+			if (position >= log.size())
+				return false;
+			byte = log[position++];
+			delta |= (uint64_t)(byte & 0x7F) << shift;
+			shift += 7;
+		} while (byte & 0x80);
+
+		time += delta;
+		event.time = time;
+
+		size_t size = payloadSize[event.type];
+		//Drawn frames have a hash on the end
+		if (event.type == PPU_LOG_FRAME && position < log.size() && log[position])
+			size += 4;
+
+		if (position + size > log.size())
+			return false;
+
+		event.reg = size > 0 ? log[position] : 0;
+		event.data = size > 1 ? log[position + 1] : 0;
+		event.payload = &log[position];
+		position += size;
+
+		events.push_back(event);
+
+		if (event.type == PPU_LOG_END)
+			break;
+	}
+
+	return true;
+}
+
+//Little endian 16-bit value from the log
+static uint16_t read16(const uint8_t *data) {
+	return data[0] | (data[1] << 8);
+}
+
+PPUReplayResult PPUReplay::run(int timedFrom) {
+	PPUReplayResult result;
+	result.frames = 0;
+	result.framesChecked = 0;
+	result.frameMismatches = 0;
+	result.readMismatches = 0;
+	result.timedDots = 0;
+	result.timedSeconds = 0;
+	result.hash = PPU_LOG_HASH_START;
+	result.complete = false;
+
+	ReplayMapper *mapper = new ReplayMapper();
+
+	//The PPU reads the mapper's pages when it's created, so the power on
+	//pages have to be in place before the console is
+	unsigned int next = 0;
+	while (next < events.size() && events[next].time == 0 && events[next].type != PPU_LOG_MAP) {
+		if (events[next].type == PPU_LOG_PAGE)
+			mapper->setPage(read16(events[next].payload), events[next].payload[2], events[next].payload + 3);
+		next++;
+	}
+	if (next < events.size() && events[next].type == PPU_LOG_MAP) {
+		uint16_t ids[12];
+		for (int i = 0; i < 12; i++)
+			ids[i] = read16(events[next].payload + 2*i);
+		mapper->mapPages(ids);
+	}
+
+	Console *console = new Console(mapper);
+	PPU *ppu = console->getPPU();
+
+	uint64_t clock = 0;
+	uint64_t timedStart = 0;
+	bool timing = timedFrom == 0;
+	auto start = chrono::steady_clock::now();
+	chrono::steady_clock::duration checkTime(0);
+
+	for (unsigned int i = 0; i < events.size(); i++) {
+		PPUReplayEvent &event = events[i];
+
+		if (event.time > clock) {
+			ppu->runDots(event.time - clock);
+			clock = event.time;
+		}
+
+		switch (event.type) {
+			case PPU_LOG_WRITE:
+				ppu->writeRegister(event.reg, event.data);
+				break;
+			case PPU_LOG_READ:
+				if (ppu->readRegister(event.reg) != event.data)
+					result.readMismatches++;
+				break;
+			case PPU_LOG_DMA:
+				ppu->writeRegister(OAMDATA, event.reg);
+				break;
+			case PPU_LOG_PAGE:
+				mapper->setPage(read16(event.payload), event.payload[2], event.payload + 3);
+				break;
+			case PPU_LOG_MAP: {
+				uint16_t ids[12];
+				for (int j = 0; j < 12; j++)
+					ids[j] = read16(event.payload + 2*j);
+				ppu->pagesChanging();
+				mapper->mapPages(ids);
+				ppu->nametablesChanged();
+				break;
+			}
+			case PPU_LOG_OAM:
+				for (int j = 0; j < 256; j++)
+					ppu->debugOAMWrite(j, event.payload[j]);
+				break;
+			case PPU_LOG_PALETTE:
+				for (int j = 0; j < 32; j++)
+					ppu->debugPaletteWrite(j, event.payload[j]);
+				break;
+			case PPU_LOG_FRAME:
+				result.frames++;
+				if (event.payload[0]) {
+					//Checking isn't part of what's being timed
+					auto checkStart = chrono::steady_clock::now();
+
+					uint32_t recorded = event.payload[1] | (event.payload[2] << 8) | (event.payload[3] << 16) | ((uint32_t)event.payload[4] << 24);
+					uint32_t hash = hashFrame(ppu->getFrame());
+					result.framesChecked++;
+					if (hash != recorded)
+						result.frameMismatches++;
+					result.hash = (result.hash ^ hash) * PPU_LOG_HASH_PRIME;
+
+					checkTime += chrono::steady_clock::now() - checkStart;
+				}
+				if (!timing && result.frames == timedFrom) {
+					timing = true;
+					timedStart = clock;
+					start = chrono::steady_clock::now();
+					checkTime = chrono::steady_clock::duration(0);
+				}
+				break;
+			case PPU_LOG_END:
+				result.complete = true;
+				break;
+		}
+	}
+
+	if (timing) {
+		result.timedDots = clock - timedStart;
+		result.timedSeconds = chrono::duration<double>(chrono::steady_clock::now() - start - checkTime).count();
+	}
+
+	delete console;
+	delete mapper;
+
+	return result;
+}
@@ -0,0 +1,98 @@
+#ifndef PPUREPLAY_H
+#define PPUREPLAY_H
+
+#include "Mapper.h"
+
+#include <cstdint>
+#include <vector>
+
+//Stands in for the cartridge when replaying a PPU log
+//
+//Holds a copy of every page the log has shown so far and maps them where
+//the log says they were. CHR pages the real mapper wouldn't write to stay
+//read-only here too. The CPU side isn't connected to anything
+class ReplayMapper : public Mapper {
+	std::vector<uint8_t *> pages;
+	std::vector<bool> writable;
+
+	//Page ids currently mapped into each CHR slot
+	uint16_t chrIds[8];
+
+public:
+	ReplayMapper();
+
+	~ReplayMapper();
+
+	//Adds page id with the given contents
+	void setPage(uint16_t id, uint8_t flags, const uint8_t *data);
+
+	//Maps 8 CHR pages then 4 nametables by id
+	void mapPages(const uint16_t *ids);
+
+	uint8_t cpuRead(uint16_t address);
+
+	uint8_t debugCpuRead(uint16_t address);
+
+	void cpuWrite(uint16_t address, uint8_t data);
+
+	uint8_t ppuRead(uint16_t address);
+
+	uint8_t debugPpuRead(uint16_t address);
+
+	void ppuWrite(uint16_t address, uint8_t data);
+};
+
+//One decoded log event, payload points into the log for the bulky ones
+struct PPUReplayEvent {
+	uint64_t time;
+	uint8_t type;
+	uint8_t reg;
+	uint8_t data;
+	const uint8_t *payload;
+};
+
+struct PPUReplayResult {
+	//Frames the log covered and how many of those had a hash to check
+	int frames;
+	int framesChecked;
+
+	//Drawn frames that didn't hash the same as when they were recorded
+	int frameMismatches;
+
+	//Register reads that got a different value than when recorded
+	int readMismatches;
+
+	//Dots run and time taken from the first timed frame on
+	uint64_t timedDots;
+	double timedSeconds;
+
+	//Every frame hash combined, to compare runs against each other
+	uint32_t hash;
+
+	//False if the log ended without a PPU_LOG_END event
+	bool complete;
+};
+
+//Drives a PPU on its own from a log written by PPURecorder
+//
+//The whole log is read and decoded up front so timing a run only measures
+//the PPU. Every run starts from a fresh console so they can be repeated
+class PPUReplay {
+	std::vector<uint8_t> log;
+	std::vector<PPUReplayEvent> events;
+
+	bool loaded;
+
+	bool decode();
+
+public:
+	PPUReplay(const char *filename);
+
+	//False if the file couldn't be read or isn't a PPU log
+	bool isLoaded();
+
+	//Replays the log, timing starts at the end of frame timedFrom
+	PPUReplayResult run(int timedFrom);
+};
+
+#endif
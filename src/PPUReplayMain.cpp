@@ -0,0 +1,63 @@
+#include "PPUReplay.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+//Replays a PPU log made with Console::recordPPU and times it
+//
+//	ppureplay <log> [--from N] [--runs N]
+//
+//--from skips timing the first N frames so a benchmark can start at an
+//interesting part of the game, --runs repeats the whole thing. Every frame
+//is checked against the hash it had when it was recorded, the exit status
+//is 1 if any of them or any register read came out differently
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		cout << "Usage: ppureplay <log> [--from N] [--runs N]" << endl;
+		return 2;
+	}
+
+	int from = 0;
+	int runs = 1;
+	for (int i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+			from = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+			runs = atoi(argv[++i]);
+		else
+			cout << "Warning: unknown option " << argv[i] << endl;
+	}
+
+	PPUReplay replay(argv[1]);
+	if (!replay.isLoaded()) {
+		cout << "Error: couldn't load PPU log " << argv[1] << endl;
+		return 2;
+	}
+
+	bool mismatch = false;
+
+	for (int run = 0; run < runs; run++) {
+		PPUReplayResult result = replay.run(from);
+
+		cout << "Run " << run + 1 << ": " << result.frames << " frames, "
+			<< result.framesChecked - result.frameMismatches << "/" << result.framesChecked << " frames match, "
+			<< result.readMismatches << " read mismatches, hash " << hex << result.hash << dec << endl;
+
+		if (result.timedSeconds > 0) {
+			cout << "	" << result.timedDots << " dots in " << result.timedSeconds * 1000 << " ms, "
+				<< result.timedDots / result.timedSeconds / 1000000 << "M dots/s, "
+				<< (result.frames - from) / result.timedSeconds << " frames/s" << endl;
+		}
+
+		if (!result.complete)
+			cout << "Warning: log ends early, the recording may not have finished" << endl;
+
+		if (result.frameMismatches || result.readMismatches)
+			mismatch = true;
+	}
+
+	return mismatch ? 1 : 0;
+}
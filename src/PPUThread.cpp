@@ -0,0 +1,109 @@
+#include "PPUThread.h"
+#include "PPU.h"
+
+#include <chrono>
+
+using namespace std;
+
+//Number of times the thread yields with nothing to do before it starts sleeping
+#define PPU_THREAD_IDLE_SPINS	1000
+
+PPUThread::PPUThread(PPU *ppu, uint64_t start) {
+	this->ppu = ppu;
+
+	queueHead = 0;
+	queueTail = 0;
+
+	limit = start;
+	clock = start;
+
+	frameEnded = false;
+
+	running = true;
+
+	thread = std::thread(&PPUThread::run, this);
+}
+
+PPUThread::~PPUThread() {
+	running = false;
+	thread.join();
+}
+
+void PPUThread::applyEvent(PPUEvent &event) {
+	switch (event.type) {
+		case PPU_EVENT_WRITE:
+			ppu->writeRegister(event.reg, event.data);
+			break;
+		case PPU_EVENT_DMA:
+			ppu->oamDMAStarted();
+			break;
+	}
+}
+
+void PPUThread::run() {
+	int idle = 0;
+
+	while (running.load(memory_order_acquire)) {
+		uint64_t target = limit.load(memory_order_acquire);
+		uint64_t now = clock.load(memory_order_relaxed);
+
+		//Apply everything that was written before the PPU got to where it is now
+		uint32_t head = queueHead.load(memory_order_relaxed);
+		uint32_t tail = queueTail.load(memory_order_acquire);
+		while (head != tail && queue[head & (PPU_EVENT_QUEUE_SIZE - 1)].time <= now) {
+			applyEvent(queue[head & (PPU_EVENT_QUEUE_SIZE - 1)]);
+			head++;
+		}
+		queueHead.store(head, memory_order_release);
+
+		//Run up to the next event or as far as we're allowed to
+		uint64_t end = target;
+		if (head != tail && queue[head & (PPU_EVENT_QUEUE_SIZE - 1)].time < end)
+			end = queue[head & (PPU_EVENT_QUEUE_SIZE - 1)].time;
+
+		if (end > now) {
+			if (ppu->runDots(end - now))
+				frameEnded.store(true, memory_order_relaxed);
+			clock.store(end, memory_order_release);
+			idle = 0;
+		}
+		else if (head == tail) {
+			//Nothing to do, back off so we don't eat a core while the console is paused
+			if (idle < PPU_THREAD_IDLE_SPINS) {
+				idle++;
+				this_thread::yield();
+			}
+			else {
+				this_thread::sleep_for(chrono::microseconds(50));
+			}
+		}
+	}
+}
+
+void PPUThread::push(uint64_t time, uint8_t type, uint8_t reg, uint8_t data) {
+	uint32_t tail = queueTail.load(memory_order_relaxed);
+
+	while (tail - queueHead.load(memory_order_acquire) >= PPU_EVENT_QUEUE_SIZE)
+		this_thread::yield();
+
+	PPUEvent &event = queue[tail & (PPU_EVENT_QUEUE_SIZE - 1)];
+	event.time = time;
+	event.type = type;
+	event.reg = reg;
+	event.data = data;
+
+	queueTail.store(tail + 1, memory_order_release);
+}
+
+void PPUThread::advance(uint64_t time) {
+	limit.store(time, memory_order_release);
+}
+
+bool PPUThread::wait() {
+	uint64_t target = limit.load(memory_order_relaxed);
+
+	while (clock.load(memory_order_acquire) < target || queueHead.load(memory_order_acquire) != queueTail.load(memory_order_relaxed))
+		this_thread::yield();
+
+	return frameEnded.exchange(false, memory_order_relaxed);
+}
@@ -0,0 +1,76 @@
+#ifndef PPUTHREAD_H
+#define PPUTHREAD_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+
+//Number of events the queue can hold, must be a power of 2
+#define PPU_EVENT_QUEUE_SIZE	4096
+
+//Kinds of events the CPU side can send the PPU thread
+#define PPU_EVENT_WRITE			0 //writeRegister(reg, data)
+#define PPU_EVENT_DMA			1 //oamDMAStarted()
+
+class PPU;
+
+//Something the CPU did that the PPU has to see, time is the number of
+//PPU dots that have to have run before it is applied
+struct PPUEvent {
+	uint64_t time;
+	uint8_t type;
+	uint8_t reg;
+	uint8_t data;
+};
+
+//Runs the PPU on its own thread
+//
+//The console is the only producer and the thread the only consumer, so the
+//queue only needs the two indices to be atomic. The console publishes how far
+//the PPU is allowed to run with advance(), the thread runs dots up to that
+//point applying events as it reaches their timestamps. Anything that needs
+//the PPU state on the CPU side calls wait() first, once it returns the thread
+//is idle until the next advance() and the PPU can be used directly
+class PPUThread {
+	PPU *ppu;
+
+	std::thread thread;
+
+	PPUEvent queue[PPU_EVENT_QUEUE_SIZE];
+
+	std::atomic<uint32_t> queueHead;
+	std::atomic<uint32_t> queueTail;
+
+	//Dots the PPU is allowed to run up to, written by the console
+	std::atomic<uint64_t> limit;
+
+	//Dots the PPU has run, written by the thread
+	std::atomic<uint64_t> clock;
+
+	//Set by the thread when the frame ends, cleared by wait()
+	std::atomic<bool> frameEnded;
+
+	std::atomic<bool> running;
+
+	void run();
+
+	void applyEvent(PPUEvent &event);
+
+public:
+	//start is the number of dots the PPU has already run
+	PPUThread(PPU *ppu, uint64_t start);
+
+	~PPUThread();
+
+	//Queues an event, blocks if the queue is full
+	void push(uint64_t time, uint8_t type, uint8_t reg, uint8_t data);
+
+	//Lets the PPU run up to the given number of dots
+	void advance(uint64_t time);
+
+	//Waits for the PPU to run up to the limit and apply every queued event
+	//Returns true if a frame ended since the last wait
+	bool wait();
+};
+
+#endif
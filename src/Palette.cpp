@@ -0,0 +1,78 @@
+#include "Palette.h"
+
+						 //00				  01				 02					03
+const uint8_t masterPalette[64][3] = { {0x65, 0x65, 0x65}, {0x00, 0x2D, 0x69}, {0x13, 0x1F, 0x7F}, {0x3C, 0x13, 0x7C},
+						 //04				  05				 06					07
+							{0x60, 0x0B, 0x62}, {0x73, 0x0A, 0x37}, {0x71, 0x0F, 0x07}, {0x5A, 0x1A, 0x00},
+						 //08				  09				 0A					0B
+							{0x34, 0x28, 0x00}, {0x0B, 0x34, 0x00}, {0x00, 0x3C, 0x00}, {0x00, 0x3D, 0x10},
+						 //0C				  0D				 0E					0F
+							{0x00, 0x38, 0x40}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00},
+						 //10				  11				 12					13
+							{0xAE, 0xAE, 0xAE}, {0x0F, 0x63, 0xB3}, {0x40, 0x51, 0xD0}, {0x78, 0x41, 0xCC},
+						 //14				  15				 16					17
+							{0xA7, 0x36, 0xA9}, {0xC0, 0x34, 0x70}, {0xBD, 0x3C, 0x30}, {0x9F, 0x4A, 0x00},
+						 //18				  19				 1A					1B
+							{0x6D, 0x5C, 0x00}, {0x36, 0x6D, 0x00}, {0x07, 0x77, 0x04}, {0x00, 0x79, 0x3D},
+						 //1C				  1D				 1E					1F
+							{0x00, 0x72, 0x7D}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00},
+						 //20				  21				 22					23
+							{0xFE, 0xFE, 0xFF}, {0x5D, 0xB3, 0xFF}, {0x8F, 0xA1, 0xFF}, {0xC8, 0x90, 0xFF},
+						 //24				  25				 26					27
+							{0xF7, 0x85, 0xFA}, {0xFF, 0x83, 0xC0}, {0xFF, 0x8B, 0x7F}, {0xEF, 0x9A, 0x49},
+						 //28				  29				 2A					2B
+							{0xBD, 0xAC, 0x2C}, {0x85, 0xBC, 0x2F}, {0x55, 0xC7, 0x53}, {0x3C, 0xC9, 0x8C},
+						 //2C				  2D				 2E					2F
+							{0x3E, 0xC2, 0xCD}, {0x4E, 0x4E, 0x4E}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00},
+						 //30				  31				 32					33
+							{0xFE, 0xFE, 0xFE}, {0xBC, 0xDF, 0xFF}, {0xD1, 0xD8, 0xFF}, {0xE8, 0xD1, 0xFF},
+						 //34				  35				 36					37
+							{0xFB, 0xCD, 0xFD}, {0xFF, 0xCC, 0xE5}, {0xFF, 0xCF, 0xCA}, {0xF8, 0xD5, 0xB4},
+						 //38				  39				 3A					3B
+							{0xE4, 0xDC, 0xA8}, {0xCC, 0xE3, 0xA9}, {0xB9, 0xE8, 0xB8}, {0xAE, 0xE8, 0xD0},
+						 //3C				  3D				 3E					3F
+							{0xAF, 0xE5, 0xEA}, {0xB6, 0xB6, 0xB6}, {0x00, 0x00, 0x00}, {0x00, 0x00, 0x00} };
+
+uint32_t packPixel(uint8_t r, uint8_t g, uint8_t b, uint8_t format) {
+	switch (format) {
+		case PIXEL_FORMAT_ARGB:
+			return 0xFF000000 | (r << 16) | (g << 8) | b;
+		case PIXEL_FORMAT_BGRA:
+			return (b << 24) | (g << 16) | (r << 8) | 0xFF;
+		case PIXEL_FORMAT_ABGR:
+			return 0xFF000000 | (b << 16) | (g << 8) | r;
+		default: //PIXEL_FORMAT_RGBA
+			return (r << 24) | (g << 16) | (b << 8) | 0xFF;
+	}
+}
+
+void buildOutputPalette(uint32_t *lut, uint8_t format) {
+	if (format == PIXEL_FORMAT_INDEX) {
+		for (int i = 0; i < OUTPUT_PALETTE_SIZE; i++)
+			lut[i] = i;
+		return;
+	}
+
+	for (int emphasis = 0; emphasis < 8; emphasis++) {
+		//A channel is darkened once for every emphasis bit that isn't its own
+		double rScale = 1.0;
+		double gScale = 1.0;
+		double bScale = 1.0;
+		if (emphasis & 0x01) {
+			gScale *= EMPHASIS_ATTENUATION;
+			bScale *= EMPHASIS_ATTENUATION;
+		}
+		if (emphasis & 0x02) {
+			rScale *= EMPHASIS_ATTENUATION;
+			bScale *= EMPHASIS_ATTENUATION;
+		}
+		if (emphasis & 0x04) {
+			rScale *= EMPHASIS_ATTENUATION;
+			gScale *= EMPHASIS_ATTENUATION;
+		}
+
+		for (int i = 0; i < 64; i++) {
+			lut[(emphasis << 6) | i] = packPixel(masterPalette[i][0] * rScale, masterPalette[i][1] * gScale, masterPalette[i][2] * bScale, format);
+		}
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <cstdint>
+
+//Byte order of a 32-bit output pixel, from most significant byte to least
+//RGBA matches an SDL surface/texture with masks R 0xFF000000 ... A 0x000000FF
+//ARGB matches SDL_PIXELFORMAT_ARGB8888
+#define PIXEL_FORMAT_RGBA	0x00
+#define PIXEL_FORMAT_ARGB	0x01
+#define PIXEL_FORMAT_BGRA	0x02
+#define PIXEL_FORMAT_ABGR	0x03
+
+//Not a colour at all, each pixel is just its EEEPPPPPP output palette index
+//(see buildOutputPalette), for post-processing like the NTSC filter
+#define PIXEL_FORMAT_INDEX	0x04
+
+//Each emphasis bit darkens the two colour channels it doesn't emphasize
+//by roughly this much. Setting all three darkens everything
+#define EMPHASIS_ATTENUATION	0.746
+
+//Number of entries in a full output lookup table (64 colours * 8 emphasis combinations)
+#define OUTPUT_PALETTE_SIZE	512
+
+//The NES doesn't actually output RGB, so every emulator ends up with its own
+//idea of what the 64 colours look like. These are stored as R, G, B
+extern const uint8_t masterPalette[64][3];
+
+//Packs an RGB triple into a 32-bit pixel in the given format with full alpha
+uint32_t packPixel(uint8_t r, uint8_t g, uint8_t b, uint8_t format);
+
+//Fills lut with OUTPUT_PALETTE_SIZE entries indexed by
+//	EEEPPPPPP
+//	|||++++++-- P: palette index
+//	+++-------- E: emphasis bits (bit 0: red, bit 1: green, bit 2: blue)
+//so that the emphasis bits of PPUMASK can be shifted straight into place
+void buildOutputPalette(uint32_t *lut, uint8_t format);
+
+#endif
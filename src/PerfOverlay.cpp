@@ -0,0 +1,195 @@
+#include "PerfOverlay.h"
+#include "FramePacer.h"
+
+#include <cstdio>
+#include <chrono>
+
+using namespace std;
+
+//Frame time graph along the bottom, tall enough for two frames' worth
+#define GRAPH_X			4
+#define GRAPH_Y			30
+#define GRAPH_HEIGHT	40
+
+//Text is 3x5, on a 4x7 grid
+#define CHAR_ADVANCE	4
+#define LINE_ADVANCE	7
+
+#define COLOUR_BACKGROUND	0x000000B0
+#define COLOUR_TEXT			0xFFFFFFFF
+#define COLOUR_CPU			0x4080FFFF
+#define COLOUR_PPU			0x40FF60FF
+#define COLOUR_APU			0xFFE040FF
+#define COLOUR_BUDGET		0xFF4040FF
+
+//ASCII space to Z, 5 rows of 3 pixels from the top left, the top left pixel
+//is bit 14. Lower case is drawn as upper case and anything else as a space
+static const uint16_t font[] = {
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x52A5, 0x0000, 0x0000,
+	0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x01C0, 0x0002, 0x12A4,
+	0x7B6F, 0x2C97, 0x73E7, 0x72CF, 0x5BC9, 0x79CF, 0x79EF, 0x7292,
+	0x7BEF, 0x7BCF, 0x0410, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+	0x0000, 0x2BED, 0x6BAE, 0x3923, 0x6B6E, 0x79A7, 0x79A4, 0x396B,
+	0x5BED, 0x7497, 0x126A, 0x5BAD, 0x4927, 0x5FED, 0x6B6D, 0x2B6A,
+	0x6BA4, 0x2B73, 0x6BAD, 0x388E, 0x7492, 0x5B6F, 0x5B6A, 0x5BFD,
+	0x5AAD, 0x5A92, 0x72A7
+};
+
+PerfOverlay::PerfOverlay() {
+	emulatedCount = 0;
+	presentedCount = 0;
+	videoQueue = 0;
+	videoQueueSize = 0;
+	governorLevel = -1;
+}
+
+double PerfOverlay::now() {
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void PerfOverlay::emulatedFrame(const FrameTiming &timing) {
+	double time = now();
+
+	lock_guard<mutex> guard(lock);
+	history[emulatedCount % PERF_HISTORY_FRAMES] = timing;
+	emulatedTimes[emulatedCount % PERF_HISTORY_FRAMES] = time;
+	emulatedCount++;
+}
+
+void PerfOverlay::presentedFrame(double convert, double present) {
+	double time = now();
+
+	lock_guard<mutex> guard(lock);
+	convertTimes[presentedCount % PERF_AVERAGE_FRAMES] = convert;
+	presentTimes[presentedCount % PERF_AVERAGE_FRAMES] = present;
+	presentedTimes[presentedCount % PERF_AVERAGE_FRAMES] = time;
+	presentedCount++;
+}
+
+void PerfOverlay::setVideoQueue(int depth, int size) {
+	lock_guard<mutex> guard(lock);
+	videoQueue = depth;
+	videoQueueSize = size;
+}
+
+void PerfOverlay::setGovernorLevel(int level) {
+	lock_guard<mutex> guard(lock);
+	governorLevel = level;
+}
+
+void PerfOverlay::fillRect(uint32_t *pixels, int pitch, int x, int y, int width, int height, uint32_t colour) {
+	for (int row = y; row < y + height; row++) {
+		uint32_t *line = (uint32_t *)((uint8_t *) pixels + row * pitch);
+		for (int column = x; column < x + width; column++)
+			line[column] = colour;
+	}
+}
+
+void PerfOverlay::drawText(uint32_t *pixels, int pitch, int x, int y, const char *text, uint32_t colour) {
+	for (; *text && x + 3 <= PERF_OVERLAY_WIDTH; text++, x += CHAR_ADVANCE) {
+		char c = *text;
+		if (c >= 'a' && c <= 'z')
+			c -= 'a' - 'A';
+		if (c < ' ' || c > 'Z')
+			c = ' ';
+
+		uint16_t glyph = font[c - ' '];
+		for (int row = 0; row < 5; row++) {
+			uint32_t *line = (uint32_t *)((uint8_t *) pixels + (y + row) * pitch);
+			for (int column = 0; column < 3; column++) {
+				if (glyph & (0x4000 >> (row * 3 + column)))
+					line[x + column] = colour;
+			}
+		}
+	}
+}
+
+void PerfOverlay::draw(uint32_t *pixels, int pitch) {
+	FrameTiming graph[PERF_HISTORY_FRAMES];
+	int graphFrames;
+	FrameTiming average = { 0, 0, 0, 0 };
+	double emulatedRate = 0;
+	double presentedRate = 0;
+	double convert = 0;
+	double present = 0;
+	int depth;
+	int size;
+	int level;
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		graphFrames = emulatedCount < PERF_HISTORY_FRAMES ? emulatedCount : PERF_HISTORY_FRAMES;
+		for (int i = 0; i < graphFrames; i++)
+			graph[i] = history[(emulatedCount - graphFrames + i) % PERF_HISTORY_FRAMES];
+
+		int frames = emulatedCount < PERF_AVERAGE_FRAMES ? emulatedCount : PERF_AVERAGE_FRAMES;
+		for (int i = 0; i < frames; i++) {
+			FrameTiming &timing = history[(emulatedCount - 1 - i) % PERF_HISTORY_FRAMES];
+			average.cpu += timing.cpu / frames;
+			average.ppu += timing.ppu / frames;
+			average.apu += timing.apu / frames;
+			average.sleep += timing.sleep / frames;
+		}
+		if (frames > 1) {
+			double span = emulatedTimes[(emulatedCount - 1) % PERF_HISTORY_FRAMES] - emulatedTimes[(emulatedCount - frames) % PERF_HISTORY_FRAMES];
+			emulatedRate = (frames - 1) / span;
+		}
+
+		frames = presentedCount < PERF_AVERAGE_FRAMES ? presentedCount : PERF_AVERAGE_FRAMES;
+		for (int i = 0; i < frames; i++) {
+			convert += convertTimes[(presentedCount - 1 - i) % PERF_AVERAGE_FRAMES] / frames;
+			present += presentTimes[(presentedCount - 1 - i) % PERF_AVERAGE_FRAMES] / frames;
+		}
+		if (frames > 1) {
+			double span = presentedTimes[(presentedCount - 1) % PERF_AVERAGE_FRAMES] - presentedTimes[(presentedCount - frames) % PERF_AVERAGE_FRAMES];
+			presentedRate = (frames - 1) / span;
+		}
+
+		depth = videoQueue;
+		size = videoQueueSize;
+		level = governorLevel;
+	}
+
+	fillRect(pixels, pitch, 0, 0, PERF_OVERLAY_WIDTH, PERF_OVERLAY_HEIGHT, COLOUR_BACKGROUND);
+
+	char text[40];
+	snprintf(text, sizeof(text), "EMU %.1f HOST %.1f FPS", emulatedRate, presentedRate);
+	drawText(pixels, pitch, 2, 2, text, COLOUR_TEXT);
+	snprintf(text, sizeof(text), "CPU %.2f PPU %.2f APU %.2f MS", average.cpu, average.ppu, average.apu);
+	drawText(pixels, pitch, 2, 2 + LINE_ADVANCE, text, COLOUR_TEXT);
+	snprintf(text, sizeof(text), "CONV %.2f PRES %.2f SLEEP %.2f", convert, present, average.sleep);
+	drawText(pixels, pitch, 2, 2 + 2*LINE_ADVANCE, text, COLOUR_TEXT);
+
+	//There's no sound output yet so there's never an audio queue
+	int length;
+	if (size)
+		length = snprintf(text, sizeof(text), "VIDEO Q %d/%d AUDIO Q -", depth, size);
+	else
+		length = snprintf(text, sizeof(text), "VIDEO Q - AUDIO Q -");
+	if (level >= 0)
+		snprintf(text + length, sizeof(text) - length, " GOV %d", level);
+	drawText(pixels, pitch, 2, 2 + 3*LINE_ADVANCE, text, COLOUR_TEXT);
+
+	//One column a frame, newest on the right, CPU at the bottom then PPU
+	//then APU. The line across the middle is one frame at the NES's rate
+	double pixelsPerMs = GRAPH_HEIGHT / (2 * 1000 / NES_FRAME_RATE);
+	for (int i = 0; i < graphFrames; i++) {
+		int x = GRAPH_X + PERF_HISTORY_FRAMES - graphFrames + i;
+		int bottom = GRAPH_Y + GRAPH_HEIGHT;
+
+		double parts[3] = { graph[i].cpu, graph[i].ppu, graph[i].apu };
+		uint32_t colours[3] = { COLOUR_CPU, COLOUR_PPU, COLOUR_APU };
+		double total = 0;
+		for (int part = 0; part < 3; part++) {
+			int from = bottom - (int)(total * pixelsPerMs + 0.5);
+			total += parts[part];
+			int to = bottom - (int)(total * pixelsPerMs + 0.5);
+			if (to < GRAPH_Y)
+				to = GRAPH_Y;
+			if (to < from)
+				fillRect(pixels, pitch, x, to, 1, from - to, colours[part]);
+		}
+	}
+	fillRect(pixels, pitch, GRAPH_X, GRAPH_Y + GRAPH_HEIGHT / 2, PERF_HISTORY_FRAMES, 1, COLOUR_BUDGET);
+}
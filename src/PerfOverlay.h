@@ -0,0 +1,83 @@
+#ifndef PERFOVERLAY_H
+#define PERFOVERLAY_H
+
+#include <cstdint>
+#include <mutex>
+
+//Size of the image draw() makes
+#define PERF_OVERLAY_WIDTH		128
+#define PERF_OVERLAY_HEIGHT		72
+
+//Frames shown in the frame time graph
+#define PERF_HISTORY_FRAMES		120
+
+//Frames the numbers are averaged over
+#define PERF_AVERAGE_FRAMES		60
+
+//Where the time for one emulated frame went, in ms
+struct FrameTiming {
+	double cpu;
+	double ppu;
+	double apu;
+
+	//Waiting for the frame's deadline
+	double sleep;
+};
+
+//Frame rates, where the time goes and how backed up the queues are, drawn
+//as a small image for the frontend to put over the picture
+//
+//The emulation thread adds a FrameTiming for every frame it runs and the UI
+//thread adds its own times for every frame it presents, then draws the
+//overlay. Both only hold the lock long enough to copy a few numbers
+class PerfOverlay {
+	std::mutex lock;
+
+	//Last PERF_HISTORY_FRAMES emulated frames, emulatedCount is the total
+	FrameTiming history[PERF_HISTORY_FRAMES];
+	double emulatedTimes[PERF_HISTORY_FRAMES];
+	uint64_t emulatedCount;
+
+	//Last PERF_AVERAGE_FRAMES presented frames
+	double convertTimes[PERF_AVERAGE_FRAMES];
+	double presentTimes[PERF_AVERAGE_FRAMES];
+	double presentedTimes[PERF_AVERAGE_FRAMES];
+	uint64_t presentedCount;
+
+	//Frames sitting in the capture queue and how many it holds, 0 and 0
+	//if nothing's being captured
+	int videoQueue;
+	int videoQueueSize;
+
+	//FrameGovernor's level, -1 if there isn't one
+	int governorLevel;
+
+	//Seconds since some fixed point
+	static double now();
+
+	void drawText(uint32_t *pixels, int pitch, int x, int y, const char *text, uint32_t colour);
+
+	void fillRect(uint32_t *pixels, int pitch, int x, int y, int width, int height, uint32_t colour);
+
+public:
+	PerfOverlay();
+
+	//Called by the emulation thread once a frame
+	void emulatedFrame(const FrameTiming &timing);
+
+	//Called by the UI thread once a present, convert is the time taken
+	//turning the frame into the texture and present the time presenting it
+	void presentedFrame(double convert, double present);
+
+	//Frames waiting in the capture queue out of how many it can hold
+	void setVideoQueue(int depth, int size);
+
+	//How far the governor has had to cut back, see FrameGovernor
+	void setGovernorLevel(int level);
+
+	//Draws the overlay as PERF_OVERLAY_WIDTH x PERF_OVERLAY_HEIGHT pixels
+	//in PIXEL_FORMAT_RGBA, the background is partly transparent
+	void draw(uint32_t *pixels, int pitch);
+};
+
+#endif
@@ -275,10 +275,10 @@ RomImage::RomImage(string path, bool forceload) {
 }
 
 RomImage::~RomImage() {
-	delete trainer;
-	delete prgROM;
-	delete chrROM;
-	delete miscROM;
+	free(trainer);
+	free(prgROM);
+	free(chrROM);
+	free(miscROM);
 }
 
 //Returns the mapper object specified by the ROM
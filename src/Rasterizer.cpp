@@ -0,0 +1,274 @@
+#include "Rasterizer.h"
+#include "PPU.h"
+
+#include <cstring>
+
+using namespace std;
+
+Rasterizer::Rasterizer(int threads, const uint32_t (*lineActions)[341]) {
+	log = NULL;
+	firstLine = 0;
+	lastLine = 0;
+	frame = NULL;
+	videoOutput = NULL;
+	videoPitch = 0;
+	outputPalette = NULL;
+	this->lineActions = lineActions;
+
+	generation = 0;
+	stopping = false;
+
+	nextLine = 0;
+	working = 0;
+
+	memset(lastPixels, 0, 256);
+
+	for (int i = 0; i < threads; i++)
+		workers.push_back(thread(&Rasterizer::work, this));
+}
+
+Rasterizer::~Rasterizer() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+void Rasterizer::work() {
+	uint64_t seen = 0;
+
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+
+		drawLines();
+		working.fetch_sub(1, memory_order_release);
+	}
+}
+
+void Rasterizer::drawLines() {
+	int line;
+	while ((line = nextLine.fetch_add(1)) < lastLine) {
+		if (!log[line].partial)
+			drawLine(line, NULL);
+	}
+}
+
+void Rasterizer::start(ScanlineLog *log, int first, int last, Frame *frame, uint32_t *videoOutput, int videoPitch, uint32_t *outputPalette) {
+	{
+		lock_guard<mutex> guard(lock);
+		this->log = log;
+		firstLine = first;
+		lastLine = last;
+		this->frame = frame;
+		this->videoOutput = videoOutput;
+		this->videoPitch = videoPitch;
+		this->outputPalette = outputPalette;
+		nextLine = first;
+		working = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+}
+
+void Rasterizer::finish() {
+	drawLines();
+
+	//Every worker has to be back waiting before the next start() moves
+	//nextLine, otherwise one still on its way out could take a line from it
+	while (working.load(memory_order_acquire) > 0)
+		this_thread::yield();
+
+	//Partial lines depend on the one above, so these go in order
+	for (int line = firstLine; line < lastLine; line++) {
+		if (log[line].partial)
+			drawLine(line, line == 0 ? lastPixels : log[line - 1].pixels);
+	}
+
+	if (lastLine == VISIBLE_LINES)
+		memcpy(lastPixels, log[VISIBLE_LINES - 1].pixels, 256);
+}
+
+static uint8_t reverseBits(uint8_t n) {
+	n = ((n & 0xF0) >> 4) | ((n & 0x0F) << 4);
+	n = ((n & 0xCC) >> 2) | ((n & 0x33) << 2);
+	n = ((n & 0xAA) >> 1) | ((n & 0x55) << 1);
+	return n;
+}
+
+//Same fetches as PPU::retrieveNameTableByte, retrieveAttrTableBits and
+//retrievePatternTableByte, and the same coarse X increment
+void runBackground(const ScanlineLog &entry, const uint32_t *actions, int lastDot, BackgroundState &bg, uint8_t *bgPixel) {
+	for (int dot = entry.firstDot; dot <= lastDot; dot++) {
+		uint32_t action = actions[dot];
+
+		//The first dot's fetch happened before the line was logged
+		if (dot == entry.firstDot)
+			action &= ~(DOT_BG_NT | DOT_BG_AT | DOT_BG_PT_LOW | DOT_BG_PT_HIGH);
+
+		if (action & DOT_BG_NT) {
+			bg.currentPattern = entry.nametablePages[(bg.accessAddress >> 10) & 0x03][bg.accessAddress & 0x03FF];
+		}
+		else if (action & DOT_BG_AT) {
+			uint8_t attr = entry.nametablePages[(bg.accessAddress >> 10) & 0x03][0x03C0 | ((bg.accessAddress >> 4) & 0x38) | ((bg.accessAddress >> 2) & 0x07)];
+			bg.attrLatchBuffer = (attr >> (((bg.accessAddress >> 4) & 0x04) | (bg.accessAddress & 0x02))) & 0x03;
+		}
+		else if (action & (DOT_BG_PT_LOW | DOT_BG_PT_HIGH)) {
+			bool plane = action & DOT_BG_PT_HIGH;
+			uint16_t address = ((bg.control1 & CONTROL1_BG_PT) << 8) | (bg.currentPattern << 4) | (plane << 3) | (bg.accessAddress >> 12);
+			uint8_t pt = reverseBits(entry.chrPages[address >> 10][address & 0x03FF]);
+
+			if (!plane) {
+				bg.patternBuffer0 = pt;
+			}
+			else {
+				bg.patternBuffer1 = pt;
+
+				if ((bg.accessAddress & 0x001F) == 0x001F)
+					bg.accessAddress = (bg.accessAddress & 0xFFE0) ^ 0x0400;
+				else
+					bg.accessAddress++;
+			}
+		}
+
+		if ((action & DOT_PIXEL) && dot <= 256) {
+			uint16_t xSelector = 0x01 << bg.fineX;
+			bgPixel[dot - 1] = (((bg.attrShift1 & xSelector) != 0) << 3) | (((bg.attrShift0 & xSelector) != 0) << 2) | (((bg.patternShift1 & xSelector) != 0) << 1) | ((bg.patternShift0 & xSelector) != 0);
+		}
+
+		if (action & DOT_SHIFT) {
+			bg.patternShift0 >>= 1;
+			bg.patternShift1 >>= 1;
+
+			if (action & DOT_RELOAD) {
+				bg.patternShift0 |= bg.patternBuffer0 << 8;
+				bg.patternShift1 |= bg.patternBuffer1 << 8;
+				bg.attrLatch = bg.attrLatchBuffer;
+			}
+
+			bg.attrShift0 >>= 1;
+			bg.attrShift0 |= (bg.attrLatch & 0x01) << 7;
+			bg.attrShift1 >>= 1;
+			bg.attrShift1 |= (bg.attrLatch & 0x02) << 6;
+		}
+	}
+}
+
+//Same thing PPU::calculatePixel and PPU::outputPixel do, one line at a time
+void Rasterizer::drawLine(int line, const uint8_t *seed) {
+	ScanlineLog &entry = log[line];
+
+	if (seed)
+		memcpy(entry.pixels, seed, 256);
+
+	entry.outputHash = LINE_HASH_START;
+	entry.output = false;
+
+	if (entry.firstDot == 0)
+		return;
+
+	//Rendering stays on or off the whole way on lines the background is
+	//fetched for here, so one row of the dot tables covers it
+	const uint8_t *bgPixel = entry.bgPixel;
+	uint8_t fetchedPixel[256];
+	if (!entry.bgLogged) {
+		BackgroundState bg = entry.background;
+		runBackground(entry, lineActions[(entry.control2 >> 3) & 0x03], 256, bg, fetchedPixel);
+		bgPixel = fetchedPixel;
+	}
+
+	uint8_t control2 = entry.control2;
+
+	uint8_t palette[32];
+	memcpy(palette, entry.palette, 32);
+
+	uint8_t spriteShift[16];
+	uint8_t spriteXCounter[8];
+	memcpy(spriteShift, entry.spriteShift, 16);
+	memcpy(spriteXCounter, entry.spriteXCounter, 8);
+
+	uint32_t *row = NULL;
+	if (videoOutput)
+		row = (uint32_t *)((uint8_t *)videoOutput + line * videoPitch);
+
+	int change = 0;
+
+	for (int dot = entry.firstDot; dot <= 259; dot++) {
+		while (change < entry.changeCount && entry.changes[change].dot <= dot) {
+			ScanlineChange &c = entry.changes[change];
+			if (c.type == CHANGE_MASK) {
+				control2 = c.data;
+			}
+			//Same mirroring as PPU::writeVRAM
+			else if ((c.address & 0x03) == 0) {
+				palette[0x00 | (c.address & 0x0F)] = c.data;
+				palette[0x10 | (c.address & 0x0F)] = c.data;
+			}
+			else {
+				palette[c.address] = c.data;
+			}
+			change++;
+		}
+
+		//Nothing is drawn on dots where rendering is off
+		if (!(control2 & (CONTROL2_BG_RNDR | CONTROL2_SPR_RNDR)))
+			continue;
+
+		if (dot <= 256) {
+			uint8_t bg = bgPixel[dot - 1];
+			uint8_t sprPixel = 0x00;
+			bool priority = 0;
+
+			for (int i = 0; i < 8; i++) {
+				if (spriteXCounter[i] == 0) {
+					if ((sprPixel & 0x03) == 0) {
+						priority = entry.spriteAttr[i] & 0x10;
+						sprPixel = ((entry.spriteAttr[i] & 0x03) << 2) | ((spriteShift[2*i+1] & 0x01) << 1) | (spriteShift[2*i+0] & 0x01);
+					}
+					spriteShift[2*i+0] >>= 1;
+					spriteShift[2*i+1] >>= 1;
+				}
+				else {
+					spriteXCounter[i] -= 1;
+				}
+			}
+
+			uint8_t pixel;
+			if ((control2 & CONTROL2_BG_RNDR) && !(control2 & CONTROL2_SPR_RNDR))
+				pixel = palette[bg];
+			else if (!(control2 & CONTROL2_BG_RNDR) && (control2 & CONTROL2_SPR_RNDR))
+				pixel = palette[0x10 | sprPixel];
+			else if ((priority == 0 || (bg & 0x03) == 0) && (sprPixel & 0x03) != 0)
+				pixel = palette[0x10 | sprPixel];
+			else
+				pixel = palette[bg];
+
+			entry.pixels[dot - 1] = pixel;
+		}
+
+		if (dot >= 4) {
+			int x = dot - 4;
+			uint8_t pixel = entry.pixels[x];
+			if (control2 & CONTROL2_COLOR)
+				pixel &= 0x30;
+
+			frame->buffer[x][line] = pixel;
+
+			uint16_t index = ((control2 & 0xE0) << 1) | pixel;
+			entry.outputHash = (entry.outputHash ^ (index | (x << 9))) * LINE_HASH_PRIME;
+			entry.output = true;
+
+			if (row)
+				row[x] = outputPalette[index];
+		}
+	}
+}
@@ -0,0 +1,163 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#define VISIBLE_LINES			240
+
+//More than a CPU can write in one line even with back to back stores
+#define SCANLINE_MAX_CHANGES	32
+
+//Kinds of mid-line changes
+#define CHANGE_MASK				0 //PPUMASK write
+#define CHANGE_PALETTE			1 //Palette RAM write
+
+struct Frame;
+
+//A write that happened after the line started drawing, it applies from
+//dot on (a write during a CPU cycle lands before the PPU's dots for it)
+struct ScanlineChange {
+	int16_t dot;
+	uint8_t type;
+	uint8_t address;
+	uint8_t data;
+};
+
+//The PPU's background fetch and shift registers, see PPU.h
+struct BackgroundState {
+	uint16_t accessAddress;
+	uint8_t fineX;
+	uint8_t control1;
+
+	uint16_t patternShift0;
+	uint16_t patternShift1;
+	uint8_t patternBuffer0;
+	uint8_t patternBuffer1;
+
+	uint8_t attrShift0;
+	uint8_t attrShift1;
+	uint8_t attrLatch;
+	uint8_t attrLatchBuffer;
+
+	uint8_t currentPattern;
+};
+
+//Everything needed to draw one visible line after the fact
+//
+//The background is fetched by the rasterizer, starting from the fetch and
+//shift registers as they were on the line's first dot and reading through
+//the CHR and nametable pages that were mapped in then. A line whose
+//background the PPU had to work out as it went (sprite 0 is on it, or a
+//write partway through changed the scroll, the pattern table, the pages or
+//whether anything is rendered) has the 4-bit pixel it shifted out on each
+//dot logged instead, see PPU::catchUpBackground. Sprites are drawn from the
+//shift registers/counters as they were when the line started, and the mask
+//register and palette from their values at that point plus any changes
+struct ScanlineLog {
+	//First dot that did pixel work, 0 if the line was never drawn
+	int16_t firstDot;
+
+	uint8_t control2;
+	uint8_t palette[32];
+
+	uint8_t spriteShift[16];
+	uint8_t spriteAttr[8];
+	uint8_t spriteXCounter[8];
+
+	BackgroundState background;
+	uint8_t *chrPages[8];
+	uint8_t *nametablePages[4];
+
+	//Set if bgPixel holds the line's background
+	bool bgLogged;
+	uint8_t bgPixel[256];
+
+	int changeCount;
+	ScanlineChange changes[SCANLINE_MAX_CHANGES];
+
+	//Lines that didn't draw from dot 1 with rendering on the whole way output
+	//some pixels left over from the line before, so they are drawn in order
+	//after everything else
+	bool partial;
+
+	//Pixel buffer at the end of the line, filled in by the rasterizer
+	uint8_t pixels[256];
+
+	//Hash of the pixels output, same as PPU::currentLineHash
+	uint32_t outputHash;
+	bool output;
+};
+
+//Does the background fetches and shifts PPU::cycle would on a line from its
+//first dot up to lastDot, going by one row of the dot tables and starting
+//from bg. The pixel shifted out on each of those dots up to 256 goes in bgPixel
+void runBackground(const ScanlineLog &entry, const uint32_t *actions, int lastDot, BackgroundState &bg, uint8_t *bgPixel);
+
+//Draws scanline logs on a pool of worker threads
+//
+//start() hands the pool a run of finished lines, finish() helps out with
+//whatever is left, draws the partial lines and returns once they're all done
+//and every worker has gone back to waiting. Nothing but the log and the
+//memory its page pointers point into is read while drawing, so the console
+//can keep running in between as long as it leaves VRAM alone
+class Rasterizer {
+	ScanlineLog *log;
+	int firstLine;
+	int lastLine;
+
+	Frame *frame;
+
+	uint32_t *videoOutput;
+	int videoPitch;
+	uint32_t *outputPalette;
+
+	//Visible line row of the PPU's dot tables
+	const uint32_t (*lineActions)[341];
+
+	std::vector<std::thread> workers;
+
+	std::mutex lock;
+	std::condition_variable wake;
+
+	//Bumped by start() so the workers know there are new lines
+	uint64_t generation;
+
+	bool stopping;
+
+	std::atomic<int> nextLine;
+
+	//Workers that haven't finished with the current lines yet
+	std::atomic<int> working;
+
+	//Pixel buffer left over from the end of the last frame drawn
+	uint8_t lastPixels[256];
+
+	void work();
+
+	//Grabs lines until there are none left
+	void drawLines();
+
+	//Draws one line, seed is the pixel buffer from the line before for
+	//partial lines and NULL otherwise
+	void drawLine(int line, const uint8_t *seed);
+
+public:
+	//threads is the number of workers on top of the thread calling finish(),
+	//lineActions is PPU::dotActions[LINE_VISIBLE]
+	Rasterizer(int threads, const uint32_t (*lineActions)[341]);
+
+	~Rasterizer();
+
+	//Lines first to last - 1, each run has to pick up where the last one
+	//left off and a frame ends with a run finishing at VISIBLE_LINES
+	void start(ScanlineLog *log, int first, int last, Frame *frame, uint32_t *videoOutput, int videoPitch, uint32_t *outputPalette);
+
+	void finish();
+};
+
+#endif
@@ -0,0 +1,49 @@
+#include "TripleBuffer.h"
+
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+TripleBuffer::TripleBuffer(int size) {
+	for (int i = 0; i < 3; i++) {
+		frames[i] = (uint32_t *) malloc(size * sizeof(uint32_t));
+		memset(frames[i], 0, size * sizeof(uint32_t));
+		numbers[i] = 0;
+	}
+
+	back = 0;
+	middle = 1;
+	front = 2;
+}
+
+TripleBuffer::~TripleBuffer() {
+	for (int i = 0; i < 3; i++)
+		free(frames[i]);
+}
+
+uint32_t *TripleBuffer::getBack() {
+	return frames[back];
+}
+
+void TripleBuffer::publish(uint64_t number) {
+	numbers[back] = number;
+	//Release so the reader sees the frame's contents along with the index
+	back = middle.exchange(back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel) & 0x03;
+}
+
+bool TripleBuffer::acquire() {
+	if (!(middle.load(memory_order_relaxed) & TRIPLE_BUFFER_FRESH))
+		return false;
+
+	front = middle.exchange(front, memory_order_acq_rel) & 0x03;
+	return true;
+}
+
+const uint32_t *TripleBuffer::getFront() {
+	return frames[front];
+}
+
+uint64_t TripleBuffer::getFrontNumber() {
+	return numbers[front];
+}
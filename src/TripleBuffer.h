@@ -0,0 +1,50 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <cstdint>
+#include <atomic>
+
+//Set in the shared slot index when it holds a frame the reader hasn't seen
+#define TRIPLE_BUFFER_FRESH		0x04
+
+//Passes whole frames from one thread to another without either waiting
+//
+//There are three frames, one the writer is filling, one the reader is
+//looking at and one in the middle. Publishing swaps the writer's frame with
+//the middle one and taking a frame swaps the reader's with it, both in a
+//single atomic exchange. The writer never blocks and the reader always gets
+//the newest frame, anything the reader doesn't get to in time is dropped
+class TripleBuffer {
+	uint32_t *frames[3];
+	uint64_t numbers[3];
+
+	//Middle frame's index and TRIPLE_BUFFER_FRESH
+	std::atomic<uint8_t> middle;
+
+	//Only touched by their own threads
+	uint8_t back;
+	uint8_t front;
+
+public:
+	//size is the number of pixels in a frame
+	TripleBuffer(int size);
+
+	~TripleBuffer();
+
+	//Frame for the writer to fill
+	uint32_t *getBack();
+
+	//Hands the back frame over to the reader, number is whatever the writer
+	//wants to tag it with
+	void publish(uint64_t number);
+
+	//Takes the newest published frame if there's one the reader hasn't had
+	//yet, returns false and leaves the front frame alone if not
+	bool acquire();
+
+	//Frame the reader last acquired and its number
+	const uint32_t *getFront();
+	uint64_t getFrontNumber();
+};
+
+#endif
@@ -0,0 +1,577 @@
+#include "Upscaler.h"
+#include "Palette.h"
+
+#include <chrono>
+#include <cstdlib>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+//Passes, see runPass
+#define PASS_SCALE2X	0
+#define PASS_SCALE3X	1
+#define PASS_XBR_PREPARE	2
+#define PASS_XBR2X		3
+#define PASS_XBR4X		4
+
+//Pixels of border xBR looks at around the image
+#define XBR_BORDER		2
+
+//Colours closer than this count as the same to xBR
+#define XBR_EQUAL_DISTANCE	155
+
+//Frames averaged over for getAverageTime
+#define UPSCALE_AVERAGE_FRAMES	60
+
+static inline int clampInt(int value, int low, int high) {
+	return value < low ? low : value > high ? high : value;
+}
+
+//Mixes amount/8 of b into a, a channel at a time
+static inline uint32_t blendPixel(uint32_t a, uint32_t b, int amount) {
+	uint32_t evenA = a & 0x00FF00FF;
+	uint32_t evenB = b & 0x00FF00FF;
+	uint32_t oddA = (a >> 8) & 0x00FF00FF;
+	uint32_t oddB = (b >> 8) & 0x00FF00FF;
+
+	uint32_t even = ((evenA * (8 - amount) + evenB * amount) >> 3) & 0x00FF00FF;
+	uint32_t odd = ((oddA * (8 - amount) + oddB * amount) >> 3) & 0x00FF00FF;
+
+	return even | (odd << 8);
+}
+
+//	A B C
+//	D E F
+//	G H I
+static inline void scale2xPixel(uint32_t B, uint32_t D, uint32_t E, uint32_t F, uint32_t H, uint32_t *out0, uint32_t *out1) {
+	if (B != H && D != F) {
+		out0[0] = D == B ? D : E;
+		out0[1] = B == F ? F : E;
+		out1[0] = D == H ? D : E;
+		out1[1] = H == F ? F : E;
+	}
+	else {
+		out0[0] = out0[1] = E;
+		out1[0] = out1[1] = E;
+	}
+}
+
+static inline void scale3xPixel(uint32_t A, uint32_t B, uint32_t C, uint32_t D, uint32_t E, uint32_t F, uint32_t G, uint32_t H, uint32_t I,
+		uint32_t *out0, uint32_t *out1, uint32_t *out2) {
+	if (B != H && D != F) {
+		out0[0] = D == B ? D : E;
+		out0[1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+		out0[2] = B == F ? F : E;
+		out1[0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+		out1[1] = E;
+		out1[2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+		out2[0] = D == H ? D : E;
+		out2[1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+		out2[2] = H == F ? F : E;
+	}
+	else {
+		out0[0] = out0[1] = out0[2] = E;
+		out1[0] = out1[1] = out1[2] = E;
+		out2[0] = out2[1] = out2[2] = E;
+	}
+}
+
+#if defined(__SSE2__)
+//Picks a where mask is set and b everywhere else
+static inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+Upscaler::Upscaler(int threads, int filter, uint8_t format) {
+	this->filter = filter;
+
+	switch (format) {
+		case PIXEL_FORMAT_ARGB:
+			redShift = 16;
+			greenShift = 8;
+			blueShift = 0;
+			break;
+		case PIXEL_FORMAT_BGRA:
+			redShift = 8;
+			greenShift = 16;
+			blueShift = 24;
+			break;
+		case PIXEL_FORMAT_ABGR:
+			redShift = 0;
+			greenShift = 8;
+			blueShift = 16;
+			break;
+		default: //PIXEL_FORMAT_RGBA
+			redShift = 24;
+			greenShift = 16;
+			blueShift = 8;
+			break;
+	}
+
+	intermediate = NULL;
+	intermediateSize = 0;
+
+	padded = NULL;
+	paddedYuv = NULL;
+	paddedSize = 0;
+
+	pass = PASS_SCALE2X;
+	input = NULL;
+	inputPitch = 0;
+	width = 0;
+	height = 0;
+	rows = 0;
+	output = NULL;
+	outputPitch = 0;
+
+	generation = 0;
+	stopping = false;
+
+	nextRow = 0;
+	working = 0;
+
+	lastTime = 0;
+	averageTime = 0;
+
+	for (int i = 0; i < threads; i++)
+		workers.push_back(thread(&Upscaler::work, this));
+}
+
+Upscaler::~Upscaler() {
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	free(intermediate);
+	free(padded);
+	free(paddedYuv);
+}
+
+void Upscaler::work() {
+	uint64_t seen = 0;
+
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+
+		passRows();
+		working.fetch_sub(1, memory_order_release);
+	}
+}
+
+void Upscaler::passRows() {
+	int row;
+	while ((row = nextRow.fetch_add(UPSCALE_ROWS_PER_JOB)) < rows) {
+		int end = row + UPSCALE_ROWS_PER_JOB;
+		if (end > rows)
+			end = rows;
+
+		for (int y = row; y < end; y++) {
+			switch (pass) {
+				case PASS_SCALE2X:
+					scale2xRow(y);
+					break;
+				case PASS_SCALE3X:
+					scale3xRow(y);
+					break;
+				case PASS_XBR_PREPARE:
+					xbrPrepareRow(y);
+					break;
+				case PASS_XBR2X:
+					xbrRow(y, 2);
+					break;
+				case PASS_XBR4X:
+					xbrRow(y, 4);
+					break;
+			}
+		}
+	}
+}
+
+void Upscaler::runPass(int pass, const uint32_t *input, int inputPitch, int width, int height, uint32_t *output, int outputPitch) {
+	{
+		lock_guard<mutex> guard(lock);
+		this->pass = pass;
+		this->input = input;
+		this->inputPitch = inputPitch;
+		this->width = width;
+		this->height = height;
+		this->output = output;
+		this->outputPitch = outputPitch;
+		//Preparing covers the border rows above and below as well
+		rows = pass == PASS_XBR_PREPARE ? height + 2*XBR_BORDER : height;
+		nextRow = 0;
+		working = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	passRows();
+
+	//A worker still on its way out of this pass would take rows from the
+	//next one as soon as nextRow is reset, so they all have to be parked
+	while (working.load(memory_order_acquire) > 0)
+		this_thread::yield();
+}
+
+int Upscaler::getScale() {
+	switch (filter) {
+		case UPSCALE_SCALE3X:
+			return 3;
+		case UPSCALE_SCALE4X:
+		case UPSCALE_XBR4X:
+			return 4;
+		default:
+			return 2;
+	}
+}
+
+void Upscaler::upscale(const uint32_t *input, int inputPitch, int width, int height, uint32_t *output, int outputPitch) {
+	auto start = chrono::steady_clock::now();
+
+	int paddedPixels = (width + 2*XBR_BORDER) * (height + 2*XBR_BORDER);
+	if ((filter == UPSCALE_XBR2X || filter == UPSCALE_XBR4X) && paddedSize < paddedPixels) {
+		padded = (uint32_t *)realloc(padded, paddedPixels * sizeof(uint32_t));
+		paddedYuv = (uint32_t *)realloc(paddedYuv, paddedPixels * sizeof(uint32_t));
+		paddedSize = paddedPixels;
+	}
+
+	if (filter == UPSCALE_SCALE4X && intermediateSize < width * height * 4) {
+		intermediate = (uint32_t *)realloc(intermediate, width * height * 4 * sizeof(uint32_t));
+		intermediateSize = width * height * 4;
+	}
+
+	switch (filter) {
+		case UPSCALE_SCALE2X:
+			runPass(PASS_SCALE2X, input, inputPitch, width, height, output, outputPitch);
+			break;
+		case UPSCALE_SCALE3X:
+			runPass(PASS_SCALE3X, input, inputPitch, width, height, output, outputPitch);
+			break;
+		case UPSCALE_SCALE4X:
+			runPass(PASS_SCALE2X, input, inputPitch, width, height, intermediate, width * 2 * 4);
+			runPass(PASS_SCALE2X, intermediate, width * 2 * 4, width * 2, height * 2, output, outputPitch);
+			break;
+		case UPSCALE_XBR2X:
+			runPass(PASS_XBR_PREPARE, input, inputPitch, width, height, NULL, 0);
+			runPass(PASS_XBR2X, input, inputPitch, width, height, output, outputPitch);
+			break;
+		case UPSCALE_XBR4X:
+			runPass(PASS_XBR_PREPARE, input, inputPitch, width, height, NULL, 0);
+			runPass(PASS_XBR4X, input, inputPitch, width, height, output, outputPitch);
+			break;
+	}
+
+	lastTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	if (averageTime == 0)
+		averageTime = lastTime;
+	else
+		averageTime += (lastTime - averageTime) / UPSCALE_AVERAGE_FRAMES;
+}
+
+double Upscaler::getLastTime() {
+	return lastTime;
+}
+
+double Upscaler::getAverageTime() {
+	return averageTime;
+}
+
+void Upscaler::scale2xRow(int y) {
+	const uint32_t *up = (const uint32_t *)((const uint8_t *)input + (y > 0 ? y - 1 : y) * inputPitch);
+	const uint32_t *cur = (const uint32_t *)((const uint8_t *)input + y * inputPitch);
+	const uint32_t *down = (const uint32_t *)((const uint8_t *)input + (y < height - 1 ? y + 1 : y) * inputPitch);
+
+	uint32_t *out0 = (uint32_t *)((uint8_t *)output + 2*y * outputPitch);
+	uint32_t *out1 = (uint32_t *)((uint8_t *)output + (2*y + 1) * outputPitch);
+
+	//The edges repeat the outermost pixels
+	scale2xPixel(up[0], cur[0], cur[0], cur[1], down[0], out0, out1);
+
+	int x = 1;
+
+#if defined(__SSE2__)
+	//Four pixels at a time, as long as the one to the right is still on the line
+	for (; x + 4 < width; x += 4) {
+		__m128i B = _mm_loadu_si128((const __m128i *)(up + x));
+		__m128i D = _mm_loadu_si128((const __m128i *)(cur + x - 1));
+		__m128i E = _mm_loadu_si128((const __m128i *)(cur + x));
+		__m128i F = _mm_loadu_si128((const __m128i *)(cur + x + 1));
+		__m128i H = _mm_loadu_si128((const __m128i *)(down + x));
+
+		__m128i same = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+
+		__m128i E0 = select(_mm_andnot_si128(same, _mm_cmpeq_epi32(D, B)), D, E);
+		__m128i E1 = select(_mm_andnot_si128(same, _mm_cmpeq_epi32(B, F)), F, E);
+		__m128i E2 = select(_mm_andnot_si128(same, _mm_cmpeq_epi32(D, H)), D, E);
+		__m128i E3 = select(_mm_andnot_si128(same, _mm_cmpeq_epi32(H, F)), F, E);
+
+		_mm_storeu_si128((__m128i *)(out0 + 2*x), _mm_unpacklo_epi32(E0, E1));
+		_mm_storeu_si128((__m128i *)(out0 + 2*x + 4), _mm_unpackhi_epi32(E0, E1));
+		_mm_storeu_si128((__m128i *)(out1 + 2*x), _mm_unpacklo_epi32(E2, E3));
+		_mm_storeu_si128((__m128i *)(out1 + 2*x + 4), _mm_unpackhi_epi32(E2, E3));
+	}
+#endif
+
+	for (; x < width; x++) {
+		int right = x < width - 1 ? x + 1 : x;
+		scale2xPixel(up[x], cur[x - 1], cur[x], cur[right], down[x], out0 + 2*x, out1 + 2*x);
+	}
+}
+
+void Upscaler::scale3xRow(int y) {
+	const uint32_t *up = (const uint32_t *)((const uint8_t *)input + (y > 0 ? y - 1 : y) * inputPitch);
+	const uint32_t *cur = (const uint32_t *)((const uint8_t *)input + y * inputPitch);
+	const uint32_t *down = (const uint32_t *)((const uint8_t *)input + (y < height - 1 ? y + 1 : y) * inputPitch);
+
+	uint32_t *out0 = (uint32_t *)((uint8_t *)output + 3*y * outputPitch);
+	uint32_t *out1 = (uint32_t *)((uint8_t *)output + (3*y + 1) * outputPitch);
+	uint32_t *out2 = (uint32_t *)((uint8_t *)output + (3*y + 2) * outputPitch);
+
+	scale3xPixel(up[0], up[0], up[1], cur[0], cur[0], cur[1], down[0], down[0], down[1], out0, out1, out2);
+
+	int x = 1;
+
+#if defined(__SSE2__)
+	for (; x + 4 < width; x += 4) {
+		__m128i A = _mm_loadu_si128((const __m128i *)(up + x - 1));
+		__m128i B = _mm_loadu_si128((const __m128i *)(up + x));
+		__m128i C = _mm_loadu_si128((const __m128i *)(up + x + 1));
+		__m128i D = _mm_loadu_si128((const __m128i *)(cur + x - 1));
+		__m128i E = _mm_loadu_si128((const __m128i *)(cur + x));
+		__m128i F = _mm_loadu_si128((const __m128i *)(cur + x + 1));
+		__m128i G = _mm_loadu_si128((const __m128i *)(down + x - 1));
+		__m128i H = _mm_loadu_si128((const __m128i *)(down + x));
+		__m128i I = _mm_loadu_si128((const __m128i *)(down + x + 1));
+
+		__m128i same = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+
+		__m128i DB = _mm_andnot_si128(same, _mm_cmpeq_epi32(D, B));
+		__m128i BF = _mm_andnot_si128(same, _mm_cmpeq_epi32(B, F));
+		__m128i DH = _mm_andnot_si128(same, _mm_cmpeq_epi32(D, H));
+		__m128i HF = _mm_andnot_si128(same, _mm_cmpeq_epi32(H, F));
+
+		__m128i EA = _mm_cmpeq_epi32(E, A);
+		__m128i EC = _mm_cmpeq_epi32(E, C);
+		__m128i EG = _mm_cmpeq_epi32(E, G);
+		__m128i EI = _mm_cmpeq_epi32(E, I);
+
+		__m128i block[9];
+		block[0] = select(DB, D, E);
+		block[1] = select(_mm_or_si128(_mm_andnot_si128(EC, DB), _mm_andnot_si128(EA, BF)), B, E);
+		block[2] = select(BF, F, E);
+		block[3] = select(_mm_or_si128(_mm_andnot_si128(EG, DB), _mm_andnot_si128(EA, DH)), D, E);
+		block[4] = E;
+		block[5] = select(_mm_or_si128(_mm_andnot_si128(EI, BF), _mm_andnot_si128(EC, HF)), F, E);
+		block[6] = select(DH, D, E);
+		block[7] = select(_mm_or_si128(_mm_andnot_si128(EI, DH), _mm_andnot_si128(EG, HF)), H, E);
+		block[8] = select(HF, F, E);
+
+		//Three way interleaves don't map onto SSE2 shuffles well, the
+		//comparisons are the expensive part anyway
+		uint32_t pixels[9][4];
+		for (int i = 0; i < 9; i++)
+			_mm_storeu_si128((__m128i *)pixels[i], block[i]);
+
+		for (int i = 0; i < 4; i++) {
+			uint32_t *o0 = out0 + 3*(x + i);
+			uint32_t *o1 = out1 + 3*(x + i);
+			uint32_t *o2 = out2 + 3*(x + i);
+			o0[0] = pixels[0][i]; o0[1] = pixels[1][i]; o0[2] = pixels[2][i];
+			o1[0] = pixels[3][i]; o1[1] = pixels[4][i]; o1[2] = pixels[5][i];
+			o2[0] = pixels[6][i]; o2[1] = pixels[7][i]; o2[2] = pixels[8][i];
+		}
+	}
+#endif
+
+	for (; x < width; x++) {
+		int right = x < width - 1 ? x + 1 : x;
+		scale3xPixel(up[x - 1], up[x], up[right], cur[x - 1], cur[x], cur[right], down[x - 1], down[x], down[right],
+				out0 + 3*x, out1 + 3*x, out2 + 3*x);
+	}
+}
+
+//Copies a row into the padded buffers along with its YUV, packed as Y,
+//U+128 and V+128 in the low three bytes. Rows and columns past the edges
+//repeat the outermost pixels
+void Upscaler::xbrPrepareRow(int y) {
+	int pitch = width + 2*XBR_BORDER;
+
+	int row = clampInt(y - XBR_BORDER, 0, height - 1);
+	const uint32_t *in = (const uint32_t *)((const uint8_t *)input + row * inputPitch);
+
+	uint32_t *pixels = padded + y * pitch;
+	uint32_t *colours = paddedYuv + y * pitch;
+
+	for (int x = 0; x < pitch; x++) {
+		uint32_t pixel = in[clampInt(x - XBR_BORDER, 0, width - 1)];
+
+		int r = (pixel >> redShift) & 0xFF;
+		int g = (pixel >> greenShift) & 0xFF;
+		int b = (pixel >> blueShift) & 0xFF;
+
+		int luma = (299*r + 587*g + 114*b) / 1000;
+		int u = (-169*r - 331*g + 500*b) / 1000 + 128;
+		int v = (500*r - 419*g - 81*b) / 1000 + 128;
+
+		pixels[x] = pixel;
+		colours[x] = luma | (u << 8) | (v << 16);
+	}
+}
+
+int Upscaler::yuvDistance(uint32_t a, uint32_t b) {
+	int luma = abs((int)(a & 0xFF) - (int)(b & 0xFF));
+	int u = abs((int)((a >> 8) & 0xFF) - (int)((b >> 8) & 0xFF));
+	int v = abs((int)((a >> 16) & 0xFF) - (int)((b >> 16) & 0xFF));
+
+	return 48*luma + 7*u + 6*v;
+}
+
+//2xBR and 4xBR by Hyllian
+//
+//Each corner of the output block looks at the pixels around it to decide
+//whether an edge runs across it, and if it does blends in the colour on the
+//other side. The rules are written for the bottom right corner,
+//
+//	   A1 B1 C1
+//	A0 A  B  C  C4
+//	D0 D  E  F  F4
+//	G0 G  H  I  I4
+//	   G5 H5 I5
+//
+//the other corners are the same thing mirrored. How far the blend reaches
+//into the block depends on whether the edge is shallow, steep or diagonal
+void Upscaler::xbrRow(int y, int scale) {
+	int pitch = width + 2*XBR_BORDER;
+	const uint32_t *pixels = padded + (y + XBR_BORDER) * pitch + XBR_BORDER;
+	const uint32_t *colours = paddedYuv + (y + XBR_BORDER) * pitch + XBR_BORDER;
+
+	uint32_t *out[4];
+	for (int i = 0; i < scale; i++)
+		out[i] = (uint32_t *)((uint8_t *)output + (scale*y + i) * outputPitch);
+
+	for (int x = 0; x < width; x++) {
+		uint32_t E = pixels[x];
+
+		uint32_t block[16];
+		for (int i = 0; i < scale*scale; i++)
+			block[i] = E;
+
+		for (int corner = 0; corner < 4; corner++) {
+			int dx = (corner & 1) ? 1 : -1;
+			int dy = (corner & 2) ? pitch : -pitch;
+
+			uint32_t F = pixels[x + dx];
+			uint32_t H = pixels[x + dy];
+
+			//Blending with either of these would just give back E
+			if (E == F || E == H)
+				continue;
+
+			const uint32_t *c = colours + x;
+			uint32_t yE = c[0], yF = c[dx], yH = c[dy], yI = c[dx + dy];
+			uint32_t yB = c[-dy], yC = c[dx - dy], yD = c[-dx], yG = c[dy - dx];
+			uint32_t yF4 = c[2*dx], yI4 = c[2*dx + dy], yH5 = c[2*dy], yI5 = c[dx + 2*dy];
+
+			int e = yuvDistance(yE, yC) + yuvDistance(yE, yG) + yuvDistance(yI, yH5) + yuvDistance(yI, yF4) + 4*yuvDistance(yH, yF);
+			int i = yuvDistance(yH, yD) + yuvDistance(yH, yI5) + yuvDistance(yF, yI4) + yuvDistance(yF, yB) + 4*yuvDistance(yE, yI);
+
+			if (e > i)
+				continue;
+
+			uint32_t px = yuvDistance(yE, yF) <= yuvDistance(yE, yH) ? F : H;
+
+			//Cell r, c of the block counting from the corner's far side
+			auto cell = [&](int r, int c) -> uint32_t & {
+				int row = dy > 0 ? r : scale - 1 - r;
+				int col = dx > 0 ? c : scale - 1 - c;
+				return block[row*scale + col];
+			};
+
+			int last = scale - 1;
+
+			bool edge = (yuvDistance(yF, yB) >= XBR_EQUAL_DISTANCE && yuvDistance(yH, yD) >= XBR_EQUAL_DISTANCE)
+					|| (yuvDistance(yE, yI) < XBR_EQUAL_DISTANCE && yuvDistance(yF, yI4) >= XBR_EQUAL_DISTANCE && yuvDistance(yH, yI5) >= XBR_EQUAL_DISTANCE)
+					|| yuvDistance(yE, yG) < XBR_EQUAL_DISTANCE || yuvDistance(yE, yC) < XBR_EQUAL_DISTANCE;
+
+			if (e == i || !edge) {
+				//Not quite an edge, just soften the corner
+				cell(last, last) = blendPixel(cell(last, last), px, scale == 2 ? 2 : 4);
+				continue;
+			}
+
+			int ke = yuvDistance(yF, yG);
+			int ki = yuvDistance(yH, yC);
+
+			uint32_t B = pixels[x - dy], C = pixels[x + dx - dy], D = pixels[x - dx], G = pixels[x + dy - dx];
+			bool shallow = 2*ke <= ki && E != G && D != G;
+			bool steep = ke >= 2*ki && E != C && B != C;
+
+			if (scale == 2) {
+				if (shallow && steep) {
+					cell(1, 1) = blendPixel(cell(1, 1), px, 7);
+					cell(1, 0) = blendPixel(cell(1, 0), px, 2);
+					cell(0, 1) = cell(1, 0);
+				}
+				else if (shallow) {
+					cell(1, 1) = blendPixel(cell(1, 1), px, 6);
+					cell(1, 0) = blendPixel(cell(1, 0), px, 2);
+				}
+				else if (steep) {
+					cell(1, 1) = blendPixel(cell(1, 1), px, 6);
+					cell(0, 1) = blendPixel(cell(0, 1), px, 2);
+				}
+				else {
+					cell(1, 1) = blendPixel(cell(1, 1), px, 4);
+				}
+			}
+			else {
+				if (shallow && steep) {
+					cell(3, 1) = blendPixel(cell(3, 1), px, 6);
+					cell(3, 0) = blendPixel(cell(3, 0), px, 2);
+					cell(3, 3) = cell(3, 2) = cell(2, 3) = px;
+					cell(2, 2) = cell(0, 3) = cell(3, 0);
+					cell(1, 3) = cell(3, 1);
+				}
+				else if (shallow) {
+					cell(2, 3) = blendPixel(cell(2, 3), px, 6);
+					cell(3, 1) = blendPixel(cell(3, 1), px, 6);
+					cell(2, 2) = blendPixel(cell(2, 2), px, 2);
+					cell(3, 0) = blendPixel(cell(3, 0), px, 2);
+					cell(3, 2) = cell(3, 3) = px;
+				}
+				else if (steep) {
+					cell(3, 2) = blendPixel(cell(3, 2), px, 6);
+					cell(1, 3) = blendPixel(cell(1, 3), px, 6);
+					cell(2, 2) = blendPixel(cell(2, 2), px, 2);
+					cell(0, 3) = blendPixel(cell(0, 3), px, 2);
+					cell(2, 3) = cell(3, 3) = px;
+				}
+				else {
+					cell(2, 3) = blendPixel(cell(2, 3), px, 4);
+					cell(3, 2) = blendPixel(cell(3, 2), px, 4);
+					cell(3, 3) = px;
+				}
+			}
+		}
+
+		for (int row = 0; row < scale; row++) {
+			for (int col = 0; col < scale; col++)
+				out[row][scale*x + col] = block[row*scale + col];
+		}
+	}
+}
@@ -0,0 +1,114 @@
+#ifndef UPSCALER_H
+#define UPSCALER_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+//Filters, see Upscaler
+#define UPSCALE_SCALE2X		0
+#define UPSCALE_SCALE3X		1
+#define UPSCALE_SCALE4X		2 //Scale2x twice
+#define UPSCALE_XBR2X		3
+#define UPSCALE_XBR4X		4
+
+//Input rows handed to a worker at a time
+#define UPSCALE_ROWS_PER_JOB	8
+
+//Pixel art upscaler
+//
+//The Scale2x/3x family only ever copies neighbouring pixels so it works on
+//any 32-bit pixels. xBR blends along edges it finds by comparing colours in
+//YUV, so it needs to know which byte is which. Scale4x runs Scale2x twice
+//through an intermediate buffer, 4xBR has its own rules. Every pass is
+//split up by rows between a pool of worker threads and whoever called
+//upscale()
+class Upscaler {
+	int filter;
+
+	//Byte offsets of each channel in a pixel, for xBR
+	int redShift;
+	int greenShift;
+	int blueShift;
+
+	//Output of the first Scale2x pass for Scale4x
+	uint32_t *intermediate;
+	int intermediateSize;
+
+	//Input with a border around it and its YUV for xBR, see xbrPrepareRow
+	uint32_t *padded;
+	uint32_t *paddedYuv;
+	int paddedSize;
+
+	//Current pass
+	int pass;
+	const uint32_t *input;
+	int inputPitch;
+	int width;
+	int height;
+	int rows;
+	uint32_t *output;
+	int outputPitch;
+
+	std::vector<std::thread> workers;
+
+	std::mutex lock;
+	std::condition_variable wake;
+
+	//Bumped for every pass so the workers know there's more to do
+	uint64_t generation;
+
+	bool stopping;
+
+	std::atomic<int> nextRow;
+
+	//Workers that haven't finished with the current pass yet
+	std::atomic<int> working;
+
+	//Time upscale() took in ms, last call and a running average
+	double lastTime;
+	double averageTime;
+
+	void work();
+
+	//Hands a pass to the pool, helps out and waits for it to finish and for
+	//every worker to go back to waiting
+	void runPass(int pass, const uint32_t *input, int inputPitch, int width, int height, uint32_t *output, int outputPitch);
+
+	//Grabs rows off the current pass until there are none left
+	void passRows();
+
+	void scale2xRow(int y);
+	void scale3xRow(int y);
+	void xbrPrepareRow(int y);
+	void xbrRow(int y, int scale);
+
+	//Weighted distance between two packed YUV values
+	int yuvDistance(uint32_t a, uint32_t b);
+
+public:
+	//threads is the number of workers on top of the thread calling upscale(),
+	//filter is one of the UPSCALE_* values and format one of the
+	//PIXEL_FORMAT_* values in Palette.h
+	Upscaler(int threads, int filter, uint8_t format);
+
+	~Upscaler();
+
+	//How many times bigger the output is than the input
+	int getScale();
+
+	//Upscales a widthxheight image, pitches are the length of a row in bytes
+	//and the output has to be getScale() times as wide and high
+	void upscale(const uint32_t *input, int inputPitch, int width, int height, uint32_t *output, int outputPitch);
+
+	//How long the last upscale() took in ms
+	double getLastTime();
+
+	//Smoothed over the last second or so of frames
+	double getAverageTime();
+};
+
+#endif
@@ -0,0 +1,241 @@
+#include "VideoCapture.h"
+#include "Palette.h"
+
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+#define CAPTURE_WIDTH	256
+#define CAPTURE_HEIGHT	240
+
+//NTSC frame rate as an exact fraction, 39375000/655171 = 60.0988
+#define Y4M_RATE_NUMERATOR		39375000
+#define Y4M_RATE_DENOMINATOR	655171
+
+//Y4M frames are the Y plane then quarter size U and V planes
+#define Y4M_FRAME_SIZE	(CAPTURE_WIDTH*CAPTURE_HEIGHT*3/2)
+
+static uint8_t clampByte(double value) {
+	if (value < 0)
+		return 0;
+	if (value > 255)
+		return 255;
+	return (uint8_t)(value + 0.5);
+}
+
+VideoCapture::VideoCapture(const char *filename, uint8_t format) {
+	this->format = format;
+
+	pipe = filename[0] == '|';
+	if (pipe) {
+		//An encoder that quits shows up as a failed write instead of killing us
+		signal(SIGPIPE, SIG_IGN);
+		file = popen(filename + 1, "w");
+	}
+	else
+		file = fopen(filename, "wb");
+
+	queueHead = 0;
+	queueTail = 0;
+	framesWritten = 0;
+	framesDropped = 0;
+	failed = false;
+
+	for (int i = 0; i < CAPTURE_QUEUE_FRAMES; i++)
+		queue[i] = (uint32_t *) malloc(CAPTURE_WIDTH * CAPTURE_HEIGHT * sizeof(uint32_t));
+	output = (uint8_t *) malloc(CAPTURE_WIDTH * CAPTURE_HEIGHT * 4);
+
+	//Limited range BT.601, which is what anything reading Y4M assumes
+	uint32_t rgb[OUTPUT_PALETTE_SIZE];
+	buildOutputPalette(rgb, PIXEL_FORMAT_RGBA);
+	for (int i = 0; i < OUTPUT_PALETTE_SIZE; i++) {
+		double r = (rgb[i] >> 24) & 0xFF;
+		double g = (rgb[i] >> 16) & 0xFF;
+		double b = (rgb[i] >> 8) & 0xFF;
+
+		uint8_t y = clampByte(16 + (65.481*r + 128.553*g + 24.966*b) / 255);
+		uint8_t u = clampByte(128 + (-37.797*r - 74.203*g + 112.0*b) / 255);
+		uint8_t v = clampByte(128 + (112.0*r - 93.786*g - 18.214*b) / 255);
+		yuvPalette[i] = y | (u << 8) | (v << 16);
+	}
+
+	//ABGR puts R in the lowest byte, so it comes first in memory on a little
+	//endian machine
+	buildOutputPalette(rgbaPalette, PIXEL_FORMAT_ABGR);
+
+	if (!file)
+		return;
+
+	if (format == CAPTURE_Y4M)
+		fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n", CAPTURE_WIDTH, CAPTURE_HEIGHT, Y4M_RATE_NUMERATOR, Y4M_RATE_DENOMINATOR);
+
+	running = true;
+	thread = std::thread(&VideoCapture::run, this);
+}
+
+VideoCapture::~VideoCapture() {
+	finish();
+
+	for (int i = 0; i < CAPTURE_QUEUE_FRAMES; i++)
+		free(queue[i]);
+	free(output);
+}
+
+bool VideoCapture::isOpen() {
+	return file != NULL;
+}
+
+void VideoCapture::finish() {
+	if (!file)
+		return;
+
+	running.store(false, memory_order_release);
+	thread.join();
+
+	if (pipe)
+		pclose(file);
+	else
+		fclose(file);
+	file = NULL;
+}
+
+bool VideoCapture::pushFrame(const uint32_t *indices) {
+	uint32_t tail = queueTail.load(memory_order_relaxed);
+	if (!file || tail - queueHead.load(memory_order_acquire) >= CAPTURE_QUEUE_FRAMES) {
+		framesDropped.fetch_add(1, memory_order_relaxed);
+		return false;
+	}
+
+	memcpy(queue[tail & (CAPTURE_QUEUE_FRAMES - 1)], indices, CAPTURE_WIDTH * CAPTURE_HEIGHT * sizeof(uint32_t));
+	queueTail.store(tail + 1, memory_order_release);
+	return true;
+}
+
+uint64_t VideoCapture::getFramesWritten() {
+	return framesWritten.load(memory_order_relaxed);
+}
+
+uint64_t VideoCapture::getFramesDropped() {
+	return framesDropped.load(memory_order_relaxed);
+}
+
+int VideoCapture::getQueueDepth() {
+	//Head first, the tail can only have moved further on since
+	uint32_t head = queueHead.load(memory_order_acquire);
+	return queueTail.load(memory_order_acquire) - head;
+}
+
+void VideoCapture::run() {
+	while (true) {
+		uint32_t head = queueHead.load(memory_order_relaxed);
+		if (head == queueTail.load(memory_order_acquire)) {
+			//Only stop once everything queued before the destructor has gone out
+			if (!running.load(memory_order_acquire) && head == queueTail.load(memory_order_acquire))
+				break;
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+
+		writeFrame(queue[head & (CAPTURE_QUEUE_FRAMES - 1)]);
+		queueHead.store(head + 1, memory_order_release);
+	}
+}
+
+//Converts two rows to Y4M, the chroma for each 2x2 block is the average of
+//its four pixels
+static void convertRowPair(const uint32_t *row0, const uint32_t *row1, const uint32_t *palette, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v) {
+#if defined(__SSE2__)
+	//8 pixels from each row at a time, the lookups themselves are scalar
+	//since there's no byte gather but everything after that is done 8 wide
+	const __m128i byteMask = _mm_set1_epi32(0xFF);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi32(2);
+	for (int x = 0; x < CAPTURE_WIDTH; x += 8) {
+		__m128i a0 = _mm_setr_epi32(palette[row0[x] & 0x1FF], palette[row0[x+1] & 0x1FF], palette[row0[x+2] & 0x1FF], palette[row0[x+3] & 0x1FF]);
+		__m128i a1 = _mm_setr_epi32(palette[row0[x+4] & 0x1FF], palette[row0[x+5] & 0x1FF], palette[row0[x+6] & 0x1FF], palette[row0[x+7] & 0x1FF]);
+		__m128i b0 = _mm_setr_epi32(palette[row1[x] & 0x1FF], palette[row1[x+1] & 0x1FF], palette[row1[x+2] & 0x1FF], palette[row1[x+3] & 0x1FF]);
+		__m128i b1 = _mm_setr_epi32(palette[row1[x+4] & 0x1FF], palette[row1[x+5] & 0x1FF], palette[row1[x+6] & 0x1FF], palette[row1[x+7] & 0x1FF]);
+
+		//Y is the low byte of each entry
+		__m128i ya = _mm_packs_epi32(_mm_and_si128(a0, byteMask), _mm_and_si128(a1, byteMask));
+		__m128i yb = _mm_packs_epi32(_mm_and_si128(b0, byteMask), _mm_and_si128(b1, byteMask));
+		_mm_storel_epi64((__m128i *)(y0 + x), _mm_packus_epi16(ya, ya));
+		_mm_storel_epi64((__m128i *)(y1 + x), _mm_packus_epi16(yb, yb));
+
+		//Add the rows together then neighbouring pixels, leaving 4 sums of 4
+		__m128i uSum = _mm_add_epi16(
+			_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a0, 8), byteMask), _mm_and_si128(_mm_srli_epi32(a1, 8), byteMask)),
+			_mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(b0, 8), byteMask), _mm_and_si128(_mm_srli_epi32(b1, 8), byteMask)));
+		__m128i vSum = _mm_add_epi16(
+			_mm_packs_epi32(_mm_srli_epi32(a0, 16), _mm_srli_epi32(a1, 16)),
+			_mm_packs_epi32(_mm_srli_epi32(b0, 16), _mm_srli_epi32(b1, 16)));
+		__m128i uAvg = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(uSum, ones), round), 2);
+		__m128i vAvg = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(vSum, ones), round), 2);
+
+		uAvg = _mm_packs_epi32(uAvg, uAvg);
+		vAvg = _mm_packs_epi32(vAvg, vAvg);
+		uint32_t uBytes = _mm_cvtsi128_si32(_mm_packus_epi16(uAvg, uAvg));
+		uint32_t vBytes = _mm_cvtsi128_si32(_mm_packus_epi16(vAvg, vAvg));
+		memcpy(u + x/2, &uBytes, 4);
+		memcpy(v + x/2, &vBytes, 4);
+	}
+#else
+	for (int x = 0; x < CAPTURE_WIDTH; x += 2) {
+		uint32_t a0 = palette[row0[x] & 0x1FF];
+		uint32_t a1 = palette[row0[x+1] & 0x1FF];
+		uint32_t b0 = palette[row1[x] & 0x1FF];
+		uint32_t b1 = palette[row1[x+1] & 0x1FF];
+
+		y0[x] = a0;
+		y0[x+1] = a1;
+		y1[x] = b0;
+		y1[x+1] = b1;
+
+		u[x/2] = (((a0 >> 8) & 0xFF) + ((a1 >> 8) & 0xFF) + ((b0 >> 8) & 0xFF) + ((b1 >> 8) & 0xFF) + 2) >> 2;
+		v[x/2] = ((a0 >> 16) + (a1 >> 16) + (b0 >> 16) + (b1 >> 16) + 2) >> 2;
+	}
+#endif
+}
+
+void VideoCapture::writeFrame(const uint32_t *indices) {
+	if (failed.load(memory_order_relaxed)) {
+		framesDropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	size_t size;
+	if (format == CAPTURE_Y4M) {
+		uint8_t *yPlane = output;
+		uint8_t *uPlane = yPlane + CAPTURE_WIDTH * CAPTURE_HEIGHT;
+		uint8_t *vPlane = uPlane + CAPTURE_WIDTH * CAPTURE_HEIGHT / 4;
+		for (int y = 0; y < CAPTURE_HEIGHT; y += 2) {
+			convertRowPair(indices + y * CAPTURE_WIDTH, indices + (y + 1) * CAPTURE_WIDTH, yuvPalette,
+				yPlane + y * CAPTURE_WIDTH, yPlane + (y + 1) * CAPTURE_WIDTH,
+				uPlane + y/2 * CAPTURE_WIDTH/2, vPlane + y/2 * CAPTURE_WIDTH/2);
+		}
+
+		fputs("FRAME\n", file);
+		size = Y4M_FRAME_SIZE;
+	}
+	else {
+		uint32_t *pixels = (uint32_t *) output;
+		for (int i = 0; i < CAPTURE_WIDTH * CAPTURE_HEIGHT; i++)
+			pixels[i] = rgbaPalette[indices[i] & 0x1FF];
+		size = CAPTURE_WIDTH * CAPTURE_HEIGHT * 4;
+	}
+
+	if (fwrite(output, 1, size, file) != size) {
+		failed.store(true, memory_order_relaxed);
+		framesDropped.fetch_add(1, memory_order_relaxed);
+		return;
+	}
+
+	framesWritten.fetch_add(1, memory_order_relaxed);
+}
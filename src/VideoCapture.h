@@ -0,0 +1,80 @@
+#ifndef VIDEOCAPTURE_H
+#define VIDEOCAPTURE_H
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+
+//What VideoCapture writes
+#define CAPTURE_Y4M			0 //YUV4MPEG2, 4:2:0 BT.601, what most encoders take on stdin
+#define CAPTURE_RGBA		1 //Bare frames of R, G, B, A bytes one after another
+
+//Frames that can be waiting to be written, must be a power of 2
+#define CAPTURE_QUEUE_FRAMES	16
+
+//Records frames to a file or an encoder on its own thread
+//
+//Frames are passed in as EEEPPPPPP output palette indices (PIXEL_FORMAT_INDEX)
+//and copied into a queue, converting and writing them happens on the
+//capture thread. Like PPUThread's queue there's one producer and one
+//consumer so only the indices are atomic. pushFrame never waits, if the
+//disk or encoder can't keep up the frame is dropped and counted instead
+class VideoCapture {
+	FILE *file;
+	bool pipe;
+	uint8_t format;
+
+	uint32_t *queue[CAPTURE_QUEUE_FRAMES];
+
+	std::atomic<uint32_t> queueHead;
+	std::atomic<uint32_t> queueTail;
+
+	std::atomic<uint64_t> framesWritten;
+	std::atomic<uint64_t> framesDropped;
+
+	//Set once a write fails, everything after that is thrown away
+	std::atomic<bool> failed;
+
+	std::atomic<bool> running;
+	std::thread thread;
+
+	//Y, U and V packed into the low 3 bytes for each output palette index
+	uint32_t yuvPalette[512];
+
+	//R, G, B, A in memory order for each output palette index
+	uint32_t rgbaPalette[512];
+
+	//One converted frame
+	uint8_t *output;
+
+	void run();
+
+	void writeFrame(const uint32_t *indices);
+
+public:
+	//Captures into filename, or to the standard input of a command if
+	//filename starts with a |
+	VideoCapture(const char *filename, uint8_t format);
+
+	//Calls finish if it hasn't been
+	~VideoCapture();
+
+	bool isOpen();
+
+	//Writes out whatever's still queued and closes the file or pipe, frames
+	//pushed after this are dropped
+	void finish();
+
+	//Queues a 256x240 frame of indices, returns false if it was dropped
+	bool pushFrame(const uint32_t *indices);
+
+	uint64_t getFramesWritten();
+
+	uint64_t getFramesDropped();
+
+	//Frames waiting to be written right now
+	int getQueueDepth();
+};
+
+#endif